@@ -70,6 +70,40 @@ defmodule ExileBench.Read do
   end
 end
 
+defmodule ExileBench.Throughput do
+  # total bytes streamed from the command per run
+  @total_size 256 * 1024 * 1024
+
+  def total_size, do: @total_size
+
+  defp exile_read_loop(s, chunk_size) do
+    case Exile.Process.read(s, chunk_size) do
+      {:ok, _data} -> exile_read_loop(s, chunk_size)
+      :eof -> :ok
+    end
+  end
+
+  def exile(chunk_size) do
+    {:ok, s} = Exile.Process.start_link(~w(head -c #{@total_size} /dev/zero))
+    :ok = exile_read_loop(s, chunk_size)
+    {:ok, 0} = Exile.Process.await_exit(s)
+  end
+
+  # prints bytes/sec for each input, derived from the average run time
+  def print_bytes_per_sec(suite) do
+    IO.puts("\nRead throughput (#{div(@total_size, 1024 * 1024)} MiB per run)")
+
+    Enum.each(suite.scenarios, fn scenario ->
+      average_ns = scenario.run_time_data.statistics.average
+      mib_per_sec = @total_size / (average_ns / 1_000_000_000) / (1024 * 1024)
+
+      IO.puts(
+        "  #{scenario.job_name} #{scenario.input_name}: #{:erlang.float_to_binary(mib_per_sec, decimals: 1)} MiB/s"
+      )
+    end)
+  end
+end
+
 read_jobs = %{
   "Exile" => fn -> ExileBench.Read.exile() end,
   "Port"  => fn ->  ExileBench.Read.port() end,
@@ -86,3 +120,22 @@ Benchee.run(read_jobs,
     Benchee.Formatters.Console
   ]
 )
+
+throughput_suite =
+  Benchee.run(
+    %{"Exile read" => fn chunk_size -> ExileBench.Throughput.exile(chunk_size) end},
+    inputs: %{
+      "64 KiB" => 64 * 1024,
+      "256 KiB" => 256 * 1024,
+      "1 MiB" => 1024 * 1024
+    },
+    warmup: 2,
+    time: 10,
+    memory_time: 1,
+    formatters: [
+      {Benchee.Formatters.HTML, file: Path.expand("output/throughput.html", __DIR__)},
+      Benchee.Formatters.Console
+    ]
+  )
+
+ExileBench.Throughput.print_bytes_per_sec(throughput_suite)
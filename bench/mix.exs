@@ -14,7 +14,10 @@ defmodule ExileBench.MixProject do
 
   defp aliases() do
     [
-      "bench.io": ["run io.exs"]
+      "bench.io": ["run io.exs"],
+      "bench.suite": ["run suite.exs"],
+      "bench.spawn": ["run suite.exs spawn"],
+      "bench.nofile": ["run nofile.exs"]
     ]
   end
 
@@ -23,6 +26,7 @@ defmodule ExileBench.MixProject do
     [
       {:benchee, "~> 1.0"},
       {:benchee_html, "~> 1.0"},
+      {:benchee_json, "~> 1.0"},
       {:exile, "~> 0.1", path: "../", override: true},
       {:ex_cmd, "~> 0.4.1"}
     ]
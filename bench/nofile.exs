@@ -0,0 +1,30 @@
+# Spawn latency depends on RLIMIT_NOFILE when the spawner has to close
+# every possible fd before exec. Run with different limits to compare:
+#
+#     for n in 1024 65536 1048576; do (ulimit -n $n && mix bench.nofile); done
+defmodule ExileBench.NoFile do
+  @count 500
+
+  def run(spawner) do
+    {time, :ok} =
+      :timer.tc(fn ->
+        Enum.each(1..@count, fn _ ->
+          {:ok, s} = Exile.Process.start_link(~w(true), spawner: spawner)
+          {:ok, 0} = Exile.Process.await_exit(s)
+        end)
+      end)
+
+    time / @count
+  end
+end
+
+{limit, 0} = System.cmd("sh", ["-c", "ulimit -n"])
+
+for spawner <- [:port, :daemon] do
+  latency = ExileBench.NoFile.run(spawner)
+
+  IO.puts(
+    "RLIMIT_NOFILE=#{String.trim(limit)} spawner=#{spawner}: " <>
+      "#{:erlang.float_to_binary(latency, decimals: 1)} µs per spawn"
+  )
+end
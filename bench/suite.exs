@@ -0,0 +1,384 @@
+# Benchmark suite. Each scenario writes machine-readable results to
+# `output/<scenario>.json` (Benchee JSON format), so results can be
+# compared across commits.
+#
+#     mix bench.suite                 # all scenarios
+#     mix bench.suite spawn stream    # selected scenarios
+defmodule ExileBench.Suite do
+  @output_dir Path.expand("output", __DIR__)
+
+  def run(name, jobs, opts \\ []) do
+    formatters = [
+      {Benchee.Formatters.JSON, file: Path.join(@output_dir, "#{name}.json")},
+      Benchee.Formatters.Console
+    ]
+
+    Benchee.run(jobs, Keyword.merge([warmup: 2, time: 10, formatters: formatters], opts))
+  end
+
+  # for metrics which are not run time, such as read_any fairness
+  def write_json(name, data) do
+    File.mkdir_p!(@output_dir)
+    File.write!(Path.join(@output_dir, "#{name}.json"), Jason.encode!(data, pretty: true))
+  end
+
+  defp read_until_eof(s, acc \\ 0) do
+    case Exile.Process.read(s) do
+      {:ok, data} -> read_until_eof(s, acc + IO.iodata_length(data))
+      :eof -> acc
+    end
+  end
+
+  def run_to_completion(cmd_with_args, opts \\ []) do
+    {:ok, s} = Exile.Process.start_link(cmd_with_args, opts)
+    size = read_until_eof(s)
+    {:ok, 0} = Exile.Process.await_exit(s)
+    size
+  end
+
+  def mib(bytes), do: div(bytes, 1024 * 1024)
+end
+
+defmodule ExileBench.Scenario.Spawn do
+  # spawn and exit rate of `true`
+  alias ExileBench.Suite
+
+  @count 200
+
+  def run do
+    Suite.run("spawn", %{
+      "Exile port spawner" => fn -> spawn_all(:port) end,
+      "Exile daemon spawner" => fn -> spawn_all(:daemon) end,
+      "Port" => fn -> spawn_all_ports() end
+    })
+  end
+
+  defp spawn_all(spawner) do
+    concurrently(fn -> Suite.run_to_completion(~w(true), spawner: spawner) end)
+  end
+
+  defp spawn_all_ports do
+    true_path = System.find_executable("true")
+
+    concurrently(fn ->
+      port = Port.open({:spawn_executable, true_path}, [:exit_status])
+
+      receive do
+        {^port, {:exit_status, 0}} -> :ok
+      end
+    end)
+  end
+
+  defp concurrently(fun) do
+    1..@count
+    |> Task.async_stream(fn _ -> fun.() end,
+      max_concurrency: System.schedulers_online(),
+      ordered: false
+    )
+    |> Stream.run()
+  end
+end
+
+defmodule ExileBench.Scenario.Stream do
+  # large unidirectional stdout streaming
+  alias ExileBench.Suite
+
+  @total_size 1024 * 1024 * 1024
+
+  def run do
+    Suite.run(
+      "stream",
+      %{
+        "Exile.stream!" => fn chunk_size ->
+          Exile.stream!(~w(head -c #{@total_size} /dev/zero), max_chunk_size: chunk_size)
+          |> Stream.run()
+        end
+      },
+      inputs: %{
+        "#{Suite.mib(@total_size)} MiB, 64 KiB chunks" => 64 * 1024,
+        "#{Suite.mib(@total_size)} MiB, 1 MiB chunks" => 1024 * 1024
+      },
+      warmup: 1,
+      time: 20,
+      memory_time: 1
+    )
+  end
+end
+
+defmodule ExileBench.Scenario.Sink do
+  # stdin heavy workload, command only consumes the input
+  alias ExileBench.Suite
+
+  @total_size 256 * 1024 * 1024
+
+  def run do
+    Suite.run(
+      "sink",
+      %{
+        "Exile.stream! input" => fn {chunk, count} ->
+          input = Stream.repeatedly(fn -> chunk end) |> Stream.take(count)
+
+          Exile.stream!(["sh", "-c", "cat > /dev/null"], input: input)
+          |> Stream.run()
+        end
+      },
+      inputs:
+        Map.new([4 * 1024, 64 * 1024, 1024 * 1024], fn size ->
+          {"#{Suite.mib(@total_size)} MiB, #{div(size, 1024)} KiB writes",
+           {:binary.copy("A", size), div(@total_size, size)}}
+        end),
+      memory_time: 1
+    )
+  end
+end
+
+defmodule ExileBench.Scenario.Stderr do
+  # stdout and stderr written concurrently and consumed together
+  alias ExileBench.Suite
+
+  @size 128 * 1024 * 1024
+
+  def run do
+    script = "head -c #{@size} /dev/zero & head -c #{@size} /dev/zero >&2; wait"
+
+    Suite.run("stderr", %{
+      "Exile.stream! stderr: :consume" => fn ->
+        Exile.stream!(["sh", "-c", script], stderr: :consume)
+        |> Stream.run()
+      end
+    })
+  end
+end
+
+defmodule ExileBench.Scenario.ReadAny do
+  # `read_any` when both stdout and stderr always have data
+  alias ExileBench.Suite
+
+  @reads 10_000
+  @script "cat /dev/zero & cat /dev/zero >&2; wait"
+
+  def run do
+    Suite.run("read_any", %{"read_any #{@reads} reads" => fn -> read_any(@reads) end})
+
+    %{stdout: stdout, stderr: stderr} = read_any(@reads)
+
+    Suite.write_json("read_any_fairness", %{
+      reads: @reads,
+      stdout_bytes: stdout,
+      stderr_bytes: stderr,
+      stdout_share: stdout / (stdout + stderr)
+    })
+
+    IO.puts("\nread_any share of stdout: #{Float.round(stdout / (stdout + stderr), 3)}")
+  end
+
+  defp read_any(reads) do
+    {:ok, s} = Exile.Process.start_link(["sh", "-c", @script], stderr: :consume)
+
+    counts =
+      Enum.reduce(1..reads, %{stdout: 0, stderr: 0}, fn _, acc ->
+        {:ok, {stream, data}} = Exile.Process.read_any(s)
+        Map.update!(acc, stream, &(&1 + IO.iodata_length(data)))
+      end)
+
+    :ok = Exile.Process.kill(s, :sigkill)
+    {:ok, _} = Exile.Process.await_exit(s)
+    counts
+  end
+end
+
+defmodule ExileBench.Scenario.StartMany do
+  # batch start versus starting commands one by one
+  alias ExileBench.Suite
+
+  def run do
+    Suite.run(
+      "start_many",
+      %{
+        "start_link loop" => fn cmds ->
+          cmds
+          |> Enum.map(fn cmd_with_args ->
+            {:ok, s} = Exile.Process.start_link(cmd_with_args, spawner: :daemon)
+            s
+          end)
+          |> Enum.each(&({:ok, 0} = Exile.Process.await_exit(&1)))
+        end,
+        "start_many" => fn cmds ->
+          {:ok, processes} = Exile.Process.start_many(cmds, spawner: :daemon)
+          Enum.each(processes, &({:ok, 0} = Exile.Process.await_exit(&1)))
+        end
+      },
+      inputs: %{
+        "100 commands" => List.duplicate(~w(true), 100),
+        "500 commands" => List.duplicate(~w(true), 500)
+      }
+    )
+  end
+end
+
+defmodule ExileBench.Scenario.Concurrent do
+  # many processes streaming at the same time
+  alias ExileBench.Suite
+
+  @size 1024 * 1024
+
+  def run do
+    Suite.run(
+      "concurrent",
+      %{
+        "Exile processes" => fn count ->
+          1..count
+          |> Task.async_stream(
+            fn _ -> Suite.run_to_completion(~w(head -c #{@size} /dev/zero)) end,
+            max_concurrency: count,
+            timeout: :infinity
+          )
+          |> Stream.run()
+        end
+      },
+      inputs: %{
+        "100 x #{Suite.mib(@size)} MiB" => 100,
+        "500 x #{Suite.mib(@size)} MiB" => 500
+      }
+    )
+  end
+end
+
+defmodule ExileBench.Scenario.Scheduler do
+  # NIF IO on dirty IO schedulers versus normal schedulers. Latency is
+  # small request-response round-trips through `cat`, throughput is
+  # streaming and round-trips from many processes at the same time
+  alias ExileBench.Suite
+
+  @round_trips 1000
+  @total_size 256 * 1024 * 1024
+  @concurrency 200
+  @schedulers [:dirty_io, :normal]
+
+  def run do
+    Suite.run(
+      "scheduler_latency",
+      Map.new(@schedulers, fn scheduler ->
+        {"#{scheduler} #{@round_trips} round-trips", fn -> round_trips(scheduler) end}
+      end)
+    )
+
+    Suite.run(
+      "scheduler_throughput",
+      Map.new(@schedulers, fn scheduler ->
+        {"#{scheduler} #{Suite.mib(@total_size)} MiB stream",
+         fn ->
+           Exile.stream!(~w(head -c #{@total_size} /dev/zero), nif_scheduler: scheduler)
+           |> Stream.run()
+         end}
+      end),
+      memory_time: 1
+    )
+
+    Suite.run(
+      "scheduler_concurrent",
+      Map.new(@schedulers, fn scheduler ->
+        {"#{scheduler} #{@concurrency} processes",
+         fn ->
+           1..@concurrency
+           |> Task.async_stream(fn _ -> round_trips(scheduler) end,
+             max_concurrency: @concurrency,
+             timeout: :infinity
+           )
+           |> Stream.run()
+         end}
+      end)
+    )
+  end
+
+  defp round_trips(scheduler) do
+    {:ok, s} = Exile.Process.start_link(~w(cat), nif_scheduler: scheduler)
+    request = :binary.copy("A", 64)
+
+    Enum.each(1..@round_trips, fn _ ->
+      :ok = Exile.Process.write(s, request)
+      {:ok, _} = Exile.Process.read(s, 64)
+    end)
+
+    :ok = Exile.Process.close_stdin(s)
+    {:ok, 0} = Exile.Process.await_exit(s)
+  end
+end
+
+defmodule ExileBench.Scenario.Footprint do
+  # VM memory and processes used by each running program. Not a timing
+  # run, results are written with `Suite.write_json/2`
+  @count 1000
+
+  def run do
+    results = Map.new([:port, :daemon], fn spawner -> {spawner, measure(spawner)} end)
+    ExileBench.Suite.write_json("footprint", Map.put(results, :programs, @count))
+
+    Enum.each(results, fn {spawner, result} ->
+      IO.puts(
+        "#{spawner} spawner, per program: #{result.bytes_per_program} bytes, " <>
+          "#{result.processes_per_program} processes, #{result.ports_per_program} ports"
+      )
+    end)
+  end
+
+  defp measure(spawner) do
+    # daemon is started lazily, so it is not counted as a program
+    _ = ExileBench.Suite.run_to_completion(~w(true), spawner: spawner)
+    :erlang.garbage_collect()
+    before = snapshot()
+
+    processes =
+      Enum.map(1..@count, fn _ ->
+        {:ok, s} = Exile.Process.start_link(~w(cat), spawner: spawner)
+        {:ok, _} = Exile.Process.os_pid(s)
+        s
+      end)
+
+    Enum.each(Process.list(), &:erlang.garbage_collect/1)
+    after_start = snapshot()
+
+    Enum.each(processes, fn s ->
+      :ok = Exile.Process.close_stdin(s)
+      {:ok, 0} = Exile.Process.await_exit(s)
+    end)
+
+    %{
+      bytes_per_program: div(after_start.memory - before.memory, @count),
+      processes_per_program: (after_start.processes - before.processes) / @count,
+      ports_per_program: (after_start.ports - before.ports) / @count
+    }
+  end
+
+  defp snapshot do
+    %{
+      memory: :erlang.memory(:total),
+      processes: :erlang.system_info(:process_count),
+      ports: :erlang.system_info(:port_count)
+    }
+  end
+end
+
+scenarios = %{
+  "spawn" => ExileBench.Scenario.Spawn,
+  "stream" => ExileBench.Scenario.Stream,
+  "sink" => ExileBench.Scenario.Sink,
+  "stderr" => ExileBench.Scenario.Stderr,
+  "read_any" => ExileBench.Scenario.ReadAny,
+  "concurrent" => ExileBench.Scenario.Concurrent,
+  "start_many" => ExileBench.Scenario.StartMany,
+  "scheduler" => ExileBench.Scenario.Scheduler,
+  "footprint" => ExileBench.Scenario.Footprint
+}
+
+selected = if System.argv() == [], do: Map.keys(scenarios), else: System.argv()
+
+Enum.each(selected, fn name ->
+  case Map.fetch(scenarios, name) do
+    {:ok, scenario} ->
+      scenario.run()
+
+    :error ->
+      raise "unknown scenario: #{name}, available: #{Enum.join(Map.keys(scenarios), ", ")}"
+  end
+end)
@@ -1,24 +1,64 @@
+#ifdef __linux__
+/* for F_SETPIPE_SZ, splice(2) and syscall(2) */
+#define _GNU_SOURCE
+#endif
+
 #include "erl_nif.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include "exile_ring.h"
 #include "utils.h"
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) ||      \
+    defined(__OpenBSD__) || defined(__DragonFly__)
+#include <sys/event.h>
+#endif
+
 #ifdef ERTS_DIRTY_SCHEDULERS
 #define USE_DIRTY_IO ERL_NIF_DIRTY_JOB_IO_BOUND
 #else
 #define USE_DIRTY_IO 0
 #endif
 
+/* maximum number of binaries returned by a single draining read */
+#define DRAIN_MAX_CHUNKS 64
+
+/* size of a pooled read buffer, see `read_fd_pooled` */
+#define BUFFER_POOL_BUFFER_SIZE 65536
+/* free buffers kept by a process, the rest are freed on release */
+#define BUFFER_POOL_MAX_FREE 16
+/* reads smaller than this are copied to a regular binary, so that a
+ * small read does not hold a whole buffer */
+#define BUFFER_POOL_COPY_THRESHOLD 4096
+
 static const int UNBUFFERED_READ = -1;
 static const int PIPE_BUF_SIZE = 65535;
 static const int FD_CLOSED = -1;
+/* maximum bytes moved by a single splice(2) call */
+static const int SPLICE_CHUNK_SIZE = 1048576;
+/* time budget for the draining loop in microseconds, roughly the
+ * length of a single timeslice */
+static const ErlNifTime DRAIN_TIME_BUDGET = 1000;
+/* maximum bytes passed to a single write(2)/writev(2) call, larger
+ * writes are done in chunks and continued with enif_schedule_nif once
+ * the time budget is used */
+static const size_t WRITE_CHUNK_SIZE = 262144;
+/* POSIX minimum (_XOPEN_IOV_MAX), updated from sysconf on load */
+static int MAX_IOV_COUNT = 16;
 
 static ERL_NIF_TERM ATOM_TRUE;
 static ERL_NIF_TERM ATOM_FALSE;
@@ -26,28 +66,165 @@ static ERL_NIF_TERM ATOM_OK;
 static ERL_NIF_TERM ATOM_ERROR;
 static ERL_NIF_TERM ATOM_UNDEFINED;
 static ERL_NIF_TERM ATOM_INVALID_FD;
+static ERL_NIF_TERM ATOM_INVALID_PEER;
 static ERL_NIF_TERM ATOM_SELECT_CANCEL_ERROR;
 static ERL_NIF_TERM ATOM_EAGAIN;
 static ERL_NIF_TERM ATOM_EPIPE;
+static ERL_NIF_TERM ATOM_ENOTSUP;
+static ERL_NIF_TERM ATOM_CONTINUE;
+
+static ERL_NIF_TERM ATOM_BYTES_READ;
+static ERL_NIF_TERM ATOM_BYTES_WRITTEN;
+static ERL_NIF_TERM ATOM_READS;
+static ERL_NIF_TERM ATOM_WRITES;
+static ERL_NIF_TERM ATOM_PARTIAL_WRITES;
+static ERL_NIF_TERM ATOM_SELECTS;
+
+static ERL_NIF_TERM ATOM_ALLOCATED;
+static ERL_NIF_TERM ATOM_REUSED;
+static ERL_NIF_TERM ATOM_COPIED;
+static ERL_NIF_TERM ATOM_FREE;
 
 static ERL_NIF_TERM ATOM_SIGTERM;
 static ERL_NIF_TERM ATOM_SIGKILL;
 static ERL_NIF_TERM ATOM_SIGPIPE;
 
-static void close_fd(int *fd) {
-  if (*fd != FD_CLOSED) {
-    close(*fd);
-    *fd = FD_CLOSED;
-  }
-}
-
-static int cancel_select(ErlNifEnv *env, int *fd) {
+static ERL_NIF_TERM ATOM_SELECT;
+static ERL_NIF_TERM ATOM_READY_INPUT;
+static ERL_NIF_TERM ATOM_READY_OUTPUT;
+static ERL_NIF_TERM ATOM_STDIN;
+static ERL_NIF_TERM ATOM_STDOUT;
+static ERL_NIF_TERM ATOM_STDERR;
+
+static ERL_NIF_TERM ATOM_DELIMITER;
+static ERL_NIF_TERM ATOM_LENGTH_PREFIXED;
+static ERL_NIF_TERM ATOM_INCOMPLETE_RECORD;
+static ERL_NIF_TERM ATOM_RECORD_TOO_LARGE;
+
+/* per fd counters, returned by `nif_fd_stats/1`. These are updated
+ * without synchronization, so they are approximate when more than one
+ * process does IO on the same fd concurrently */
+typedef struct {
+  ErlNifUInt64 bytes_read;
+  ErlNifUInt64 bytes_written;
+  /* read(2) and splice(2) calls on the fd */
+  ErlNifUInt64 reads;
+  /* write(2), writev(2) and splice(2) calls on the fd */
+  ErlNifUInt64 writes;
+  /* writes which were only partially satisfied since the pipe is full */
+  ErlNifUInt64 partial_writes;
+  /* number of times select is armed, i.e. an operation hit EAGAIN */
+  ErlNifUInt64 selects;
+} io_stats_t;
+
+enum { FRAMING_NONE, FRAMING_DELIMITER, FRAMING_LENGTH_PREFIXED };
+
+/* when set, reads return a list of complete records instead of raw
+ * bytes. See `nif_set_framing/2` */
+typedef struct {
+  int mode;
+  /* record separator for FRAMING_DELIMITER */
+  unsigned char delimiter;
+  /* size of the big-endian length header for FRAMING_LENGTH_PREFIXED */
+  int prefix_size;
+  /* records larger than this fail the read, 0 for no limit */
+  size_t max_record_size;
+  /* incomplete record left over by the previous read, reads append to
+   * it. `carry.size` is the capacity and `carry_size` the bytes used */
+  ErlNifBinary carry;
+  size_t carry_size;
+  /* carried bytes known not to contain the delimiter */
+  size_t scanned;
+  /* bytes of an oversized length prefixed record still to be dropped,
+   * for delimited records any non-zero value drops up to the delimiter */
+  size_t discard;
+} framing_t;
+
+/* Shared memory ring set up by the spawner for `stdout: {:ring, _}`, see
+ * `c_src/exile_ring.h`. Reads are served from the ring and the stdout
+ * pipe only carries the doorbell and EOF */
+typedef struct {
+  exile_ring_t *shared;
+  /* validated by `exile_ring_map`, the header is writable by the
+   * command so it is never read from there */
+  uint64_t capacity;
+  /* rung after consuming when the command is waiting for space */
+  int doorbell_fd;
+} ring_t;
+
+/* output accumulated by `nif_read_all/2` till EOF */
+typedef struct {
+  ErlNifBinary bin;
+  /* bytes of `bin` filled so far */
+  size_t size;
+  bool allocated;
+} collect_t;
+
+typedef struct {
+  int fd;
+  /* pending stdin data which is not yet written to the pipe. Created
+   * lazily on the first vectored write */
+  ErlNifIOQueue *write_queue;
+  io_stats_t stats;
+  framing_t framing;
+  /* NULL unless reads are served from a shared memory ring */
+  ring_t *ring;
+  collect_t collect;
+  /* resource passed to enif_select. Same as the io resource for a
+   * standalone fd, or the process resource for a process pipe */
+  void *select_obj;
+  /* pipe name for a process pipe, `undefined` for a standalone fd */
+  ERL_NIF_TERM name;
+} io_resource_t;
+
+enum { PIPE_STDIN, PIPE_STDOUT, PIPE_STDERR, PIPE_COUNT };
+
+/* Free list of fixed size read buffers of a process. Buffers are handed
+ * to the VM as resource binaries and come back here when the binary is
+ * garbage collected, so a busy pipe reuses the same few buffers instead
+ * of allocating a new binary for every read. Buffers are released by
+ * whichever scheduler runs the GC, hence the lock */
+typedef struct {
+  ErlNifMutex *lock;
+  unsigned char *free[BUFFER_POOL_MAX_FREE];
+  int free_count;
+  /* buffers allocated because the free list was empty */
+  ErlNifUInt64 allocated;
+  /* reads served by a buffer from the free list */
+  ErlNifUInt64 reused;
+  /* small reads copied to a regular binary */
+  ErlNifUInt64 copied;
+} buffer_pool_t;
+
+/* All stdio pipes of a spawned program under a single resource, with a
+ * single monitor on the owner. A pipe is referred to from Erlang as
+ * `{process_resource, pipe_name}` */
+typedef struct {
+  pid_t os_pid;
+  io_resource_t pipes[PIPE_COUNT];
+  /* pipe served first by the next `nif_read_any/3` */
+  int read_any_next;
+  /* NULL unless pooled read buffers are enabled */
+  buffer_pool_t *buffers;
+} process_resource_t;
+
+/* Resource behind a binary returned from a pooled buffer. Keeps the
+ * process resource, and so the pool, alive till the buffer is back */
+typedef struct {
+  process_resource_t *proc;
+  unsigned char *data;
+} buffer_resource_t;
+
+static int cancel_select(ErlNifEnv *env, io_resource_t *res) {
   int ret;
 
-  if (*fd != FD_CLOSED) {
-    ret = enif_select(env, *fd, ERL_NIF_SELECT_STOP, fd, NULL, ATOM_UNDEFINED);
+  if (res->fd != FD_CLOSED) {
+    ret = enif_select(env, res->fd, ERL_NIF_SELECT_STOP, res->select_obj,
+                      NULL, ATOM_UNDEFINED);
     if (ret < 0)
       perror("cancel_select()");
+    else // fd is closed by the stop callback
+      res->fd = FD_CLOSED;
 
     return ret;
   }
@@ -56,25 +233,151 @@ static int cancel_select(ErlNifEnv *env, int *fd) {
 }
 
 static void io_resource_dtor(ErlNifEnv *env, void *obj) {
+  io_resource_t *res = (io_resource_t *)obj;
+
+  if (res->write_queue != NULL) {
+    enif_ioq_destroy(res->write_queue);
+    res->write_queue = NULL;
+  }
+
+  if (res->framing.carry.data != NULL) {
+    enif_release_binary(&res->framing.carry);
+    res->framing.carry.data = NULL;
+  }
+
+  if (res->ring != NULL) {
+    exile_ring_unmap(res->ring->shared, res->ring->capacity);
+    close(res->ring->doorbell_fd);
+    enif_free(res->ring);
+    res->ring = NULL;
+  }
+
+  if (res->collect.allocated) {
+    enif_release_binary(&res->collect.bin);
+    res->collect.allocated = false;
+  }
+
   debug("Exile io_resource_dtor called");
 }
 
 static void io_resource_stop(ErlNifEnv *env, void *obj, int fd,
                              int is_direct_call) {
-  close_fd(&fd);
+  if (fd != FD_CLOSED)
+    close(fd);
   debug("Exile io_resource_stop called %d", fd);
 }
 
 static void io_resource_down(ErlNifEnv *env, void *obj, ErlNifPid *pid,
                              ErlNifMonitor *monitor) {
-  int *fd = (int *)obj;
-  cancel_select(env, fd);
+  io_resource_t *res = (io_resource_t *)obj;
+  cancel_select(env, res);
   debug("Exile io_resource_down called");
 }
 
+static void process_resource_dtor(ErlNifEnv *env, void *obj) {
+  process_resource_t *proc = (process_resource_t *)obj;
+  int i;
+
+  for (i = 0; i < PIPE_COUNT; i++)
+    io_resource_dtor(env, &proc->pipes[i]);
+
+  /* all buffers are back, since each of them keeps the resource */
+  if (proc->buffers != NULL) {
+    for (i = 0; i < proc->buffers->free_count; i++)
+      enif_free(proc->buffers->free[i]);
+    enif_mutex_destroy(proc->buffers->lock);
+    enif_free(proc->buffers);
+    proc->buffers = NULL;
+  }
+
+  debug("Exile process_resource_dtor called");
+}
+
+static void process_resource_down(ErlNifEnv *env, void *obj, ErlNifPid *pid,
+                                  ErlNifMonitor *monitor) {
+  process_resource_t *proc = (process_resource_t *)obj;
+  int i;
+
+  for (i = 0; i < PIPE_COUNT; i++)
+    cancel_select(env, &proc->pipes[i]);
+
+  debug("Exile process_resource_down called");
+}
+
+static void buffer_resource_dtor(ErlNifEnv *env, void *obj) {
+  buffer_resource_t *buf = (buffer_resource_t *)obj;
+  buffer_pool_t *pool = buf->proc->buffers;
+
+  enif_mutex_lock(pool->lock);
+  if (pool->free_count < BUFFER_POOL_MAX_FREE) {
+    pool->free[pool->free_count++] = buf->data;
+    buf->data = NULL;
+  }
+  enif_mutex_unlock(pool->lock);
+
+  if (buf->data != NULL)
+    enif_free(buf->data);
+
+  enif_release_resource(buf->proc);
+}
+
 static ErlNifResourceTypeInit io_rt_init;
+static ErlNifResourceTypeInit process_rt_init;
+static ErlNifResourceTypeInit buffer_rt_init;
 
 static ErlNifResourceType *FD_RT;
+static ErlNifResourceType *PROCESS_RT;
+static ErlNifResourceType *BUFFER_RT;
+
+/* Accepts either a standalone fd resource or `{process_resource, name}`
+ * for a pipe of a process resource */
+static bool get_io_resource(ErlNifEnv *env, ERL_NIF_TERM term,
+                            io_resource_t **res) {
+  const ERL_NIF_TERM *tuple;
+  process_resource_t *proc;
+  int arity;
+
+  if (enif_get_resource(env, term, FD_RT, (void **)res))
+    return true;
+
+  if (!enif_get_tuple(env, term, &arity, &tuple) || arity != 2 ||
+      !enif_get_resource(env, tuple[0], PROCESS_RT, (void **)&proc))
+    return false;
+
+  if (enif_is_identical(tuple[1], ATOM_STDIN))
+    *res = &proc->pipes[PIPE_STDIN];
+  else if (enif_is_identical(tuple[1], ATOM_STDOUT))
+    *res = &proc->pipes[PIPE_STDOUT];
+  else if (enif_is_identical(tuple[1], ATOM_STDERR))
+    *res = &proc->pipes[PIPE_STDERR];
+  else
+    return false;
+
+  return true;
+}
+
+/* Process pipes use a custom select message so that the message carries
+ * the same `{process_resource, name}` term used to refer to the pipe,
+ * `{select, {process_resource, name}, undefined, ready_input}` */
+static int select_pipe(ErlNifEnv *env, io_resource_t *res, int mode) {
+  ERL_NIF_TERM handle, msg;
+
+  if (enif_is_identical(res->name, ATOM_UNDEFINED))
+    return enif_select(env, res->fd, mode, res, NULL, ATOM_UNDEFINED);
+
+  handle = enif_make_tuple2(env, enif_make_resource(env, res->select_obj),
+                            res->name);
+
+  if (mode == ERL_NIF_SELECT_READ) {
+    msg = enif_make_tuple4(env, ATOM_SELECT, handle, ATOM_UNDEFINED,
+                           ATOM_READY_INPUT);
+    return enif_select_read(env, res->fd, res->select_obj, NULL, msg, NULL);
+  }
+
+  msg = enif_make_tuple4(env, ATOM_SELECT, handle, ATOM_UNDEFINED,
+                         ATOM_READY_OUTPUT);
+  return enif_select_write(env, res->fd, res->select_obj, NULL, msg, NULL);
+}
 
 static inline ERL_NIF_TERM make_ok(ErlNifEnv *env, ERL_NIF_TERM term) {
   return enif_make_tuple2(env, ATOM_OK, term);
@@ -84,6 +387,22 @@ static inline ERL_NIF_TERM make_error(ErlNifEnv *env, ERL_NIF_TERM term) {
   return enif_make_tuple2(env, ATOM_ERROR, term);
 }
 
+static inline void count_read(io_resource_t *res, ssize_t result) {
+  res->stats.reads++;
+  if (result > 0)
+    res->stats.bytes_read += result;
+}
+
+static inline void count_write(io_resource_t *res, ssize_t result,
+                               size_t requested) {
+  res->stats.writes++;
+  if (result > 0) {
+    res->stats.bytes_written += result;
+    if ((size_t)result < requested)
+      res->stats.partial_writes++;
+  }
+}
+
 /* time is assumed to be in microseconds */
 static void notify_consumed_timeslice(ErlNifEnv *env, ErlNifTime start,
                                       ErlNifTime stop) {
@@ -97,51 +416,85 @@ static void notify_consumed_timeslice(ErlNifEnv *env, ErlNifTime start,
   enif_consume_timeslice(env, pct);
 }
 
-static int select_write(ErlNifEnv *env, int *fd) {
-  int ret =
-      enif_select(env, *fd, ERL_NIF_SELECT_WRITE, fd, NULL, ATOM_UNDEFINED);
+static int select_write(ErlNifEnv *env, io_resource_t *res) {
+  int ret = select_pipe(env, res, ERL_NIF_SELECT_WRITE);
 
   if (ret != 0)
     perror("select_write()");
+  else
+    res->stats.selects++;
   return ret;
 }
 
-static ERL_NIF_TERM nif_write(ErlNifEnv *env, int argc,
-                              const ERL_NIF_TERM argv[]) {
-  ASSERT_ARGC(argc, 2);
+static ERL_NIF_TERM nif_write_continue(ErlNifEnv *env, int argc,
+                                       const ERL_NIF_TERM argv[]);
 
+/* writes `argv[1]` from `offset` in chunks of WRITE_CHUNK_SIZE. When
+ * the time budget is used before the whole binary is written, the rest
+ * is written by a continuation on the same kind of scheduler (`flags`),
+ * which returns the same result as a single call. So a large write
+ * does not hold the scheduler */
+static ERL_NIF_TERM write_binary(ErlNifEnv *env, const ERL_NIF_TERM argv[],
+                                 size_t offset, int flags) {
   ErlNifTime start;
   ssize_t size;
+  size_t chunk_size, written;
   ErlNifBinary bin;
   int write_errno;
-  int *fd;
+  io_resource_t *res;
+  ERL_NIF_TERM args[4];
 
   start = enif_monotonic_time(ERL_NIF_USEC);
 
-  if (!enif_get_resource(env, argv[0], FD_RT, (void **)&fd))
+  if (!get_io_resource(env, argv[0], &res))
     return make_error(env, ATOM_INVALID_FD);
 
   if (enif_inspect_binary(env, argv[1], &bin) != true)
     return enif_make_badarg(env);
 
-  if (bin.size == 0)
+  if (bin.size == 0 || offset >= bin.size)
     return enif_make_badarg(env);
 
-  /* should we limit the bin.size here? */
-  size = write(*fd, bin.data, bin.size);
-  write_errno = errno;
+  written = offset;
+  for (;;) {
+    chunk_size = bin.size - written;
+    if (chunk_size > WRITE_CHUNK_SIZE)
+      chunk_size = WRITE_CHUNK_SIZE;
+
+    size = write(res->fd, bin.data + written, chunk_size);
+    write_errno = errno;
+    count_write(res, size, chunk_size);
+
+    if (size < 0)
+      break;
+
+    written += size;
+    if (written == bin.size || (size_t)size < chunk_size)
+      break;
+
+    if (enif_monotonic_time(ERL_NIF_USEC) - start >= DRAIN_TIME_BUDGET) {
+      notify_consumed_timeslice(env, start,
+                                enif_monotonic_time(ERL_NIF_USEC));
+      args[0] = argv[0];
+      args[1] = argv[1];
+      args[2] = enif_make_uint64(env, written);
+      args[3] = enif_make_int(env, flags);
+      return enif_schedule_nif(env, "nif_write", flags, nif_write_continue,
+                               4, args);
+    }
+  }
 
   notify_consumed_timeslice(env, start, enif_monotonic_time(ERL_NIF_USEC));
 
-  if (size >= (ssize_t)bin.size) { // request completely satisfied
-    return make_ok(env, enif_make_int(env, size));
-  } else if (size >= 0) { // request partially satisfied
-    int retval = select_write(env, fd);
+  if (written == bin.size) { // request completely satisfied
+    return make_ok(env, enif_make_uint64(env, written));
+  } else if (size >= 0 || written > 0) { // request partially satisfied
+    int retval = select_write(env, res);
     if (retval != 0)
       return make_error(env, enif_make_int(env, retval));
-    return make_ok(env, enif_make_int(env, size));
+    return make_ok(env, enif_make_uint64(env, written));
   } else if (write_errno == EAGAIN || write_errno == EWOULDBLOCK) { // busy
-    int retval = select_write(env, fd);
+    int retval = select_write(env, res);
     if (retval != 0)
       return make_error(env, enif_make_int(env, retval));
     return make_error(env, ATOM_EAGAIN);
@@ -153,81 +506,390 @@ static ERL_NIF_TERM nif_write(ErlNifEnv *env, int argc,
   }
 }
 
-static int select_read(ErlNifEnv *env, int *fd) {
-  int ret =
-      enif_select(env, *fd, ERL_NIF_SELECT_READ, fd, NULL, ATOM_UNDEFINED);
+static ERL_NIF_TERM nif_write_continue(ErlNifEnv *env, int argc,
+                                       const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 4);
+
+  ErlNifUInt64 offset;
+  int flags;
+
+  if (!enif_get_uint64(env, argv[2], &offset) ||
+      !enif_get_int(env, argv[3], &flags))
+    return enif_make_badarg(env);
+
+  return write_binary(env, argv, (size_t)offset, flags);
+}
+
+static ERL_NIF_TERM nif_write(ErlNifEnv *env, int argc,
+                              const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 2);
+  return write_binary(env, argv, 0, USE_DIRTY_IO);
+}
+
+static ERL_NIF_TERM nif_write_normal(ErlNifEnv *env, int argc,
+                                     const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 2);
+  return write_binary(env, argv, 0, 0);
+}
+
+/* writes as much of the pending write queue as possible, in chunks of
+ * at most WRITE_CHUNK_SIZE bytes. Returns `:ok` when the queue is
+ * drained, otherwise select is armed and the unwritten tail stays in
+ * the queue for the next flush. When `yield` is set and the time budget
+ * since `start` is used while the fd is still writable, `continue` is
+ * returned instead, and the caller is expected to reschedule the flush */
+static ERL_NIF_TERM flush_write_queue(ErlNifEnv *env, io_resource_t *res,
+                                      ErlNifTime start, bool yield) {
+  ErlNifIOQueue *queue = res->write_queue;
+  SysIOVec *iov;
+  ssize_t size;
+  size_t batch_size;
+  int iovcnt, i;
+  int write_errno;
+
+  while (enif_ioq_size(queue) > 0) {
+    iov = enif_ioq_peek(queue, &iovcnt);
+    if (iovcnt > MAX_IOV_COUNT)
+      iovcnt = MAX_IOV_COUNT;
+
+    batch_size = 0;
+    for (i = 0; i < iovcnt; i++) {
+      if (batch_size + iov[i].iov_len > WRITE_CHUNK_SIZE)
+        break;
+      batch_size += iov[i].iov_len;
+    }
+
+    if (i == 0) { // head binary alone is larger than the chunk
+      batch_size = WRITE_CHUNK_SIZE;
+      size = write(res->fd, iov[0].iov_base, batch_size);
+    } else {
+      size = writev(res->fd, (struct iovec *)iov, i);
+    }
+    write_errno = errno;
+    count_write(res, size, batch_size);
+
+    if (size < 0) {
+      if (write_errno == EAGAIN || write_errno == EWOULDBLOCK) // busy
+        break;
+
+      /* pending data can never be written after an error */
+      enif_ioq_deq(queue, enif_ioq_size(queue), NULL);
+
+      if (write_errno == EPIPE)
+        return make_error(env, ATOM_EPIPE);
+
+      perror("writev()");
+      return make_error(env, enif_make_int(env, write_errno));
+    }
+
+    if (!enif_ioq_deq(queue, size, NULL))
+      return make_error(env, ATOM_ERROR);
+
+    if ((size_t)size < batch_size) // partially satisfied, pipe is full
+      break;
+
+    if (enif_ioq_size(queue) > 0 &&
+        enif_monotonic_time(ERL_NIF_USEC) - start >= DRAIN_TIME_BUDGET) {
+      if (yield)
+        return ATOM_CONTINUE;
+      /* select fires right away, the caller gets a chance to yield */
+      break;
+    }
+  }
+
+  if (enif_ioq_size(queue) == 0)
+    return ATOM_OK;
+
+  int retval = select_write(env, res);
+  if (retval != 0)
+    return make_error(env, enif_make_int(env, retval));
+  return make_error(env, ATOM_EAGAIN);
+}
+
+static ERL_NIF_TERM nif_write_iov_continue(ErlNifEnv *env, int argc,
+                                           const ERL_NIF_TERM argv[]);
+
+/* Writes a list of binaries (as returned by `erlang:iolist_to_iovec/1`)
+ * using writev(2) without flattening. Unwritten data is kept in the
+ * resource write queue and is written on the subsequent call, so on
+ * `{:error, :eagain}` the caller should retry with an empty list once the
+ * fd is ready for writing. `flags` is the scheduler of the continuation */
+static ERL_NIF_TERM write_iov(ErlNifEnv *env, const ERL_NIF_TERM argv[],
+                              int flags) {
+  ErlNifTime start;
+  ERL_NIF_TERM tail, ret;
+  ERL_NIF_TERM args[3];
+  ErlNifIOVec *iovec;
+  io_resource_t *res;
+
+  start = enif_monotonic_time(ERL_NIF_USEC);
+
+  if (!get_io_resource(env, argv[0], &res))
+    return make_error(env, ATOM_INVALID_FD);
+
+  if (!enif_is_list(env, argv[1]))
+    return enif_make_badarg(env);
+
+  if (res->write_queue == NULL) {
+    res->write_queue = enif_ioq_create(ERL_NIF_IOQ_NORMAL);
+    if (res->write_queue == NULL)
+      return make_error(env, enif_make_int(env, ENOMEM));
+  }
+
+  tail = argv[1];
+  while (!enif_is_empty_list(env, tail)) {
+    if (!enif_inspect_iovec(env, MAX_IOV_COUNT, tail, &tail, &iovec))
+      return enif_make_badarg(env);
+
+    if (!enif_ioq_enqv(res->write_queue, iovec, 0))
+      return make_error(env, enif_make_int(env, ENOMEM));
+  }
+
+  ret = flush_write_queue(env, res, start, true);
+
+  notify_consumed_timeslice(env, start, enif_monotonic_time(ERL_NIF_USEC));
+
+  /* rest of the queue is written by the same call with an empty list */
+  if (enif_compare(ret, ATOM_CONTINUE) == 0) {
+    args[0] = argv[0];
+    args[1] = enif_make_list(env, 0);
+    args[2] = enif_make_int(env, flags);
+    return enif_schedule_nif(env, "nif_write_iov", flags,
+                             nif_write_iov_continue, 3, args);
+  }
+
+  return ret;
+}
+
+static ERL_NIF_TERM nif_write_iov_continue(ErlNifEnv *env, int argc,
+                                           const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 3);
+
+  int flags;
+
+  if (!enif_get_int(env, argv[2], &flags))
+    return enif_make_badarg(env);
+
+  return write_iov(env, argv, flags);
+}
+
+static ERL_NIF_TERM nif_write_iov(ErlNifEnv *env, int argc,
+                                  const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 2);
+  return write_iov(env, argv, USE_DIRTY_IO);
+}
+
+static ERL_NIF_TERM nif_write_iov_normal(ErlNifEnv *env, int argc,
+                                         const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 2);
+  return write_iov(env, argv, 0);
+}
+
+static int select_read(ErlNifEnv *env, io_resource_t *res) {
+  int ret = select_pipe(env, res, ERL_NIF_SELECT_READ);
 
   if (ret != 0)
     perror("select_read()");
+  else
+    res->stats.selects++;
   return ret;
 }
 
-static ERL_NIF_TERM nif_create_fd(ErlNifEnv *env, int argc,
-                                  const ERL_NIF_TERM argv[]) {
-  ASSERT_ARGC(argc, 1);
+static void init_io_resource(io_resource_t *res, int fd, void *select_obj,
+                             ERL_NIF_TERM name) {
+  res->fd = fd;
+  res->write_queue = NULL;
+  memset(&res->stats, 0, sizeof(io_stats_t));
+  memset(&res->framing, 0, sizeof(framing_t));
+  res->ring = NULL;
+  memset(&res->collect, 0, sizeof(collect_t));
+  res->select_obj = select_obj;
+  res->name = name;
+}
 
-  ERL_NIF_TERM term;
+/* monitors the calling process, so that fds are closed when it exits */
+static int monitor_self(ErlNifEnv *env, void *obj) {
   ErlNifPid pid;
-  int *fd;
   int ret;
 
-  fd = enif_alloc_resource(FD_RT, sizeof(int));
-
-  if (!enif_get_int(env, argv[0], fd))
-    goto error_exit;
-
   if (!enif_self(env, &pid)) {
     error("failed get self pid");
-    goto error_exit;
+    return -1;
   }
 
-  ret = enif_monitor_process(env, fd, &pid, NULL);
+  ret = enif_monitor_process(env, obj, &pid, NULL);
 
   if (ret < 0) {
     error("no down callback is provided");
-    goto error_exit;
+    return -1;
   } else if (ret > 0) {
     error("pid is not alive");
-    goto error_exit;
+    return -1;
+  }
+
+  return 0;
+}
+
+static ERL_NIF_TERM make_fd_resource(ErlNifEnv *env, int fd) {
+  ERL_NIF_TERM term;
+  io_resource_t *res;
+
+  res = enif_alloc_resource(FD_RT, sizeof(io_resource_t));
+  init_io_resource(res, fd, res, ATOM_UNDEFINED);
+
+  if (monitor_self(env, res) != 0) {
+    res->fd = FD_CLOSED;
+    enif_release_resource(res);
+    return ATOM_ERROR;
+  }
+
+  term = enif_make_resource(env, res);
+  enif_release_resource(res);
+
+  return make_ok(env, term);
+}
+
+/* Creates a process resource holding the stdio pipes of a spawned
+ * program. stderr fd is closed right away unless it is consumed. Pipes
+ * are used as `{process_resource, stdin | stdout | stderr}` */
+static ERL_NIF_TERM nif_create_process(ErlNifEnv *env, int argc,
+                                       const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 5);
+
+  ERL_NIF_TERM term;
+  process_resource_t *proc;
+  int os_pid, stdin_fd, stdout_fd, stderr_fd;
+
+  if (!enif_get_int(env, argv[0], &os_pid) ||
+      !enif_get_int(env, argv[1], &stdin_fd) ||
+      !enif_get_int(env, argv[2], &stdout_fd) ||
+      !enif_get_int(env, argv[3], &stderr_fd))
+    return enif_make_badarg(env);
+
+  if (!enif_is_identical(argv[4], ATOM_TRUE)) {
+    close(stderr_fd);
+    stderr_fd = FD_CLOSED;
+  }
+
+  proc = enif_alloc_resource(PROCESS_RT, sizeof(process_resource_t));
+  proc->os_pid = os_pid;
+  proc->read_any_next = PIPE_STDOUT;
+  proc->buffers = NULL;
+  init_io_resource(&proc->pipes[PIPE_STDIN], stdin_fd, proc, ATOM_STDIN);
+  init_io_resource(&proc->pipes[PIPE_STDOUT], stdout_fd, proc, ATOM_STDOUT);
+  init_io_resource(&proc->pipes[PIPE_STDERR], stderr_fd, proc, ATOM_STDERR);
+
+  if (monitor_self(env, proc) != 0) {
+    /* fds are not selected yet, so stop callback is not involved */
+    close(stdin_fd);
+    close(stdout_fd);
+    if (stderr_fd != FD_CLOSED)
+      close(stderr_fd);
+    enif_release_resource(proc);
+    return ATOM_ERROR;
   }
 
-  term = enif_make_resource(env, fd);
-  enif_release_resource(fd);
+  term = enif_make_resource(env, proc);
+  enif_release_resource(proc);
 
   return make_ok(env, term);
+}
+
+/* Wraps a duplicate of an fd owned by someone else (such as a socket or
+ * a file), so that closing the resource does not affect the original */
+static ERL_NIF_TERM nif_dup_fd(ErlNifEnv *env, int argc,
+                               const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 1);
+
+  ERL_NIF_TERM ret;
+  int fd, new_fd;
+
+  if (!enif_get_int(env, argv[0], &fd) || fd < 0)
+    return enif_make_badarg(env);
+
+  new_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (new_fd < 0)
+    return make_error(env, enif_make_int(env, errno));
+
+  ret = make_fd_resource(env, new_fd);
+  if (enif_compare(ret, ATOM_ERROR) == 0)
+    close(new_fd);
 
-error_exit:
-  enif_release_resource(fd);
-  return ATOM_ERROR;
+  return ret;
 }
 
-static ERL_NIF_TERM read_fd(ErlNifEnv *env, int *fd, int max_size) {
+/* Reads up to `max_size` bytes. A single read(2) from a pipe returns at
+ * most the pipe capacity, so when a read fills the requested space we
+ * keep reading (growing the binary) until a short read, EAGAIN, EOF,
+ * `max_size` or the time budget is reached. */
+static ERL_NIF_TERM read_fd(ErlNifEnv *env, io_resource_t *res,
+                            int max_size) {
   if (max_size == UNBUFFERED_READ) {
     max_size = PIPE_BUF_SIZE;
   } else if (max_size < 1) {
     return enif_make_badarg(env);
-  } else if (max_size > PIPE_BUF_SIZE) {
-    max_size = PIPE_BUF_SIZE;
   }
 
   ErlNifTime start = enif_monotonic_time(ERL_NIF_USEC);
-  unsigned char buf[max_size];
-  ssize_t result = read(*fd, buf, max_size);
-  int read_errno = errno;
-
-  ERL_NIF_TERM bin_term = 0;
-  if (result >= 0) {
-    /* no need to release this binary */
-    unsigned char *temp = enif_make_new_binary(env, result, &bin_term);
-    memcpy(temp, buf, result);
+  ErlNifBinary bin;
+  size_t capacity = max_size < PIPE_BUF_SIZE ? max_size : PIPE_BUF_SIZE;
+  size_t offset = 0;
+  ssize_t result;
+  int read_errno = 0;
+
+  /* read directly into the binary which is handed over to the VM, so
+   * that data is not copied again from an intermediate buffer */
+  if (!enif_alloc_binary(capacity, &bin))
+    return make_error(env, enif_make_int(env, ENOMEM));
+
+  for (;;) {
+    result = read(res->fd, bin.data + offset, capacity - offset);
+    read_errno = errno;
+    count_read(res, result);
+
+    if (result <= 0 || (size_t)result < capacity - offset) {
+      if (result > 0)
+        offset += result;
+      break;
+    }
+
+    offset += result;
+
+    if (offset == (size_t)max_size)
+      break;
+
+    /* rest is returned by the next read */
+    if (enif_monotonic_time(ERL_NIF_USEC) - start >= DRAIN_TIME_BUDGET)
+      break;
+
+    /* pipe had at least as much as we asked for, there might be more */
+    capacity *= 2;
+    if (capacity > (size_t)max_size)
+      capacity = max_size;
+    if (!enif_realloc_binary(&bin, capacity)) {
+      enif_release_binary(&bin);
+      return make_error(env, enif_make_int(env, ENOMEM));
+    }
   }
 
   notify_consumed_timeslice(env, start, enif_monotonic_time(ERL_NIF_USEC));
 
-  if (result >= 0) {
-    return make_ok(env, bin_term);
-  } else if (read_errno == EAGAIN || read_errno == EWOULDBLOCK) { // busy
-    int retval = select_read(env, fd);
+  /* return whatever is read so far. Error, if any, will be returned by
+   * the next read */
+  if (offset > 0 || result == 0) {
+    /* shrink to the actual size on short read */
+    if (offset < bin.size && !enif_realloc_binary(&bin, offset)) {
+      enif_release_binary(&bin);
+      return make_error(env, enif_make_int(env, ENOMEM));
+    }
+    /* ownership of the binary is transferred to the term */
+    return make_ok(env, enif_make_binary(env, &bin));
+  }
+
+  enif_release_binary(&bin);
+
+  if (read_errno == EAGAIN || read_errno == EWOULDBLOCK) { // busy
+    int retval = select_read(env, res);
     if (retval != 0)
       return make_error(env, enif_make_int(env, retval));
     return make_error(env, ATOM_EAGAIN);
@@ -239,83 +901,1402 @@ static ERL_NIF_TERM read_fd(ErlNifEnv *env, int *fd, int max_size) {
   }
 }
 
-static ERL_NIF_TERM nif_read(ErlNifEnv *env, int argc,
-                             const ERL_NIF_TERM argv[]) {
-  ASSERT_ARGC(argc, 2);
+/* process owning the pipe, NULL for a standalone fd */
+static process_resource_t *pipe_process(io_resource_t *res) {
+  if (enif_is_identical(res->name, ATOM_UNDEFINED))
+    return NULL;
+  return (process_resource_t *)res->select_obj;
+}
 
-  int max_size;
-  int *fd;
+/* Takes a buffer from the free list or allocates a new one, returns a
+ * resource owning it */
+static buffer_resource_t *take_buffer(process_resource_t *proc) {
+  buffer_pool_t *pool = proc->buffers;
+  buffer_resource_t *buf;
+  unsigned char *data = NULL;
+
+  enif_mutex_lock(pool->lock);
+  if (pool->free_count > 0) {
+    data = pool->free[--pool->free_count];
+    pool->reused++;
+  } else {
+    pool->allocated++;
+  }
+  enif_mutex_unlock(pool->lock);
 
-  if (!enif_get_resource(env, argv[0], FD_RT, (void **)&fd))
-    return make_error(env, ATOM_INVALID_FD);
+  if (data == NULL && (data = enif_alloc(BUFFER_POOL_BUFFER_SIZE)) == NULL)
+    return NULL;
 
-  if (!enif_get_int(env, argv[1], &max_size))
+  buf = enif_alloc_resource(BUFFER_RT, sizeof(buffer_resource_t));
+  if (buf == NULL) {
+    enif_free(data);
+    return NULL;
+  }
+
+  enif_keep_resource(proc);
+  buf->proc = proc;
+  buf->data = data;
+  return buf;
+}
+
+/* Same as `read_fd`, but reads into a pooled buffer with a single
+ * read(2) of at most BUFFER_POOL_BUFFER_SIZE bytes. Data is returned as
+ * a resource binary, and the buffer goes back to the pool once the
+ * binary and all sub-binaries of it are garbage collected */
+static ERL_NIF_TERM read_fd_pooled(ErlNifEnv *env, io_resource_t *res,
+                                   process_resource_t *proc, int max_size) {
+  if (max_size == UNBUFFERED_READ) {
+    max_size = PIPE_BUF_SIZE;
+  } else if (max_size < 1) {
     return enif_make_badarg(env);
+  }
+
+  ErlNifTime start = enif_monotonic_time(ERL_NIF_USEC);
+  size_t size = max_size < BUFFER_POOL_BUFFER_SIZE ? max_size
+                                                   : BUFFER_POOL_BUFFER_SIZE;
+  buffer_resource_t *buf;
+  ERL_NIF_TERM term;
+  unsigned char *data;
+  ssize_t result;
+  int read_errno;
+
+  buf = take_buffer(proc);
+  if (buf == NULL)
+    return make_error(env, enif_make_int(env, ENOMEM));
+
+  result = read(res->fd, buf->data, size);
+  read_errno = errno;
+  count_read(res, result);
+
+  notify_consumed_timeslice(env, start, enif_monotonic_time(ERL_NIF_USEC));
+
+  if (result >= BUFFER_POOL_COPY_THRESHOLD) {
+    term = enif_make_resource_binary(env, buf, buf->data, result);
+    enif_release_resource(buf);
+    return make_ok(env, term);
+  }
+
+  if (result >= 0) {
+    data = enif_make_new_binary(env, result, &term);
+    memcpy(data, buf->data, result);
+  }
+
+  /* buffer goes straight back to the pool */
+  enif_release_resource(buf);
+
+  if (result > 0) {
+    enif_mutex_lock(proc->buffers->lock);
+    proc->buffers->copied++;
+    enif_mutex_unlock(proc->buffers->lock);
+  }
+
+  if (result >= 0)
+    return make_ok(env, term);
 
-  return read_fd(env, fd, max_size);
+  if (read_errno == EAGAIN || read_errno == EWOULDBLOCK) { // busy
+    int retval = select_read(env, res);
+    if (retval != 0)
+      return make_error(env, enif_make_int(env, retval));
+    return make_error(env, ATOM_EAGAIN);
+  } else if (read_errno == EPIPE) {
+    return make_error(env, ATOM_EPIPE);
+  } else {
+    perror("read_fd_pooled()");
+    return make_error(env, enif_make_int(env, read_errno));
+  }
 }
 
-static ERL_NIF_TERM nif_close(ErlNifEnv *env, int argc,
-                              const ERL_NIF_TERM argv[]) {
+/* Enables pooled read buffers for stdout and stderr of the process. Only
+ * plain reads use the pool, see `read_pipe` */
+static ERL_NIF_TERM nif_enable_buffer_pool(ErlNifEnv *env, int argc,
+                                           const ERL_NIF_TERM argv[]) {
   ASSERT_ARGC(argc, 1);
 
-  int *fd;
+  process_resource_t *proc;
+  buffer_pool_t *pool;
 
-  if (!enif_get_resource(env, argv[0], FD_RT, (void **)&fd))
+  if (!enif_get_resource(env, argv[0], PROCESS_RT, (void **)&proc))
     return make_error(env, ATOM_INVALID_FD);
 
-  if (cancel_select(env, fd) < 0)
-    return make_error(env, ATOM_SELECT_CANCEL_ERROR);
+  if (proc->buffers != NULL)
+    return ATOM_OK;
+
+  pool = enif_alloc(sizeof(buffer_pool_t));
+  if (pool == NULL)
+    return make_error(env, enif_make_int(env, ENOMEM));
 
-  close_fd(fd);
+  memset(pool, 0, sizeof(buffer_pool_t));
+  pool->lock = enif_mutex_create("exile_buffer_pool");
+  if (pool->lock == NULL) {
+    enif_free(pool);
+    return make_error(env, enif_make_int(env, ENOMEM));
+  }
 
+  proc->buffers = pool;
   return ATOM_OK;
 }
 
-static ERL_NIF_TERM nif_is_os_pid_alive(ErlNifEnv *env, int argc,
-                                        const ERL_NIF_TERM argv[]) {
+/* Returns buffer pool counters of the process owning the pipe as a map,
+ * or `undefined` when the pool is not enabled */
+static ERL_NIF_TERM nif_buffer_pool_stats(ErlNifEnv *env, int argc,
+                                          const ERL_NIF_TERM argv[]) {
   ASSERT_ARGC(argc, 1);
 
-  pid_t pid;
-
-  if (!enif_get_int(env, argv[0], (int *)&pid))
-    return enif_make_badarg(env);
+  ERL_NIF_TERM keys[4], values[4], map;
+  process_resource_t *proc;
+  buffer_pool_t *pool;
+  io_resource_t *res;
 
-  int result = kill(pid, 0);
+  if (!get_io_resource(env, argv[0], &res))
+    return make_error(env, ATOM_INVALID_FD);
 
-  if (result == 0)
-    return ATOM_TRUE;
-  else
-    return ATOM_FALSE;
+  proc = pipe_process(res);
+  if (proc == NULL || proc->buffers == NULL)
+    return make_ok(env, ATOM_UNDEFINED);
+
+  pool = proc->buffers;
+  enif_mutex_lock(pool->lock);
+  keys[0] = ATOM_ALLOCATED;
+  values[0] = enif_make_uint64(env, pool->allocated);
+  keys[1] = ATOM_REUSED;
+  values[1] = enif_make_uint64(env, pool->reused);
+  keys[2] = ATOM_COPIED;
+  values[2] = enif_make_uint64(env, pool->copied);
+  keys[3] = ATOM_FREE;
+  values[3] = enif_make_int(env, pool->free_count);
+  enif_mutex_unlock(pool->lock);
+
+  if (!enif_make_map_from_arrays(env, keys, values, 4, &map))
+    return make_error(env, ATOM_ERROR);
+
+  return make_ok(env, map);
 }
 
-static ERL_NIF_TERM nif_kill(ErlNifEnv *env, int argc,
-                             const ERL_NIF_TERM argv[]) {
-  ASSERT_ARGC(argc, 2);
+/* Keeps reading until the pipe is drained (EAGAIN), EOF, `max_size` bytes
+ * or the timeslice budget is exhausted. Each read(2) is returned as a
+ * separate binary, so result is either a binary or list of binaries. */
+static ERL_NIF_TERM read_fd_drain(ErlNifEnv *env, io_resource_t *res,
+                                  int max_size) {
+  if (max_size < 1)
+    return enif_make_badarg(env);
 
-  pid_t pid;
-  int ret;
+  ErlNifTime start = enif_monotonic_time(ERL_NIF_USEC);
+  ERL_NIF_TERM chunks[DRAIN_MAX_CHUNKS];
+  ErlNifBinary bin;
+  size_t total = 0, chunk_size;
+  ssize_t result;
+  int count = 0, read_errno = 0;
+
+  while (total < (size_t)max_size && count < DRAIN_MAX_CHUNKS) {
+    chunk_size = max_size - total;
+    if (chunk_size > (size_t)PIPE_BUF_SIZE)
+      chunk_size = PIPE_BUF_SIZE;
+
+    if (!enif_alloc_binary(chunk_size, &bin)) {
+      read_errno = ENOMEM;
+      result = -1;
+      break;
+    }
+
+    result = read(res->fd, bin.data, chunk_size);
+    read_errno = errno;
+    count_read(res, result);
+
+    if (result <= 0) {
+      enif_release_binary(&bin);
+      break;
+    }
+
+    if ((size_t)result < chunk_size && !enif_realloc_binary(&bin, result)) {
+      enif_release_binary(&bin);
+      read_errno = ENOMEM;
+      result = -1;
+      break;
+    }
+
+    chunks[count++] = enif_make_binary(env, &bin);
+    total += result;
+
+    if (enif_monotonic_time(ERL_NIF_USEC) - start >= DRAIN_TIME_BUDGET)
+      break;
+  }
 
-  // we should not assume pid type to be `int`?
-  if (!enif_get_int(env, argv[0], (int *)&pid))
-    return enif_make_badarg(env);
+  notify_consumed_timeslice(env, start, enif_monotonic_time(ERL_NIF_USEC));
 
-  if (enif_compare(argv[1], ATOM_SIGKILL) == 0)
-    ret = kill(pid, SIGKILL);
-  else if (enif_compare(argv[1], ATOM_SIGTERM) == 0)
-    ret = kill(pid, SIGTERM);
-  else if (enif_compare(argv[1], ATOM_SIGPIPE) == 0) {
-    ret = kill(pid, SIGPIPE);
-  } else
-    return enif_make_badarg(env);
+  /* return whatever is read so far. Error, if any, will be returned by
+   * the next read */
+  if (count == 1)
+    return make_ok(env, chunks[0]);
+  else if (count > 1)
+    return make_ok(env, enif_make_list_from_array(env, chunks, count));
+  else if (result == 0) { // EOF
+    enif_make_new_binary(env, 0, &chunks[0]);
+    return make_ok(env, chunks[0]);
+  }
 
-  if (ret != 0) {
-    perror("[exile] failed to send signal");
-    return make_error(
-        env, enif_make_string(env, "failed to send signal", ERL_NIF_LATIN1));
+  if (read_errno == EAGAIN || read_errno == EWOULDBLOCK) { // busy
+    int retval = select_read(env, res);
+    if (retval != 0)
+      return make_error(env, enif_make_int(env, retval));
+    return make_error(env, ATOM_EAGAIN);
+  } else if (read_errno == EPIPE) {
+    return make_error(env, ATOM_EPIPE);
+  } else {
+    perror("read_fd_drain()");
+    return make_error(env, enif_make_int(env, read_errno));
   }
+}
 
-  return ATOM_OK;
+/* length of the record from the big-endian header at `data` */
+static size_t record_length(framing_t *framing, const unsigned char *data) {
+  size_t length = 0;
+  int i;
+
+  for (i = 0; i < framing->prefix_size; i++)
+    length = (length << 8) | data[i];
+
+  return length;
+}
+
+/* Finds the record starting at `pos`, returns false if the record is
+ * not complete yet. Data in `[pos, scan_from)` is known not to contain
+ * the delimiter. `*next` is set to the start of the following record */
+static bool next_record(framing_t *framing, const unsigned char *data,
+                        size_t size, size_t pos, size_t scan_from,
+                        size_t *record_start, size_t *record_size,
+                        size_t *next) {
+  const unsigned char *found;
+  size_t length;
+
+  if (framing->mode == FRAMING_DELIMITER) {
+    if (scan_from < pos)
+      scan_from = pos;
+
+    found = memchr(data + scan_from, framing->delimiter, size - scan_from);
+    if (found == NULL)
+      return false;
+
+    *record_start = pos;
+    *record_size = found - data - pos;
+    *next = *record_start + *record_size + 1;
+    return true;
+  }
+
+  if (size - pos < (size_t)framing->prefix_size)
+    return false;
+
+  length = record_length(framing, data + pos);
+  if (size - pos - framing->prefix_size < length)
+    return false;
+
+  *record_start = pos + framing->prefix_size;
+  *record_size = length;
+  *next = *record_start + length;
+  return true;
+}
+
+static bool record_too_large(framing_t *framing, size_t size) {
+  return framing->max_record_size > 0 && size > framing->max_record_size;
+}
+
+/* Makes room for reading `chunk_size` more bytes into the carry. A long
+ * delimited record grows the carry geometrically, and a length prefixed
+ * record is allocated whole once its header is read, so that a long
+ * record is not copied over and over */
+static int reserve_carry(framing_t *framing, size_t chunk_size) {
+  ErlNifBinary *carry = &framing->carry;
+  size_t size = framing->carry_size + chunk_size, length;
+
+  if (framing->mode == FRAMING_LENGTH_PREFIXED) {
+    if (framing->discard == 0 &&
+        framing->carry_size >= (size_t)framing->prefix_size) {
+      length = framing->prefix_size + record_length(framing, carry->data);
+      if (size < length)
+        size = length;
+    }
+  } else if (carry->data != NULL && size > carry->size &&
+             size < 2 * carry->size) {
+    size = 2 * carry->size;
+  }
+
+  if (carry->data == NULL)
+    return enif_alloc_binary(size, carry) ? 0 : ENOMEM;
+
+  if (size > carry->size && !enif_realloc_binary(carry, size))
+    return ENOMEM;
+
+  return 0;
+}
+
+static void clear_carry(framing_t *framing) {
+  if (framing->carry.data != NULL)
+    enif_release_binary(&framing->carry);
+
+  framing->carry.data = NULL;
+  framing->carry_size = 0;
+  framing->scanned = 0;
+}
+
+/* Replaces the carry with a copy of `data` */
+static int set_carry(framing_t *framing, const unsigned char *data,
+                     size_t size) {
+  clear_carry(framing);
+  if (size == 0)
+    return 0;
+
+  if (reserve_carry(framing, size) != 0)
+    return ENOMEM;
+
+  memcpy(framing->carry.data, data, size);
+  framing->carry_size = size;
+  return 0;
+}
+
+/* Transfers the ownership of the carried bytes to `*term`, the carry is
+ * empty afterwards */
+static bool take_carry(ErlNifEnv *env, framing_t *framing,
+                       ERL_NIF_TERM *term) {
+  ErlNifBinary *carry = &framing->carry;
+
+  /* unused capacity would be kept alive by the sub binaries */
+  if (framing->carry_size < carry->size &&
+      !enif_realloc_binary(carry, framing->carry_size))
+    return false;
+
+  *term = enif_make_binary(env, carry);
+  carry->data = NULL;
+  framing->carry_size = 0;
+  framing->scanned = 0;
+  return true;
+}
+
+/* Drops the carried bytes of a record which failed with
+ * `:record_too_large`, see `framing_t.discard` */
+static void discard_carry(framing_t *framing) {
+  unsigned char *data = framing->carry.data;
+  const unsigned char *found;
+  size_t size = framing->carry_size, dropped;
+
+  if (framing->mode == FRAMING_DELIMITER) {
+    found = memchr(data, framing->delimiter, size);
+    if (found == NULL) {
+      framing->carry_size = 0;
+      return;
+    }
+    dropped = found - data + 1;
+    framing->discard = 0;
+  } else {
+    dropped = size < framing->discard ? size : framing->discard;
+    framing->discard -= dropped;
+  }
+
+  memmove(data, data + dropped, size - dropped);
+  framing->carry_size = size - dropped;
+  framing->scanned = 0;
+}
+
+/* Returns true when the incomplete record in the carry is already larger
+ * than `max_record_size`. The record is dropped, including the part which
+ * is not read yet, so that the following reads start at the next record */
+static bool carry_too_large(framing_t *framing) {
+  size_t length;
+
+  if (framing->mode == FRAMING_DELIMITER) {
+    if (!record_too_large(framing, framing->carry_size))
+      return false;
+    framing->discard = 1;
+  } else {
+    if (framing->carry_size < (size_t)framing->prefix_size)
+      return false;
+
+    length = record_length(framing, framing->carry.data);
+    if (!record_too_large(framing, length))
+      return false;
+    framing->discard = framing->prefix_size + length;
+  }
+
+  discard_carry(framing);
+  return true;
+}
+
+/* Returns the complete records of the carry as sub binaries of it, and
+ * keeps the trailing incomplete record in a new carry. Records before an
+ * oversized record are returned first, the next call fails with
+ * `:record_too_large` */
+static ERL_NIF_TERM take_records(ErlNifEnv *env, framing_t *framing) {
+  ERL_NIF_TERM term, records = enif_make_list(env, 0);
+  ErlNifBinary bin;
+  size_t scan_from = framing->scanned, pos = 0, start, size, next;
+  bool oversized = false;
+
+  if (!take_carry(env, framing, &term))
+    return make_error(env, enif_make_int(env, ENOMEM));
+
+  enif_inspect_binary(env, term, &bin);
+
+  while (next_record(framing, bin.data, bin.size, pos, scan_from, &start,
+                     &size, &next)) {
+    if (record_too_large(framing, size)) {
+      oversized = true;
+      break;
+    }
+
+    records = enif_make_list_cell(
+        env, enif_make_sub_binary(env, term, start, size), records);
+    pos = next;
+  }
+
+  /* the oversized record is complete, so the following records are
+   * still aligned */
+  if (oversized && enif_is_empty_list(env, records))
+    pos = next;
+
+  if (set_carry(framing, bin.data + pos, bin.size - pos) != 0)
+    return make_error(env, enif_make_int(env, ENOMEM));
+
+  /* the tail was scanned for the delimiter by the last `next_record` */
+  if (!oversized)
+    framing->scanned = framing->carry_size;
+
+  if (enif_is_empty_list(env, records))
+    return make_error(env, ATOM_RECORD_TOO_LARGE);
+
+  enif_make_reverse_list(env, records, &records);
+  return make_ok(env, records);
+}
+
+/* Reads and returns `{:ok, records}` where records is a non-empty list of
+ * complete records, without the delimiter or the length header. Data is
+ * read into the tail of the carry and records are sub binaries of it, so
+ * only the incomplete tail is copied to the next read. Returned records
+ * can exceed `max_size`, since a record is never split. A record larger
+ * than `max_record_size` returns `{:error, :record_too_large}` and is
+ * dropped */
+static ERL_NIF_TERM read_fd_framed(ErlNifEnv *env, io_resource_t *res,
+                                   int max_size) {
+  if (max_size == UNBUFFERED_READ) {
+    max_size = PIPE_BUF_SIZE;
+  } else if (max_size < 1) {
+    return enif_make_badarg(env);
+  }
+
+  framing_t *framing = &res->framing;
+  ErlNifBinary *carry = &framing->carry;
+  ErlNifTime start = enif_monotonic_time(ERL_NIF_USEC);
+  ERL_NIF_TERM term;
+  size_t chunk_size, pos, record_start, record_size;
+  ssize_t result;
+  int read_errno = 0;
+
+  chunk_size = max_size < PIPE_BUF_SIZE ? max_size : PIPE_BUF_SIZE;
+
+  for (;;) {
+    if (framing->discard > 0 && framing->carry_size > 0)
+      discard_carry(framing);
+
+    if (framing->discard == 0 && framing->carry_size > 0) {
+      if (next_record(framing, carry->data, framing->carry_size, 0,
+                      framing->scanned, &record_start, &record_size, &pos)) {
+        notify_consumed_timeslice(env, start,
+                                  enif_monotonic_time(ERL_NIF_USEC));
+        return take_records(env, framing);
+      }
+
+      framing->scanned = framing->carry_size;
+
+      if (carry_too_large(framing)) {
+        notify_consumed_timeslice(env, start,
+                                  enif_monotonic_time(ERL_NIF_USEC));
+        return make_error(env, ATOM_RECORD_TOO_LARGE);
+      }
+    }
+
+    /* select fires right away if there is more data, so we yield in
+     * between long records */
+    if (enif_monotonic_time(ERL_NIF_USEC) - start >= DRAIN_TIME_BUDGET) {
+      result = -1;
+      read_errno = EAGAIN;
+      break;
+    }
+
+    if (reserve_carry(framing, chunk_size) != 0)
+      return make_error(env, enif_make_int(env, ENOMEM));
+
+    result = read(res->fd, carry->data + framing->carry_size,
+                  carry->size - framing->carry_size);
+    read_errno = errno;
+    count_read(res, result);
+
+    if (result <= 0)
+      break;
+
+    framing->carry_size += result;
+  }
+
+  notify_consumed_timeslice(env, start, enif_monotonic_time(ERL_NIF_USEC));
+
+  if (result == 0) { // EOF
+    if (framing->carry_size == 0) {
+      clear_carry(framing);
+      enif_make_new_binary(env, 0, &term);
+      return make_ok(env, term);
+    }
+
+    if (framing->mode == FRAMING_LENGTH_PREFIXED) {
+      clear_carry(framing);
+      return make_error(env, ATOM_INCOMPLETE_RECORD);
+    }
+
+    /* last record without the trailing delimiter */
+    if (!take_carry(env, framing, &term))
+      return make_error(env, enif_make_int(env, ENOMEM));
+    return make_ok(env, enif_make_list(env, 1, term));
+  }
+
+  if (read_errno == EAGAIN || read_errno == EWOULDBLOCK) { // busy
+    int retval = select_read(env, res);
+    if (retval != 0)
+      return make_error(env, enif_make_int(env, retval));
+    return make_error(env, ATOM_EAGAIN);
+  } else if (read_errno == EPIPE) {
+    return make_error(env, ATOM_EPIPE);
+  } else {
+    perror("read_fd_framed()");
+    return make_error(env, enif_make_int(env, read_errno));
+  }
+}
+
+/* Enables framing of the reads, `{delimiter, byte}` or
+ * `{length_prefixed, header_size}` where header size is 1, 2 or 4.
+ * Records larger than `max_record_size` bytes fail the read, 0 for no
+ * limit */
+static ERL_NIF_TERM nif_set_framing(ErlNifEnv *env, int argc,
+                                    const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 3);
+
+  const ERL_NIF_TERM *tuple;
+  io_resource_t *res;
+  ErlNifUInt64 max_record_size;
+  int arity, value;
+
+  if (!get_io_resource(env, argv[0], &res))
+    return make_error(env, ATOM_INVALID_FD);
+
+  if (!enif_get_tuple(env, argv[1], &arity, &tuple) || arity != 2 ||
+      !enif_get_int(env, tuple[1], &value) ||
+      !enif_get_uint64(env, argv[2], &max_record_size))
+    return enif_make_badarg(env);
+
+  if (enif_is_identical(tuple[0], ATOM_DELIMITER) && value >= 0 &&
+      value <= 255) {
+    res->framing.mode = FRAMING_DELIMITER;
+    res->framing.delimiter = (unsigned char)value;
+  } else if (enif_is_identical(tuple[0], ATOM_LENGTH_PREFIXED) &&
+             (value == 1 || value == 2 || value == 4)) {
+    res->framing.mode = FRAMING_LENGTH_PREFIXED;
+    res->framing.prefix_size = value;
+  } else {
+    return enif_make_badarg(env);
+  }
+
+  res->framing.max_record_size = (size_t)max_record_size;
+
+  return ATOM_OK;
+}
+
+static bool ring_empty(exile_ring_t *ring, uint64_t tail) {
+  return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail;
+}
+
+/* Reads up to `max_size` bytes from the ring. Data is copied out instead
+ * of returning binaries pointing into the ring, since the producer can
+ * only reuse the space once the VM releases such binaries, which might
+ * be never. When the ring is empty we wait on the stdout pipe, same as
+ * `read_fd`, and the pipe reaching EOF after the ring is drained is EOF */
+static ERL_NIF_TERM read_ring(ErlNifEnv *env, io_resource_t *res,
+                              int max_size) {
+  if (max_size == UNBUFFERED_READ) {
+    max_size = PIPE_BUF_SIZE;
+  } else if (max_size < 1) {
+    return enif_make_badarg(env);
+  }
+
+  ErlNifTime start = enif_monotonic_time(ERL_NIF_USEC);
+  exile_ring_t *ring = res->ring->shared;
+  uint64_t capacity = res->ring->capacity;
+  uint64_t head, tail, offset, size, first;
+  unsigned char *data, buf[64];
+  ERL_NIF_TERM term;
+  ssize_t result;
+  int retval;
+
+  tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+  if (ring_empty(ring, tail)) {
+    /* either the producer sees the flag or we see the new head, see
+     * `exile_ring_notify` */
+    __atomic_store_n(&ring->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    /* drain the doorbell, rechecking the ring since a drained byte might
+     * be for data published after the last check */
+    while (ring_empty(ring, tail)) {
+      result = read(res->fd, buf, sizeof(buf));
+
+      if (result > 0 || (result < 0 && errno == EINTR))
+        continue;
+
+      /* the command closed stdout and everything it wrote is in the
+       * ring already */
+      if (result == 0) {
+        if (!ring_empty(ring, tail))
+          break;
+        enif_make_new_binary(env, 0, &term);
+        return make_ok(env, term);
+      }
+
+      if (errno == EAGAIN || errno == EWOULDBLOCK) { // busy
+        retval = select_read(env, res);
+        if (retval != 0)
+          return make_error(env, enif_make_int(env, retval));
+        return make_error(env, ATOM_EAGAIN);
+      }
+
+      perror("read_ring()");
+      return make_error(env, enif_make_int(env, errno));
+    }
+
+    __atomic_store_n(&ring->consumer_waiting, 0, __ATOMIC_RELAXED);
+  }
+
+  head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+  /* head is written by the command, do not trust it */
+  if (head - tail > capacity)
+    return make_error(env, enif_make_int(env, EPROTO));
+
+  size = head - tail;
+  if (size > (uint64_t)max_size)
+    size = max_size;
+
+  data = enif_make_new_binary(env, size, &term);
+  if (data == NULL)
+    return make_error(env, enif_make_int(env, ENOMEM));
+
+  /* data might wrap around the end of the ring */
+  offset = tail & (capacity - 1);
+  first = capacity - offset < size ? capacity - offset : size;
+  memcpy(data, exile_ring_data(ring) + offset, first);
+  memcpy(data + first, exile_ring_data(ring), size - first);
+
+  __atomic_store_n(&ring->tail, tail + size, __ATOMIC_RELEASE);
+  count_read(res, size);
+
+  /* failure means the command is gone, which is seen as EOF later */
+  exile_ring_notify(&ring->producer_waiting, res->ring->doorbell_fd);
+
+  notify_consumed_timeslice(env, start, enif_monotonic_time(ERL_NIF_USEC));
+
+  return make_ok(env, term);
+}
+
+/* Switches reads of the process stdout to the shared memory ring set up
+ * by the spawner. Takes ownership of both fds, ring fd is closed once it
+ * is mapped */
+static ERL_NIF_TERM nif_attach_ring(ErlNifEnv *env, int argc,
+                                    const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 3);
+
+  process_resource_t *proc;
+  exile_ring_t *shared;
+  io_resource_t *res;
+  uint64_t capacity;
+  int ring_fd, doorbell_fd, err;
+
+  if (!enif_get_resource(env, argv[0], PROCESS_RT, (void **)&proc))
+    return make_error(env, ATOM_INVALID_FD);
+
+  if (!enif_get_int(env, argv[1], &ring_fd) ||
+      !enif_get_int(env, argv[2], &doorbell_fd))
+    return enif_make_badarg(env);
+
+  res = &proc->pipes[PIPE_STDOUT];
+  if (res->ring != NULL)
+    return enif_make_badarg(env);
+
+  shared = exile_ring_map(ring_fd, &capacity);
+  err = errno;
+  close(ring_fd);
+
+  if (shared == NULL) {
+    close(doorbell_fd);
+    return make_error(env, enif_make_int(env, err));
+  }
+
+  res->ring = enif_alloc(sizeof(ring_t));
+  if (res->ring == NULL) {
+    exile_ring_unmap(shared, capacity);
+    close(doorbell_fd);
+    return make_error(env, enif_make_int(env, ENOMEM));
+  }
+
+  res->ring->shared = shared;
+  res->ring->capacity = capacity;
+  res->ring->doorbell_fd = doorbell_fd;
+
+  return ATOM_OK;
+}
+
+static ERL_NIF_TERM read_pipe(ErlNifEnv *env, io_resource_t *res,
+                              int max_size, bool drain) {
+  process_resource_t *proc;
+
+  /* a single copy out of the ring already returns all the data */
+  if (res->ring != NULL)
+    return read_ring(env, res, max_size);
+
+  /* framed read already keeps reading until a record is complete */
+  if (res->framing.mode != FRAMING_NONE)
+    return read_fd_framed(env, res, max_size);
+
+  if (drain)
+    return read_fd_drain(env, res, max_size);
+
+  proc = pipe_process(res);
+  if (proc != NULL && proc->buffers != NULL)
+    return read_fd_pooled(env, res, proc, max_size);
+
+  return read_fd(env, res, max_size);
+}
+
+static bool is_eof(ErlNifEnv *env, ERL_NIF_TERM term) {
+  const ERL_NIF_TERM *tuple;
+  ErlNifBinary bin;
+  int arity;
+
+  return enif_get_tuple(env, term, &arity, &tuple) && arity == 2 &&
+         enif_is_identical(tuple[0], ATOM_OK) &&
+         enif_inspect_binary(env, tuple[1], &bin) && bin.size == 0;
+}
+
+static ERL_NIF_TERM nif_read(ErlNifEnv *env, int argc,
+                             const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 2);
+
+  int max_size;
+  io_resource_t *res;
+
+  if (!get_io_resource(env, argv[0], &res))
+    return make_error(env, ATOM_INVALID_FD);
+
+  if (!enif_get_int(env, argv[1], &max_size))
+    return enif_make_badarg(env);
+
+  return read_pipe(env, res, max_size, false);
+}
+
+/* Reads till EOF, accumulating everything in a binary kept by the
+ * resource, and returns it as a single binary at EOF. Data beyond
+ * `max_size` bytes is read and discarded, so that the program is not
+ * blocked. Returns `{:error, :eagain}` after arming select when the pipe
+ * is empty, and `continue` when the timeslice is used up. Data read so
+ * far is kept across calls in both cases */
+static ERL_NIF_TERM nif_read_all(ErlNifEnv *env, int argc,
+                                 const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 2);
+
+  unsigned char discard[16384];
+  ErlNifUInt64 max_size;
+  ErlNifTime start;
+  ERL_NIF_TERM term;
+  io_resource_t *res;
+  collect_t *out;
+  size_t capacity;
+  ssize_t result;
+  int read_errno;
+
+  if (!get_io_resource(env, argv[0], &res))
+    return make_error(env, ATOM_INVALID_FD);
+
+  if (!enif_get_uint64(env, argv[1], &max_size))
+    return enif_make_badarg(env);
+
+  /* reads are not raw bytes of the fd */
+  if (res->ring != NULL || res->framing.mode != FRAMING_NONE)
+    return make_error(env, ATOM_ENOTSUP);
+
+  start = enif_monotonic_time(ERL_NIF_USEC);
+  out = &res->collect;
+
+  if (!out->allocated) {
+    capacity = PIPE_BUF_SIZE;
+    if (capacity > max_size)
+      capacity = max_size;
+    if (!enif_alloc_binary(capacity, &out->bin))
+      return make_error(env, enif_make_int(env, ENOMEM));
+    out->size = 0;
+    out->allocated = true;
+  }
+
+  for (;;) {
+    /* grow geometrically up to `max_size` */
+    if (out->size == out->bin.size && out->size < max_size) {
+      capacity = out->bin.size * 2;
+      if (capacity > max_size)
+        capacity = max_size;
+      if (!enif_realloc_binary(&out->bin, capacity))
+        return make_error(env, enif_make_int(env, ENOMEM));
+    }
+
+    if (out->size < out->bin.size)
+      result = read(res->fd, out->bin.data + out->size,
+                    out->bin.size - out->size);
+    else
+      result = read(res->fd, discard, sizeof(discard));
+    read_errno = errno;
+    count_read(res, result);
+
+    if (result <= 0)
+      break;
+
+    if (out->size < out->bin.size)
+      out->size += result;
+
+    if (enif_monotonic_time(ERL_NIF_USEC) - start >= DRAIN_TIME_BUDGET) {
+      notify_consumed_timeslice(env, start,
+                                enif_monotonic_time(ERL_NIF_USEC));
+      return ATOM_CONTINUE;
+    }
+  }
+
+  notify_consumed_timeslice(env, start, enif_monotonic_time(ERL_NIF_USEC));
+
+  if (result == 0) { // EOF
+    if (out->size < out->bin.size &&
+        !enif_realloc_binary(&out->bin, out->size))
+      return make_error(env, enif_make_int(env, ENOMEM));
+
+    /* ownership of the binary is transferred to the term */
+    term = enif_make_binary(env, &out->bin);
+    out->allocated = false;
+    out->size = 0;
+    return make_ok(env, term);
+  }
+
+  if (read_errno == EAGAIN || read_errno == EWOULDBLOCK) { // busy
+    int retval = select_read(env, res);
+    if (retval != 0)
+      return make_error(env, enif_make_int(env, retval));
+    return make_error(env, ATOM_EAGAIN);
+  } else if (read_errno == EPIPE) {
+    return make_error(env, ATOM_EPIPE);
+  } else {
+    perror("nif_read_all()");
+    return make_error(env, enif_make_int(env, read_errno));
+  }
+}
+
+/* Sets kernel pipe buffer capacity, so that a single read can return
+ * more than the default pipe capacity. Only supported on Linux */
+static ERL_NIF_TERM nif_set_pipe_size(ErlNifEnv *env, int argc,
+                                      const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 2);
+
+  io_resource_t *res;
+  int size;
+
+  if (!get_io_resource(env, argv[0], &res))
+    return make_error(env, ATOM_INVALID_FD);
+
+  if (!enif_get_int(env, argv[1], &size) || size < 1)
+    return enif_make_badarg(env);
+
+#ifdef F_SETPIPE_SZ
+  int ret = fcntl(res->fd, F_SETPIPE_SZ, size);
+
+  if (ret < 0)
+    return make_error(env, enif_make_int(env, errno));
+
+  /* kernel rounds up the size */
+  return make_ok(env, enif_make_int(env, ret));
+#else
+  return make_error(env, ATOM_ENOTSUP);
+#endif
+}
+
+static ERL_NIF_TERM nif_read_drain(ErlNifEnv *env, int argc,
+                                   const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 2);
+
+  int max_size;
+  io_resource_t *res;
+
+  if (!get_io_resource(env, argv[0], &res))
+    return make_error(env, ATOM_INVALID_FD);
+
+  if (!enif_get_int(env, argv[1], &max_size))
+    return enif_make_badarg(env);
+
+  return read_pipe(env, res, max_size, true);
+}
+
+/* Reads from whichever of stdout and stderr is ready, in a single call.
+ * Both fds are polled without blocking, and when both are ready the
+ * pipes are served in round-robin, so that a chatty stdout can not
+ * starve stderr. Returns `{:ok, {stdout | stderr, data}}`, `{:ok, <<>>}`
+ * when both pipes reached EOF or are closed, or `{:error, :eagain}` after
+ * arming select for both pipes at once */
+static ERL_NIF_TERM nif_read_any(ErlNifEnv *env, int argc,
+                                 const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 3);
+
+  const int names[2] = {PIPE_STDOUT, PIPE_STDERR};
+  const ERL_NIF_TERM *tuple;
+  process_resource_t *proc;
+  struct pollfd fds[2];
+  bool done[2], armed[2], drain;
+  ERL_NIF_TERM term, eagain;
+  io_resource_t *res;
+  int max_size, i, n, arity, retval;
+
+  if (!enif_get_resource(env, argv[0], PROCESS_RT, (void **)&proc))
+    return make_error(env, ATOM_INVALID_FD);
+
+  if (!enif_get_int(env, argv[1], &max_size))
+    return enif_make_badarg(env);
+
+  drain = enif_is_identical(argv[2], ATOM_TRUE);
+
+  for (i = 0; i < 2; i++) {
+    /* poll(2) ignores negative fds, such as a closed pipe */
+    fds[i].fd = proc->pipes[names[i]].fd;
+    fds[i].events = POLLIN;
+    fds[i].revents = 0;
+    done[i] = fds[i].fd < 0;
+    armed[i] = false;
+  }
+
+  if (poll(fds, 2, 0) < 0 && errno != EINTR)
+    return make_error(env, enif_make_int(env, errno));
+
+  /* ring might have data without a doorbell */
+  for (i = 0; i < 2; i++) {
+    if (proc->pipes[names[i]].ring != NULL)
+      fds[i].revents |= POLLIN;
+  }
+
+  eagain = make_error(env, ATOM_EAGAIN);
+
+  for (n = 0; n < 2; n++) {
+    i = proc->read_any_next == PIPE_STDOUT ? n : 1 - n;
+    res = &proc->pipes[names[i]];
+
+    if (done[i] || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+      continue;
+
+    term = read_pipe(env, res, max_size, drain);
+
+    /* select is already armed by the read */
+    if (enif_is_identical(term, eagain)) {
+      armed[i] = true;
+      continue;
+    }
+
+    if (is_eof(env, term)) {
+      done[i] = true;
+      continue;
+    }
+
+    proc->read_any_next = names[1 - i];
+
+    if (enif_get_tuple(env, term, &arity, &tuple) &&
+        enif_is_identical(tuple[0], ATOM_OK))
+      return make_ok(env, enif_make_tuple2(env, res->name, tuple[1]));
+
+    return term;
+  }
+
+  if (done[0] && done[1]) {
+    enif_make_new_binary(env, 0, &term);
+    return make_ok(env, term);
+  }
+
+  for (i = 0; i < 2; i++) {
+    if (done[i] || armed[i])
+      continue;
+
+    retval = select_read(env, &proc->pipes[names[i]]);
+    if (retval != 0)
+      return make_error(env, enif_make_int(env, retval));
+  }
+
+  return eagain;
+}
+
+/* Arms select for the side which is blocking the splice. splice(2)
+ * returns EAGAIN both when `src` is empty and when `dst` is full */
+static int select_splice(ErlNifEnv *env, io_resource_t *src,
+                         io_resource_t *dst) {
+  struct pollfd fds[2];
+  bool src_ready, dst_ready;
+  int ret = 0;
+
+  fds[0].fd = src->fd;
+  fds[0].events = POLLIN;
+  fds[0].revents = 0;
+  fds[1].fd = dst->fd;
+  fds[1].events = POLLOUT;
+  fds[1].revents = 0;
+
+  if (poll(fds, 2, 0) < 0)
+    perror("poll()");
+
+  src_ready = fds[0].revents & (POLLIN | POLLHUP);
+  dst_ready = fds[1].revents & (POLLOUT | POLLERR);
+
+  /* when it is not clear which side is blocking we wait for both */
+  if (!src_ready || dst_ready)
+    ret = select_read(env, src);
+  if (ret == 0 && (!dst_ready || src_ready))
+    ret = select_write(env, dst);
+
+  return ret;
+}
+
+/* Copies a single read from `src` to the `dst` write queue. Used when
+ * splice(2) is not available or not supported by the fds. Returns the
+ * number of bytes read, 0 on EOF or -1 with errno set */
+static ssize_t copy_to_write_queue(io_resource_t *src, io_resource_t *dst) {
+  ErlNifBinary bin;
+  ssize_t result;
+  int read_errno;
+
+  if (dst->write_queue == NULL) {
+    dst->write_queue = enif_ioq_create(ERL_NIF_IOQ_NORMAL);
+    if (dst->write_queue == NULL) {
+      errno = ENOMEM;
+      return -1;
+    }
+  }
+
+  if (!enif_alloc_binary(PIPE_BUF_SIZE, &bin)) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  result = read(src->fd, bin.data, bin.size);
+  read_errno = errno;
+  count_read(src, result);
+
+  if (result <= 0) {
+    enif_release_binary(&bin);
+    errno = read_errno;
+    return result;
+  }
+
+  if ((size_t)result < bin.size && !enif_realloc_binary(&bin, result)) {
+    enif_release_binary(&bin);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  /* ownership of the binary is transferred to the queue */
+  if (!enif_ioq_enq_binary(dst->write_queue, &bin, 0)) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  return result;
+}
+
+/* Moves data from `src` to `dst` without copying it through the VM.
+ * Uses splice(2) on Linux and falls back to read/write through the `dst`
+ * write queue elsewhere. Keeps moving until EAGAIN, EOF or the timeslice
+ * budget is exhausted and returns the number of bytes moved, `{:ok, 0}`
+ * means EOF. Like reads, error is returned by the next call if some data
+ * is already moved */
+static ERL_NIF_TERM nif_splice(ErlNifEnv *env, int argc,
+                               const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 2);
+
+  ErlNifTime start;
+  ERL_NIF_TERM ret;
+  io_resource_t *src, *dst;
+  ErlNifSInt64 total = 0;
+  ssize_t result;
+  int splice_errno = 0;
+  bool use_splice = false;
+
+  start = enif_monotonic_time(ERL_NIF_USEC);
+
+  if (!get_io_resource(env, argv[0], &src) ||
+      !get_io_resource(env, argv[1], &dst))
+    return make_error(env, ATOM_INVALID_FD);
+
+  /* data is not in the pipe */
+  if (src->ring != NULL)
+    return make_error(env, ATOM_ENOTSUP);
+
+  /* data queued by an earlier copy or write must go out first */
+  if (dst->write_queue != NULL && enif_ioq_size(dst->write_queue) > 0) {
+    ret = flush_write_queue(env, dst, start, false);
+    if (enif_compare(ret, ATOM_OK) != 0)
+      return ret;
+  }
+
+#ifdef __linux__
+  use_splice = true;
+#endif
+
+  for (;;) {
+#ifdef __linux__
+    if (use_splice) {
+      result = splice(src->fd, NULL, dst->fd, NULL, SPLICE_CHUNK_SIZE,
+                      SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      splice_errno = errno;
+      count_read(src, result);
+      count_write(dst, result, result);
+
+      /* such as `dst` being a file opened in append mode */
+      if (result < 0 && splice_errno == EINVAL) {
+        use_splice = false;
+        continue;
+      }
+    }
+#endif
+
+    if (!use_splice) {
+      result = copy_to_write_queue(src, dst);
+      splice_errno = errno;
+
+      if (result > 0) {
+        total += result;
+        ret = flush_write_queue(env, dst, start, false);
+        /* on eagain the data stays in the queue and select is armed,
+         * on error the queue is cleared */
+        if (enif_compare(ret, ATOM_OK) != 0) {
+          if (enif_ioq_size(dst->write_queue) > 0)
+            break;
+          return ret;
+        }
+      }
+    } else if (result > 0) {
+      total += result;
+    }
+
+    if (result <= 0)
+      break;
+
+    if (enif_monotonic_time(ERL_NIF_USEC) - start >= DRAIN_TIME_BUDGET)
+      break;
+  }
+
+  notify_consumed_timeslice(env, start, enif_monotonic_time(ERL_NIF_USEC));
+
+  if (total > 0 || result >= 0)
+    return make_ok(env, enif_make_int64(env, total));
+
+  if (splice_errno == EAGAIN || splice_errno == EWOULDBLOCK) { // busy
+    int retval = use_splice ? select_splice(env, src, dst)
+                            : select_read(env, src);
+    if (retval != 0)
+      return make_error(env, enif_make_int(env, retval));
+    return make_error(env, ATOM_EAGAIN);
+  } else if (splice_errno == EPIPE) {
+    return make_error(env, ATOM_EPIPE);
+  } else {
+    perror("splice()");
+    return make_error(env, enif_make_int(env, splice_errno));
+  }
+}
+
+/* Returns IO counters of the fd as a map. Counters are kept after the fd
+ * is closed, so it can be called at the end to get the totals */
+static ERL_NIF_TERM nif_fd_stats(ErlNifEnv *env, int argc,
+                                 const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 1);
+
+  ERL_NIF_TERM keys[6], values[6], map;
+  io_resource_t *res;
+
+  if (!get_io_resource(env, argv[0], &res))
+    return make_error(env, ATOM_INVALID_FD);
+
+  keys[0] = ATOM_BYTES_READ;
+  values[0] = enif_make_uint64(env, res->stats.bytes_read);
+  keys[1] = ATOM_BYTES_WRITTEN;
+  values[1] = enif_make_uint64(env, res->stats.bytes_written);
+  keys[2] = ATOM_READS;
+  values[2] = enif_make_uint64(env, res->stats.reads);
+  keys[3] = ATOM_WRITES;
+  values[3] = enif_make_uint64(env, res->stats.writes);
+  keys[4] = ATOM_PARTIAL_WRITES;
+  values[4] = enif_make_uint64(env, res->stats.partial_writes);
+  keys[5] = ATOM_SELECTS;
+  values[5] = enif_make_uint64(env, res->stats.selects);
+
+  if (!enif_make_map_from_arrays(env, keys, values, 6, &map))
+    return make_error(env, ATOM_ERROR);
+
+  return make_ok(env, map);
+}
+
+static ERL_NIF_TERM nif_close(ErlNifEnv *env, int argc,
+                              const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 1);
+
+  io_resource_t *res;
+
+  if (!get_io_resource(env, argv[0], &res))
+    return make_error(env, ATOM_INVALID_FD);
+
+  if (cancel_select(env, res) < 0)
+    return make_error(env, ATOM_SELECT_CANCEL_ERROR);
+
+  return ATOM_OK;
+}
+
+/* Returns an fd resource which becomes readable when the process exits,
+ * select is armed before returning, so caller gets `:ready_input` on
+ * exit. Uses pidfd on Linux (5.3+) and kqueue EVFILT_PROC on BSD and
+ * macOS. Returns `{:error, :enotsup}` when neither is available */
+static ERL_NIF_TERM nif_watch_process_exit(ErlNifEnv *env, int argc,
+                                           const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 1);
+
+  const ERL_NIF_TERM *tuple;
+  ERL_NIF_TERM ret;
+  io_resource_t *res;
+  int pid, fd, arity;
+
+  if (!enif_get_int(env, argv[0], &pid) || pid < 1)
+    return enif_make_badarg(env);
+
+#if defined(__linux__) && defined(SYS_pidfd_open)
+  fd = syscall(SYS_pidfd_open, pid, 0);
+
+  if (fd < 0) {
+    if (errno == ENOSYS)
+      return make_error(env, ATOM_ENOTSUP);
+    return make_error(env, enif_make_int(env, errno));
+  }
+#elif defined(EVFILT_PROC)
+  struct kevent change;
+
+  fd = kqueue();
+  if (fd < 0)
+    return make_error(env, enif_make_int(env, errno));
+
+  EV_SET(&change, pid, EVFILT_PROC, EV_ADD | EV_ONESHOT, NOTE_EXIT, 0, NULL);
+
+  if (kevent(fd, &change, 1, NULL, 0, NULL) < 0) {
+    int kevent_errno = errno;
+    close(fd);
+    return make_error(env, enif_make_int(env, kevent_errno));
+  }
+#else
+  return make_error(env, ATOM_ENOTSUP);
+#endif
+
+  ret = make_fd_resource(env, fd);
+  if (enif_compare(ret, ATOM_ERROR) == 0) {
+    close(fd);
+    return ret;
+  }
+
+  if (!enif_get_tuple(env, ret, &arity, &tuple) ||
+      !enif_get_resource(env, tuple[1], FD_RT, (void **)&res))
+    return ATOM_ERROR;
+
+  if (select_read(env, res) != 0)
+    return make_error(env, ATOM_ERROR);
+
+  return ret;
+}
+
+/* Checks that the peer of the unix socket `fd` is the process `os_pid`
+ * run by the same user as the VM. Anyone can connect to an abstract
+ * socket address since it has no permissions. Other platforms use a
+ * socket file and the pid of the peer is not available everywhere, so
+ * only the user is checked */
+static ERL_NIF_TERM nif_verify_peer(ErlNifEnv *env, int argc,
+                                    const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 2);
+
+  int fd;
+  pid_t os_pid;
+
+  if (!enif_get_int(env, argv[0], &fd) ||
+      !enif_get_int(env, argv[1], (int *)&os_pid))
+    return enif_make_badarg(env);
+
+#if defined(__linux__)
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+    return make_error(env, enif_make_int(env, errno));
+
+  if (cred.uid != geteuid() || cred.pid != os_pid)
+    return make_error(env, ATOM_INVALID_PEER);
+#else
+  uid_t uid;
+  gid_t gid;
+
+  if (getpeereid(fd, &uid, &gid) != 0)
+    return make_error(env, enif_make_int(env, errno));
+
+  if (uid != geteuid())
+    return make_error(env, ATOM_INVALID_PEER);
+#endif
+
+  return ATOM_OK;
+}
+
+static ERL_NIF_TERM nif_is_os_pid_alive(ErlNifEnv *env, int argc,
+                                        const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 1);
+
+  pid_t pid;
+
+  if (!enif_get_int(env, argv[0], (int *)&pid))
+    return enif_make_badarg(env);
+
+  int result = kill(pid, 0);
+
+  if (result == 0)
+    return ATOM_TRUE;
+  else
+    return ATOM_FALSE;
+}
+
+static ERL_NIF_TERM nif_kill(ErlNifEnv *env, int argc,
+                             const ERL_NIF_TERM argv[]) {
+  ASSERT_ARGC(argc, 2);
+
+  pid_t pid;
+  int ret;
+
+  // we should not assume pid type to be `int`?
+  if (!enif_get_int(env, argv[0], (int *)&pid))
+    return enif_make_badarg(env);
+
+  if (enif_compare(argv[1], ATOM_SIGKILL) == 0)
+    ret = kill(pid, SIGKILL);
+  else if (enif_compare(argv[1], ATOM_SIGTERM) == 0)
+    ret = kill(pid, SIGTERM);
+  else if (enif_compare(argv[1], ATOM_SIGPIPE) == 0) {
+    ret = kill(pid, SIGPIPE);
+  } else
+    return enif_make_badarg(env);
+
+  if (ret != 0) {
+    perror("[exile] failed to send signal");
+    return make_error(
+        env, enif_make_string(env, "failed to send signal", ERL_NIF_LATIN1));
+  }
+
+  return ATOM_OK;
 }
 
 static int on_load(ErlNifEnv *env, void **priv, ERL_NIF_TERM load_info) {
@@ -323,24 +2304,69 @@ static int on_load(ErlNifEnv *env, void **priv, ERL_NIF_TERM load_info) {
   io_rt_init.stop = io_resource_stop;
   io_rt_init.down = io_resource_down;
 
+  process_rt_init.dtor = process_resource_dtor;
+  process_rt_init.stop = io_resource_stop;
+  process_rt_init.down = process_resource_down;
+
+  buffer_rt_init.dtor = buffer_resource_dtor;
+
+  long iov_max = sysconf(_SC_IOV_MAX);
+  if (iov_max > 0)
+    MAX_IOV_COUNT = (int)iov_max;
+
   FD_RT =
       enif_open_resource_type_x(env, "exile_resource", &io_rt_init,
                                 ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL);
 
+  PROCESS_RT = enif_open_resource_type_x(
+      env, "exile_process_resource", &process_rt_init,
+      ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL);
+
+  BUFFER_RT = enif_open_resource_type_x(
+      env, "exile_buffer_resource", &buffer_rt_init,
+      ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL);
+
   ATOM_TRUE = enif_make_atom(env, "true");
   ATOM_FALSE = enif_make_atom(env, "false");
   ATOM_OK = enif_make_atom(env, "ok");
   ATOM_ERROR = enif_make_atom(env, "error");
   ATOM_UNDEFINED = enif_make_atom(env, "undefined");
   ATOM_INVALID_FD = enif_make_atom(env, "invalid_fd_resource");
+  ATOM_INVALID_PEER = enif_make_atom(env, "invalid_peer");
   ATOM_EAGAIN = enif_make_atom(env, "eagain");
   ATOM_EPIPE = enif_make_atom(env, "epipe");
+  ATOM_ENOTSUP = enif_make_atom(env, "enotsup");
+  ATOM_CONTINUE = enif_make_atom(env, "continue");
   ATOM_SELECT_CANCEL_ERROR = enif_make_atom(env, "select_cancel_error");
 
   ATOM_SIGTERM = enif_make_atom(env, "sigterm");
   ATOM_SIGKILL = enif_make_atom(env, "sigkill");
   ATOM_SIGPIPE = enif_make_atom(env, "sigpipe");
 
+  ATOM_SELECT = enif_make_atom(env, "select");
+  ATOM_READY_INPUT = enif_make_atom(env, "ready_input");
+  ATOM_READY_OUTPUT = enif_make_atom(env, "ready_output");
+  ATOM_STDIN = enif_make_atom(env, "stdin");
+  ATOM_STDOUT = enif_make_atom(env, "stdout");
+  ATOM_STDERR = enif_make_atom(env, "stderr");
+
+  ATOM_DELIMITER = enif_make_atom(env, "delimiter");
+  ATOM_LENGTH_PREFIXED = enif_make_atom(env, "length_prefixed");
+  ATOM_INCOMPLETE_RECORD = enif_make_atom(env, "incomplete_record");
+  ATOM_RECORD_TOO_LARGE = enif_make_atom(env, "record_too_large");
+
+  ATOM_BYTES_READ = enif_make_atom(env, "bytes_read");
+  ATOM_BYTES_WRITTEN = enif_make_atom(env, "bytes_written");
+  ATOM_READS = enif_make_atom(env, "reads");
+  ATOM_WRITES = enif_make_atom(env, "writes");
+  ATOM_PARTIAL_WRITES = enif_make_atom(env, "partial_writes");
+  ATOM_SELECTS = enif_make_atom(env, "selects");
+
+  ATOM_ALLOCATED = enif_make_atom(env, "allocated");
+  ATOM_REUSED = enif_make_atom(env, "reused");
+  ATOM_COPIED = enif_make_atom(env, "copied");
+  ATOM_FREE = enif_make_atom(env, "free");
+
   return 0;
 }
 
@@ -349,13 +2375,37 @@ static void on_unload(ErlNifEnv *env, void *priv) {
   enif_free(priv);
 }
 
+/* IO on the non-blocking pipes is bounded by DRAIN_TIME_BUDGET, so the
+ * IO functions are also registered for normal schedulers with a
+ * `_normal` suffix, see the `nif_scheduler` option */
 static ErlNifFunc nif_funcs[] = {
     {"nif_read", 2, nif_read, USE_DIRTY_IO},
-    {"nif_create_fd", 1, nif_create_fd, USE_DIRTY_IO},
+    {"nif_read_normal", 2, nif_read, 0},
+    {"nif_read_drain", 2, nif_read_drain, USE_DIRTY_IO},
+    {"nif_read_drain_normal", 2, nif_read_drain, 0},
+    {"nif_read_any", 3, nif_read_any, USE_DIRTY_IO},
+    {"nif_read_any_normal", 3, nif_read_any, 0},
+    {"nif_read_all", 2, nif_read_all, USE_DIRTY_IO},
+    {"nif_read_all_normal", 2, nif_read_all, 0},
+    {"nif_create_process", 5, nif_create_process, 0},
+    {"nif_dup_fd", 1, nif_dup_fd, 0},
     {"nif_write", 2, nif_write, USE_DIRTY_IO},
-    {"nif_close", 1, nif_close, USE_DIRTY_IO},
-    {"nif_is_os_pid_alive", 1, nif_is_os_pid_alive, USE_DIRTY_IO},
-    {"nif_kill", 2, nif_kill, USE_DIRTY_IO}};
+    {"nif_write_normal", 2, nif_write_normal, 0},
+    {"nif_write_iov", 2, nif_write_iov, USE_DIRTY_IO},
+    {"nif_write_iov_normal", 2, nif_write_iov_normal, 0},
+    {"nif_close", 1, nif_close, 0},
+    {"nif_splice", 2, nif_splice, USE_DIRTY_IO},
+    {"nif_splice_normal", 2, nif_splice, 0},
+    {"nif_fd_stats", 1, nif_fd_stats, 0},
+    {"nif_set_pipe_size", 2, nif_set_pipe_size, 0},
+    {"nif_set_framing", 3, nif_set_framing, 0},
+    {"nif_attach_ring", 3, nif_attach_ring, USE_DIRTY_IO},
+    {"nif_enable_buffer_pool", 1, nif_enable_buffer_pool, 0},
+    {"nif_buffer_pool_stats", 1, nif_buffer_pool_stats, 0},
+    {"nif_watch_process_exit", 1, nif_watch_process_exit, 0},
+    {"nif_is_os_pid_alive", 1, nif_is_os_pid_alive, 0},
+    {"nif_verify_peer", 2, nif_verify_peer, 0},
+    {"nif_kill", 2, nif_kill, 0}};
 
 ERL_NIF_INIT(Elixir.Exile.Process.Nif, nif_funcs, &on_load, NULL, NULL,
              &on_unload)
@@ -0,0 +1,236 @@
+#ifndef EXILE_RING_H
+#define EXILE_RING_H
+
+/* Shared memory ring used for `stdout: {:ring, capacity}`
+ *
+ * Single producer (the command) single consumer (the VM) byte ring,
+ * set up by the spawner. The ring fd is mapped by both sides, first
+ * EXILE_RING_HEADER_SIZE bytes are `exile_ring_t` followed by `capacity`
+ * bytes of data. `head` and `tail` are free running byte counters, the
+ * readable data is `[tail, head)`.
+ *
+ * Doorbells are pipes so that both sides can wait with poll(2), and the
+ * VM with enif_select. After publishing data the producer writes a byte
+ * to its stdout if `consumer_waiting` is set. After consuming the VM
+ * writes a byte to the doorbell if `producer_waiting` is set. Closing
+ * stdout (or exiting) marks the end of the stream, data still in the
+ * ring is read by the VM before EOF. Reading EOF from the doorbell
+ * means the VM is gone.
+ *
+ * On Linux the ring is a memfd sealed against resizing, since an access
+ * past the end of a truncated mapping is SIGBUS. Other platforms use an
+ * unlinked file which can not be sealed, and the command is trusted not
+ * to truncate it.
+ *
+ * Command gets the ring as fd EXILE_RING_FD and the doorbell read end as
+ * fd EXILE_RING_DOORBELL_FD, also advertised with the env variables of
+ * the same name. Programs written in C can include this file and use
+ * `exile_ring_map` and `exile_ring_write`. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define EXILE_RING_MAGIC 0x474e5245 /* "ERNG" */
+#define EXILE_RING_VERSION 1
+/* data starts at a page boundary */
+#define EXILE_RING_HEADER_SIZE 4096
+#define EXILE_RING_MIN_CAPACITY 4096
+#define EXILE_RING_MAX_CAPACITY (1UL << 30)
+
+#define EXILE_RING_FD 3
+#define EXILE_RING_DOORBELL_FD 4
+
+/* file sealing is available since Linux 3.17, libc might not define it */
+#if defined(__linux__)
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_GET_SEALS 1034
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+#define EXILE_RING_SEALS (F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW)
+#endif
+
+/* fields written by the producer and the consumer are kept on separate
+ * cache lines */
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  /* power of two */
+  uint64_t capacity;
+  char pad0[48];
+
+  /* advanced by the producer */
+  uint64_t head;
+  /* set by the producer when the ring is full */
+  uint32_t producer_waiting;
+  char pad1[52];
+
+  /* advanced by the consumer */
+  uint64_t tail;
+  /* set by the consumer when the ring is empty */
+  uint32_t consumer_waiting;
+  char pad2[52];
+} exile_ring_t;
+
+static inline unsigned char *exile_ring_data(exile_ring_t *ring) {
+  return (unsigned char *)ring + EXILE_RING_HEADER_SIZE;
+}
+
+static inline size_t exile_ring_map_size(uint64_t capacity) {
+  return EXILE_RING_HEADER_SIZE + (size_t)capacity;
+}
+
+static inline int exile_ring_valid_capacity(uint64_t capacity) {
+  return capacity >= EXILE_RING_MIN_CAPACITY &&
+         capacity <= EXILE_RING_MAX_CAPACITY &&
+         (capacity & (capacity - 1)) == 0;
+}
+
+/* Maps the ring, returns NULL with errno set on failure. The fd can be
+ * closed afterwards. `*capacity` is set to the validated capacity, the
+ * other side can rewrite the header, so it must not be read again */
+static inline exile_ring_t *exile_ring_map(int fd, uint64_t *capacity_out) {
+  exile_ring_t *ring;
+  uint64_t capacity;
+  void *map;
+
+#if defined(__linux__)
+  int seals = fcntl(fd, F_GET_SEALS);
+
+  if (seals < 0 || (seals & EXILE_RING_SEALS) != EXILE_RING_SEALS) {
+    errno = EINVAL;
+    return NULL;
+  }
+#endif
+
+  map = mmap(NULL, EXILE_RING_HEADER_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  ring = (exile_ring_t *)map;
+  capacity = ring->capacity;
+
+  if (ring->magic != EXILE_RING_MAGIC || ring->version != EXILE_RING_VERSION ||
+      !exile_ring_valid_capacity(capacity)) {
+    munmap(map, EXILE_RING_HEADER_SIZE);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  munmap(map, EXILE_RING_HEADER_SIZE);
+
+  map = mmap(NULL, exile_ring_map_size(capacity), PROT_READ | PROT_WRITE,
+             MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  *capacity_out = capacity;
+  return (exile_ring_t *)map;
+}
+
+static inline void exile_ring_unmap(exile_ring_t *ring, uint64_t capacity) {
+  munmap(ring, exile_ring_map_size(capacity));
+}
+
+/* Rings the doorbell `fd` if the other side is waiting on `flag`. The
+ * fence pairs with the one in the waiting side, so either the waiter
+ * sees the new counter or we see the flag */
+static inline int exile_ring_notify(uint32_t *flag, int fd) {
+  char byte = 0;
+  ssize_t ret;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  if (__atomic_exchange_n(flag, 0, __ATOMIC_SEQ_CST) == 0)
+    return 0;
+
+  do {
+    ret = write(fd, &byte, 1);
+  } while (ret < 0 && errno == EINTR);
+
+  /* doorbell pipe is full, there is a pending notification already */
+  if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+    return -1;
+
+  return 0;
+}
+
+static inline uint64_t exile_ring_free_space(exile_ring_t *ring) {
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+  return ring->capacity - (head - tail);
+}
+
+/* Producer side. Blocks on the doorbell until the consumer frees some
+ * space. Returns -1 with errno EPIPE when the VM is gone */
+static inline int exile_ring_wait_space(exile_ring_t *ring) {
+  char buf[64];
+  ssize_t ret;
+
+  __atomic_store_n(&ring->producer_waiting, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  /* consumer might have freed space before seeing the flag */
+  if (exile_ring_free_space(ring) > 0) {
+    __atomic_store_n(&ring->producer_waiting, 0, __ATOMIC_RELAXED);
+    return 0;
+  }
+
+  do {
+    ret = read(EXILE_RING_DOORBELL_FD, buf, sizeof(buf));
+  } while (ret < 0 && errno == EINTR);
+
+  if (ret == 0)
+    errno = EPIPE;
+
+  return ret > 0 ? 0 : -1;
+}
+
+/* Producer side. Copies `size` bytes into the ring, waiting for space
+ * when the ring is full. Returns 0, or -1 with errno set */
+static inline int exile_ring_write(exile_ring_t *ring, const void *data,
+                                   size_t size) {
+  const unsigned char *src = (const unsigned char *)data;
+  uint64_t head, space, offset, n;
+
+  while (size > 0) {
+    space = exile_ring_free_space(ring);
+
+    if (space == 0) {
+      if (exile_ring_wait_space(ring) != 0)
+        return -1;
+      continue;
+    }
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    offset = head & (ring->capacity - 1);
+
+    /* contiguous part up to the end of the data area */
+    n = ring->capacity - offset;
+    if (n > space)
+      n = space;
+    if (n > size)
+      n = size;
+
+    memcpy(exile_ring_data(ring) + offset, src, n);
+    __atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+
+    if (exile_ring_notify(&ring->consumer_waiting, STDOUT_FILENO) != 0)
+      return -1;
+
+    src += n;
+    size -= n;
+  }
+
+  return 0;
+}
+
+#endif
@@ -1,14 +1,45 @@
+#ifdef __linux__
+/* for syscall(2) */
+#define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include "exile_ring.h"
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/* close_range(2) is available since Linux 5.9, CLOSE_RANGE_CLOEXEC since
+ * 5.11. libc might not have the wrapper, so we use the syscall */
+#if defined(__linux__) && !defined(CLOSE_RANGE_CLOEXEC)
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
+/* memfd_create(2) is available since Linux 3.17, libc wrapper since
+ * glibc 2.27 */
+#if defined(__linux__) && !defined(MFD_CLOEXEC)
+#define MFD_CLOEXEC 0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+
 // #define DEBUG
 
 #ifdef DEBUG
@@ -36,42 +67,86 @@ static const int PIPE_WRITE = 1;
  * https://www.tldp.org/LDP/abs/html/exitcodes.html. */
 static const int FORK_EXEC_FAILURE = 125;
 
+/* upper limit for a single spawn request in daemon mode */
+static const uint32_t MAX_REQUEST_SIZE = 16 * 1024 * 1024;
+
+/* fds passed by the VM for `fd` redirects, one for each stdio stream */
+#define MAX_PASSED_FDS 3
+/* fds sent to the VM, stdio pipes and the ring with its doorbell */
+#define MAX_IO_FDS 5
+
+static const char FILE_REDIRECT[] = "file:";
+static const char FD_REDIRECT[] = "fd";
+static const char RING_MODE[] = "ring:";
+/* stderr shares the stdout of the command, same as `2>&1` */
+static const char STDERR_TO_STDOUT[] = "redirect_to_stdout";
+
+/* fds of a shared memory ring, see `c_src/exile_ring.h` */
+static const int RING_FD = 0;
+static const int RING_DOORBELL_READ = 1;
+static const int RING_DOORBELL_WRITE = 2;
+
+/* ring fds are moved above the fds which the command gets, so that
+ * setting up the command stdio does not clobber them */
+static const int RING_MIN_FD = EXILE_RING_DOORBELL_FD + 1;
+
+/* Replies sent by the daemon. All replies are of fixed size so that the
+ * VM can read exactly one reply, along with its fds, at a time. */
+static const int32_t REPLY_SPAWNED = 'S';
+static const int32_t REPLY_ERROR = 'E';
+static const int32_t REPLY_EXIT = 'X';
+
+typedef struct {
+  int32_t tag;
+  /* request id for `S` and `E`, os pid for `X` */
+  int32_t id;
+  /* os pid for `S`, errno for `E`, exit status for `X` */
+  int32_t value;
+  int32_t reserved;
+} daemon_reply_t;
+
 static int set_flag(int fd, int flags) {
   return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | flags);
 }
 
-static int send_io_fds(int socket, int stdin_fd, int stdout_fd, int stderr_fd) {
+/* FD_CLOEXEC is a descriptor flag, it can not be set using F_SETFL */
+static int set_cloexec(int fd) {
+  return fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+}
+
+static int send_fds(int socket, const int *fds, int fd_count, void *data,
+                    size_t data_len) {
   struct msghdr msg = {0};
   struct cmsghdr *cmsg;
-  int fds[3];
-  char buf[CMSG_SPACE(3 * sizeof(int))];
-  char dup[256];
+  char buf[CMSG_SPACE(MAX_IO_FDS * sizeof(int))];
   struct iovec io;
+  ssize_t ret;
 
   memset(buf, '\0', sizeof(buf));
 
-  io.iov_base = &dup;
-  io.iov_len = sizeof(dup);
+  io.iov_base = data;
+  io.iov_len = data_len;
 
   msg.msg_iov = &io;
   msg.msg_iovlen = 1;
-  msg.msg_control = buf;
-  msg.msg_controllen = sizeof(buf);
 
-  cmsg = CMSG_FIRSTHDR(&msg);
-  cmsg->cmsg_level = SOL_SOCKET;
-  cmsg->cmsg_type = SCM_RIGHTS;
-  cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+  if (fd_count > 0) {
+    msg.msg_control = buf;
+    msg.msg_controllen = CMSG_SPACE(fd_count * sizeof(int));
 
-  fds[0] = stdin_fd;
-  fds[1] = stdout_fd;
-  fds[2] = stderr_fd;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(fd_count * sizeof(int));
 
-  debug("stdout: %d, stderr: %d", stdout_fd, stderr_fd);
+    memcpy((int *)CMSG_DATA(cmsg), fds, fd_count * sizeof(int));
+  }
 
-  memcpy((int *)CMSG_DATA(cmsg), fds, 3 * sizeof(int));
+  do {
+    ret = sendmsg(socket, &msg, 0);
+  } while (ret < 0 && errno == EINTR);
 
-  if (sendmsg(socket, &msg, 0) < 0) {
+  if (ret < 0) {
     debug("Failed to send message");
     return EXIT_FAILURE;
   }
@@ -79,6 +154,318 @@ static int send_io_fds(int socket, int stdin_fd, int stdout_fd, int stderr_fd) {
   return EXIT_SUCCESS;
 }
 
+/* Receives into `buf` along with the fds sent by the peer. Fds beyond
+ * `max_fds` are closed. Returns like recv(2) */
+static ssize_t recv_with_fds(int socket, void *buf, size_t size, int *fds,
+                             int max_fds, int *fd_count) {
+  struct msghdr msg = {0};
+  struct cmsghdr *cmsg;
+  char ctrl[CMSG_SPACE(MAX_PASSED_FDS * sizeof(int))];
+  struct iovec io;
+  ssize_t ret;
+  int count, fd;
+
+  memset(ctrl, '\0', sizeof(ctrl));
+  *fd_count = 0;
+
+  io.iov_base = buf;
+  io.iov_len = size;
+
+  msg.msg_iov = &io;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl;
+  msg.msg_controllen = sizeof(ctrl);
+
+  do {
+    ret = recvmsg(socket, &msg, 0);
+  } while (ret < 0 && errno == EINTR);
+
+  if (ret <= 0)
+    return ret;
+
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+
+    count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+    for (int i = 0; i < count; i++) {
+      memcpy(&fd, (char *)CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+
+      if (*fd_count < max_fds && set_cloexec(fd) == 0) {
+        fds[(*fd_count)++] = fd;
+      } else {
+        close(fd);
+      }
+    }
+  }
+
+  return ret;
+}
+
+static void close_fds(int *fds, int count) {
+  for (int i = 0; i < count; i++) {
+    if (fds[i] >= 0) {
+      close(fds[i]);
+      fds[i] = -1;
+    }
+  }
+}
+
+/* Sets `redirects[i]` to the fd to be used as the stdio stream `i` of the
+ * command instead of the pipe, or -1 when the stream is not redirected.
+ * Mode `file:<path>` opens the file, truncating it, and `fd` takes the
+ * next of the fds passed by the VM. Redirect fds are CLOEXEC and must be
+ * closed by the caller. Returns 0 or an errno value */
+static int open_redirects(const char *const modes[3], const int *passed_fds,
+                          int passed_count, int redirects[3]) {
+  int next = 0, err;
+
+  for (int i = 0; i < 3; i++)
+    redirects[i] = -1;
+
+  for (int i = 0; i < 3; i++) {
+    if (modes[i] == NULL)
+      continue;
+
+    if (strncmp(modes[i], FILE_REDIRECT, sizeof(FILE_REDIRECT) - 1) == 0) {
+      redirects[i] =
+          open(modes[i] + sizeof(FILE_REDIRECT) - 1,
+               (i == STDIN_FILENO ? O_RDONLY : O_WRONLY | O_CREAT | O_TRUNC) |
+                   O_CLOEXEC,
+               0644);
+    } else if (strcmp(modes[i], FD_REDIRECT) == 0) {
+      if (next >= passed_count) {
+        err = EBADF;
+        goto error;
+      }
+      /* passed fds are closed by the caller */
+      redirects[i] = fcntl(passed_fds[next++], F_DUPFD_CLOEXEC, 0);
+    } else {
+      continue;
+    }
+
+    if (redirects[i] < 0) {
+      err = errno;
+      goto error;
+    }
+  }
+
+  return 0;
+
+error:
+  close_fds(redirects, 3);
+  return err;
+}
+
+static bool needs_passed_fds(const char *const modes[3]) {
+  for (int i = 0; i < 3; i++) {
+    if (modes[i] != NULL && strcmp(modes[i], FD_REDIRECT) == 0)
+      return true;
+  }
+  return false;
+}
+
+/* Moves `fd` to a CLOEXEC fd not lower than RING_MIN_FD */
+static int move_ring_fd(int fd) {
+  int new_fd;
+
+  if (fd < 0)
+    return fd;
+
+  new_fd = fcntl(fd, F_DUPFD_CLOEXEC, RING_MIN_FD);
+  close(fd);
+  return new_fd;
+}
+
+static int create_ring_fd(void) {
+#if defined(__linux__)
+  /* only a memfd can be sealed, which the VM requires on Linux */
+  return syscall(SYS_memfd_create, "exile-ring",
+                 MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+  char path[PATH_MAX];
+  const char *dir;
+  int fd;
+
+  /* unlinked file backed mapping elsewhere */
+  dir = getenv("TMPDIR");
+  if (dir == NULL || dir[0] == '\0')
+    dir = "/tmp";
+
+  if (snprintf(path, sizeof(path), "%s/exile-ring-XXXXXX", dir) >=
+      (int)sizeof(path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  fd = mkstemp(path);
+  if (fd < 0)
+    return -1;
+
+  unlink(path);
+
+  if (set_cloexec(fd) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+#endif
+}
+
+/* Creates the ring for stdout mode `ring:<capacity>`. Sets `ring` to -1
+ * for other modes. Doorbell write end is nonblocking since it is used by
+ * the VM. Returns 0 or an errno value */
+static int open_ring(const char *mode, int ring[3]) {
+  exile_ring_t *header;
+  unsigned long long capacity;
+  int doorbell[2], err;
+  char *end;
+
+  for (int i = 0; i < 3; i++)
+    ring[i] = -1;
+
+  if (strncmp(mode, RING_MODE, sizeof(RING_MODE) - 1) != 0)
+    return 0;
+
+  errno = 0;
+  capacity = strtoull(mode + sizeof(RING_MODE) - 1, &end, 10);
+  if (errno != 0 || *end != '\0' || !exile_ring_valid_capacity(capacity))
+    return EINVAL;
+
+  ring[RING_FD] = move_ring_fd(create_ring_fd());
+  if (ring[RING_FD] < 0)
+    goto error;
+
+  if (ftruncate(ring[RING_FD], exile_ring_map_size(capacity)) != 0)
+    goto error;
+
+  /* rest of the header is zeroed by ftruncate */
+  header = mmap(NULL, EXILE_RING_HEADER_SIZE, PROT_READ | PROT_WRITE,
+                MAP_SHARED, ring[RING_FD], 0);
+  if (header == MAP_FAILED)
+    goto error;
+
+  header->magic = EXILE_RING_MAGIC;
+  header->version = EXILE_RING_VERSION;
+  header->capacity = capacity;
+  munmap(header, EXILE_RING_HEADER_SIZE);
+
+#if defined(__linux__)
+  /* command inherits the ring fd, the VM must never see it resized */
+  if (fcntl(ring[RING_FD], F_ADD_SEALS, EXILE_RING_SEALS) != 0)
+    goto error;
+#endif
+
+  if (pipe(doorbell) != 0)
+    goto error;
+
+  ring[RING_DOORBELL_READ] = move_ring_fd(doorbell[PIPE_READ]);
+  ring[RING_DOORBELL_WRITE] = move_ring_fd(doorbell[PIPE_WRITE]);
+
+  if (ring[RING_DOORBELL_READ] < 0 || ring[RING_DOORBELL_WRITE] < 0 ||
+      set_flag(ring[RING_DOORBELL_WRITE], O_NONBLOCK) < 0)
+    goto error;
+
+  return 0;
+
+error:
+  err = errno;
+  close_fds(ring, 3);
+  return err;
+}
+
+/* Fds sent to the VM, stdin, stdout and stderr pipes followed by the
+ * ring and its doorbell in ring mode. Returns the count */
+static int io_fds(int pipes[3][2], const int ring[3], int fds[MAX_IO_FDS]) {
+  fds[0] = pipes[STDIN_FILENO][PIPE_WRITE];
+  fds[1] = pipes[STDOUT_FILENO][PIPE_READ];
+  fds[2] = pipes[STDERR_FILENO][PIPE_READ];
+
+  if (ring[RING_FD] < 0)
+    return 3;
+
+  fds[3] = ring[RING_FD];
+  fds[4] = ring[RING_DOORBELL_WRITE];
+  return 5;
+}
+
+static int send_io_fds(int socket, int pipes[3][2], const int ring[3]) {
+  int fds[MAX_IO_FDS], count;
+  char dup[256];
+
+  memset(dup, '\0', sizeof(dup));
+
+  count = io_fds(pipes, ring, fds);
+
+  debug("stdout: %d, stderr: %d", fds[1], fds[2]);
+
+  return send_fds(socket, fds, count, dup, sizeof(dup));
+}
+
+static void close_or_cloexec(int fd, bool cloexec) {
+  if (cloexec)
+    set_cloexec(fd);
+  else
+    close(fd);
+}
+
+/* Returns -1 when the fd directory is not available */
+static int close_listed_fds(const char *fd_dir, int from_fd, bool cloexec) {
+  DIR *dir;
+  struct dirent *entry;
+  char *end;
+  long fd;
+  int dir_fd;
+
+  dir = opendir(fd_dir);
+  if (dir == NULL)
+    return -1;
+
+  dir_fd = dirfd(dir);
+
+  while ((entry = readdir(dir)) != NULL) {
+    fd = strtol(entry->d_name, &end, 10);
+
+    // skip "." and ".."
+    if (end == entry->d_name || *end != '\0')
+      continue;
+
+    if (fd >= from_fd && fd != dir_fd)
+      close_or_cloexec((int)fd, cloexec);
+  }
+
+  closedir(dir);
+  return 0;
+}
+
+/* Closes, or marks CLOEXEC, every fd starting from `from_fd`. Calling
+ * close(2) for every possible fd up to `_SC_OPEN_MAX` is slow when
+ * `RLIMIT_NOFILE` is large, so we prefer close_range(2) and then the
+ * list of open fds, which is only proportional to the open fds. */
+static void close_fds_from(int from_fd, bool cloexec) {
+  long i, max;
+
+#if defined(__linux__) && defined(SYS_close_range)
+  if (syscall(SYS_close_range, (unsigned int)from_fd, ~0U,
+              cloexec ? CLOSE_RANGE_CLOEXEC : 0) == 0)
+    return;
+#elif defined(__FreeBSD__) && defined(CLOSE_RANGE_CLOEXEC)
+  if (close_range(from_fd, ~0U, cloexec ? CLOSE_RANGE_CLOEXEC : 0) == 0)
+    return;
+#endif
+
+  if (close_listed_fds("/proc/self/fd", from_fd, cloexec) == 0 ||
+      close_listed_fds("/dev/fd", from_fd, cloexec) == 0)
+    return;
+
+  max = sysconf(_SC_OPEN_MAX);
+  for (i = from_fd; i < max; i++)
+    close_or_cloexec((int)i, cloexec);
+}
+
 static void close_pipes(int pipes[3][2]) {
   for (int i = 0; i < 3; i++) {
     if (pipes[i][PIPE_READ] > 0)
@@ -88,11 +475,8 @@ static void close_pipes(int pipes[3][2]) {
   }
 }
 
-static int exec_process(char const *bin, char *const *args, int socket,
-                        char const *stderr_str) {
-  int pipes[3][2] = {{0, 0}, {0, 0}, {0, 0}};
+static int create_pipes(int pipes[3][2]) {
   int r_cmdin, w_cmdin, r_cmdout, w_cmdout, r_cmderr, w_cmderr;
-  int i;
 
   if (pipe(pipes[STDIN_FILENO]) == -1 || pipe(pipes[STDOUT_FILENO]) == -1 ||
       pipe(pipes[STDERR_FILENO]) == -1) {
@@ -112,11 +496,11 @@ static int exec_process(char const *bin, char *const *args, int socket,
   r_cmderr = pipes[STDERR_FILENO][PIPE_READ];
   w_cmderr = pipes[STDERR_FILENO][PIPE_WRITE];
 
-  if (set_flag(r_cmdin, O_CLOEXEC) < 0 || set_flag(w_cmdout, O_CLOEXEC) < 0 ||
-      set_flag(w_cmderr, O_CLOEXEC) < 0 ||
-      set_flag(w_cmdin, O_CLOEXEC | O_NONBLOCK) < 0 ||
-      set_flag(r_cmdout, O_CLOEXEC | O_NONBLOCK) < 0 ||
-      set_flag(r_cmderr, O_CLOEXEC | O_NONBLOCK) < 0) {
+  if (set_cloexec(r_cmdin) < 0 || set_cloexec(w_cmdout) < 0 ||
+      set_cloexec(w_cmderr) < 0 || set_cloexec(w_cmdin) < 0 ||
+      set_cloexec(r_cmdout) < 0 || set_cloexec(r_cmderr) < 0 ||
+      set_flag(w_cmdin, O_NONBLOCK) < 0 || set_flag(r_cmdout, O_NONBLOCK) < 0 ||
+      set_flag(r_cmderr, O_NONBLOCK) < 0) {
     perror("[spawner] failed to set flags for pipes");
     close_pipes(pipes);
     return 1;
@@ -124,35 +508,64 @@ static int exec_process(char const *bin, char *const *args, int socket,
 
   debug("set fd flags to pipes");
 
-  if (send_io_fds(socket, w_cmdin, r_cmdout, r_cmderr) != EXIT_SUCCESS) {
-    perror("[spawner] failed to send fd via socket");
-    close_pipes(pipes);
-    return 1;
-  }
+  return 0;
+}
 
-  debug("sent fds over UDS");
+/* Sets up stdio of the current process using `pipes`, or `redirects`
+ * when set, and execs the command. Never returns */
+static void exec_child(int pipes[3][2], const int redirects[3],
+                       const int ring[3], char const *bin, char *const *args,
+                       char const *stderr_str) {
+  int r_cmdin, w_cmdin, r_cmdout, w_cmdout, r_cmderr, w_cmderr;
+
+  r_cmdin = pipes[STDIN_FILENO][PIPE_READ];
+  w_cmdin = pipes[STDIN_FILENO][PIPE_WRITE];
+
+  r_cmdout = pipes[STDOUT_FILENO][PIPE_READ];
+  w_cmdout = pipes[STDOUT_FILENO][PIPE_WRITE];
+
+  r_cmderr = pipes[STDERR_FILENO][PIPE_READ];
+  w_cmderr = pipes[STDERR_FILENO][PIPE_WRITE];
 
   close(STDIN_FILENO);
   close(w_cmdin);
-  if (dup2(r_cmdin, STDIN_FILENO) < 0) {
+  if (dup2(redirects[STDIN_FILENO] >= 0 ? redirects[STDIN_FILENO] : r_cmdin,
+           STDIN_FILENO) < 0) {
     perror("[spawner] failed to dup to stdin");
     _exit(FORK_EXEC_FAILURE);
   }
 
   close(STDOUT_FILENO);
   close(r_cmdout);
-  if (dup2(w_cmdout, STDOUT_FILENO) < 0) {
+  if (dup2(redirects[STDOUT_FILENO] >= 0 ? redirects[STDOUT_FILENO] : w_cmdout,
+           STDOUT_FILENO) < 0) {
     perror("[spawner] failed to dup to stdout");
     _exit(FORK_EXEC_FAILURE);
   }
 
-  if (strcmp(stderr_str, "consume") == 0) {
+  if (redirects[STDERR_FILENO] >= 0) {
+    close(STDERR_FILENO);
+    close(r_cmderr);
+    close(w_cmderr);
+    if (dup2(redirects[STDERR_FILENO], STDERR_FILENO) < 0) {
+      perror("[spawner] failed to dup to stderr");
+      _exit(FORK_EXEC_FAILURE);
+    }
+  } else if (strcmp(stderr_str, "consume") == 0) {
     close(STDERR_FILENO);
     close(r_cmderr);
     if (dup2(w_cmderr, STDERR_FILENO) < 0) {
       perror("[spawner] failed to dup to stderr");
       _exit(FORK_EXEC_FAILURE);
     }
+  } else if (strcmp(stderr_str, STDERR_TO_STDOUT) == 0) {
+    close(STDERR_FILENO);
+    close(r_cmderr);
+    close(w_cmderr);
+    if (dup2(STDOUT_FILENO, STDERR_FILENO) < 0) {
+      perror("[spawner] failed to dup stdout to stderr");
+      _exit(FORK_EXEC_FAILURE);
+    }
   } else if (strcmp(stderr_str, "disable") == 0) {
     close(STDERR_FILENO);
     close(r_cmderr);
@@ -168,9 +581,18 @@ static int exec_process(char const *bin, char *const *args, int socket,
     close(w_cmderr);
   }
 
+  /* ring fds are above the fds they are moved to */
+  if (ring[RING_FD] >= 0 &&
+      (dup2(ring[RING_FD], EXILE_RING_FD) < 0 ||
+       dup2(ring[RING_DOORBELL_READ], EXILE_RING_DOORBELL_FD) < 0)) {
+    perror("[spawner] failed to dup ring fds");
+    _exit(FORK_EXEC_FAILURE);
+  }
+
   /* Close all non-standard io fds. Not closing STDERR */
-  for (i = STDERR_FILENO + 1; i < sysconf(_SC_OPEN_MAX); i++)
-    close(i);
+  close_fds_from(ring[RING_FD] >= 0 ? EXILE_RING_DOORBELL_FD + 1
+                                    : STDERR_FILENO + 1,
+                 false);
 
   debug("exec %s", bin);
 
@@ -180,56 +602,583 @@ static int exec_process(char const *bin, char *const *args, int socket,
   _exit(FORK_EXEC_FAILURE);
 }
 
-static int spawn(const char *socket_path, const char *stderr_str,
-                 const char *bin, char *const *args) {
+static int exec_process(char const *bin, char *const *args, int socket,
+                        const int redirects[3], const int ring[3],
+                        char const *stderr_str) {
+  int pipes[3][2] = {{0, 0}, {0, 0}, {0, 0}};
+
+  if (create_pipes(pipes) != 0)
+    return 1;
+
+  if (send_io_fds(socket, pipes, ring) != EXIT_SUCCESS) {
+    perror("[spawner] failed to send fd via socket");
+    close_pipes(pipes);
+    return 1;
+  }
+
+  debug("sent fds over UDS");
+
+  exec_child(pipes, redirects, ring, bin, args, stderr_str);
+
+  // we should never reach here
+  return 1;
+}
+
+/* path starting with '@' is a Linux abstract address, the name after
+ * '@' is placed after a leading NUL byte and nothing is created in the
+ * filesystem */
+static socklen_t socket_address(const char *socket_path,
+                                struct sockaddr_un *socket_addr) {
+  size_t len;
+
+  memset(socket_addr, 0, sizeof(struct sockaddr_un));
+  socket_addr->sun_family = AF_UNIX;
+
+  if (socket_path[0] != '@') {
+    strncpy(socket_addr->sun_path, socket_path,
+            sizeof(socket_addr->sun_path) - 1);
+    return sizeof(struct sockaddr_un);
+  }
+
+  len = strlen(socket_path + 1);
+  if (len > sizeof(socket_addr->sun_path) - 1)
+    len = sizeof(socket_addr->sun_path) - 1;
+
+  memcpy(socket_addr->sun_path + 1, socket_path + 1, len);
+  return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + len);
+}
+
+static int connect_socket(const char *socket_path) {
   int socket_fd;
   struct sockaddr_un socket_addr;
+  socklen_t addr_len;
 
   socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
 
   if (socket_fd == -1) {
     debug("Failed to create socket");
-    return EXIT_FAILURE;
+    return -1;
   }
 
   debug("created domain socket");
 
-  memset(&socket_addr, 0, sizeof(struct sockaddr_un));
-  socket_addr.sun_family = AF_UNIX;
-  strncpy(socket_addr.sun_path, socket_path, sizeof(socket_addr.sun_path) - 1);
+  addr_len = socket_address(socket_path, &socket_addr);
 
-  if (connect(socket_fd, (struct sockaddr *)&socket_addr,
-              sizeof(struct sockaddr_un)) == -1) {
+  if (connect(socket_fd, (struct sockaddr *)&socket_addr, addr_len) == -1) {
     debug("Failed to connect to socket");
-    return EXIT_FAILURE;
+    close(socket_fd);
+    return -1;
   }
 
   debug("connected to exile");
 
-  if (exec_process(bin, args, socket_fd, stderr_str) != 0)
+  return socket_fd;
+}
+
+static int spawn(const char *socket_path, const char *const modes[3],
+                 const char *bin, char *const *args) {
+  const char *stderr_str = modes[STDERR_FILENO];
+  int passed_fds[MAX_PASSED_FDS] = {-1, -1, -1}, redirects[3], ring[3];
+  int passed_count = 0, err;
+  char byte;
+
+  int socket_fd = connect_socket(socket_path);
+
+  if (socket_fd < 0)
+    return EXIT_FAILURE;
+
+  /* VM sends the fds right after accepting the connection */
+  if (needs_passed_fds(modes) &&
+      recv_with_fds(socket_fd, &byte, 1, passed_fds, MAX_PASSED_FDS,
+                    &passed_count) <= 0) {
+    perror("[spawner] failed to receive redirect fds");
+    return EXIT_FAILURE;
+  }
+
+  err = open_redirects(modes, passed_fds, passed_count, redirects);
+  close_fds(passed_fds, passed_count);
+
+  if (err != 0) {
+    error("failed to open redirect: %s", strerror(err));
+    return EXIT_FAILURE;
+  }
+
+  err = open_ring(modes[STDOUT_FILENO], ring);
+  if (err != 0) {
+    error("failed to create ring: %s", strerror(err));
+    return EXIT_FAILURE;
+  }
+
+  if (exec_process(bin, args, socket_fd, redirects, ring, stderr_str) != 0)
     return EXIT_FAILURE;
 
   // we should never reach here
   return EXIT_SUCCESS;
 }
 
+/* Daemon mode
+ *
+ * Instead of spawning a single command, spawner keeps a persistent
+ * connection to the VM and spawns commands on request, avoiding the
+ * Port and socket setup for every command.
+ *
+ * Request: `size:u32 req_id:u32 argc:u32 envc:u32` followed by NUL
+ * terminated strings: stdin, stdout and stderr modes, cd (empty for none),
+ * `argc` arguments and `envc` env entries (`KEY=VALUE`). Env is the
+ * complete environment of the command, not the changes. Integers are in
+ * native byte order. Fds for `fd` redirects are sent along with the
+ * request.
+ *
+ * Replies are `daemon_reply_t`. `S` carries stdin, stdout and stderr
+ * fds of the spawned command, followed by the ring and its doorbell for
+ * ring mode. Exit of a command is reported with `X`,
+ * exit status is `128 + signal` when it is terminated by a signal, same
+ * as ports. Daemon terminates its commands and exits when the connection
+ * is closed. */
+
+extern char **environ;
+
+static int sigchld_pipe[2] = {-1, -1};
+
+static pid_t *children = NULL;
+static size_t children_count = 0;
+static size_t children_capacity = 0;
+
+static void handle_sigchld(int sig) {
+  int saved_errno = errno;
+  char c = 0;
+
+  if (write(sigchld_pipe[PIPE_WRITE], &c, 1) < 0) {
+    // pipe is full, there is a pending notification already
+  }
+
+  errno = saved_errno;
+}
+
+static int track_child(pid_t pid) {
+  pid_t *new_children;
+
+  if (children_count == children_capacity) {
+    children_capacity = children_capacity == 0 ? 64 : children_capacity * 2;
+    new_children = realloc(children, children_capacity * sizeof(pid_t));
+    if (new_children == NULL)
+      return -1;
+    children = new_children;
+  }
+
+  children[children_count++] = pid;
+  return 0;
+}
+
+static void untrack_child(pid_t pid) {
+  for (size_t i = 0; i < children_count; i++) {
+    if (children[i] == pid) {
+      children[i] = children[--children_count];
+      return;
+    }
+  }
+}
+
+static int send_reply(int conn, int32_t tag, int32_t id, int32_t value,
+                      const int *fds, int fd_count) {
+  daemon_reply_t reply;
+
+  memset(&reply, 0, sizeof(reply));
+  reply.tag = tag;
+  reply.id = id;
+  reply.value = value;
+
+  return send_fds(conn, fds, fd_count, &reply, sizeof(reply));
+}
+
+static ssize_t read_full(int fd, void *buf, size_t size) {
+  size_t offset = 0;
+  ssize_t ret;
+
+  while (offset < size) {
+    ret = read(fd, (char *)buf + offset, size - offset);
+
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      return ret;
+
+    offset += ret;
+  }
+
+  return offset;
+}
+
+/* Spawns the command using posix_spawn(3), which does not copy the page
+ * tables of the daemon (glibc and musl use vfork semantics), so cost of
+ * spawning does not grow with the memory size. All fds of the daemon are
+ * CLOEXEC, so the command only inherits the stdio set by file actions.
+ * Returns 0 or an errno value */
+static int posix_spawn_command(pid_t *pid, int pipes[3][2],
+                               const int redirects[3], const int ring[3],
+                               const char *stderr_str, char *const *args,
+                               char *const *env) {
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t default_signals, mask;
+  int ret;
+
+  ret = posix_spawn_file_actions_init(&actions);
+  if (ret != 0)
+    return ret;
+
+  ret = posix_spawnattr_init(&attr);
+  if (ret != 0) {
+    posix_spawn_file_actions_destroy(&actions);
+    return ret;
+  }
+
+  /* ignored signals are inherited across exec */
+  sigemptyset(&default_signals);
+  sigaddset(&default_signals, SIGPIPE);
+  sigemptyset(&mask);
+
+  ret = posix_spawnattr_setsigdefault(&attr, &default_signals);
+  if (ret == 0)
+    ret = posix_spawnattr_setsigmask(&attr, &mask);
+  if (ret == 0)
+    ret = posix_spawnattr_setflags(
+        &attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+  if (ret == 0)
+    ret = posix_spawn_file_actions_adddup2(
+        &actions,
+        redirects[STDIN_FILENO] >= 0 ? redirects[STDIN_FILENO]
+                                     : pipes[STDIN_FILENO][PIPE_READ],
+        STDIN_FILENO);
+  if (ret == 0)
+    ret = posix_spawn_file_actions_adddup2(
+        &actions,
+        redirects[STDOUT_FILENO] >= 0 ? redirects[STDOUT_FILENO]
+                                      : pipes[STDOUT_FILENO][PIPE_WRITE],
+        STDOUT_FILENO);
+
+  if (ret == 0 && redirects[STDERR_FILENO] >= 0)
+    ret = posix_spawn_file_actions_adddup2(
+        &actions, redirects[STDERR_FILENO], STDERR_FILENO);
+  else if (ret == 0 && strcmp(stderr_str, "consume") == 0)
+    ret = posix_spawn_file_actions_adddup2(
+        &actions, pipes[STDERR_FILENO][PIPE_WRITE], STDERR_FILENO);
+  else if (ret == 0 && strcmp(stderr_str, STDERR_TO_STDOUT) == 0)
+    /* actions run in order, stdout is already in place */
+    ret = posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO,
+                                           STDERR_FILENO);
+  else if (ret == 0 && strcmp(stderr_str, "disable") == 0)
+    ret = posix_spawn_file_actions_addopen(&actions, STDERR_FILENO,
+                                           "/dev/null", O_WRONLY, 0);
+
+  if (ret == 0 && ring[RING_FD] >= 0)
+    ret = posix_spawn_file_actions_adddup2(&actions, ring[RING_FD],
+                                           EXILE_RING_FD);
+  if (ret == 0 && ring[RING_FD] >= 0)
+    ret = posix_spawn_file_actions_adddup2(
+        &actions, ring[RING_DOORBELL_READ], EXILE_RING_DOORBELL_FD);
+
+  if (ret == 0)
+    ret = posix_spawn(pid, args[0], &actions, &attr, args, env);
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+
+  return ret;
+}
+
+/* posix_spawn can not change the working directory portably, so we fork
+ * when `cd` is set */
+static int fork_command(pid_t *pid, int pipes[3][2], const int redirects[3],
+                        const int ring[3], const char *stderr_str,
+                        const char *cd, char *const *args, char **env) {
+  *pid = fork();
+
+  if (*pid < 0)
+    return errno;
+
+  if (*pid == 0) {
+    /* ignored signals are inherited across exec */
+    signal(SIGPIPE, SIG_DFL);
+
+    if (chdir(cd) != 0) {
+      perror("[spawner] chdir()");
+      _exit(FORK_EXEC_FAILURE);
+    }
+
+    environ = env;
+
+    exec_child(pipes, redirects, ring, args[0], args, stderr_str);
+  }
+
+  return 0;
+}
+
+static int spawn_child(int conn, int32_t req_id, const char *const modes[3],
+                       const int *passed_fds, int passed_count,
+                       const char *cd, char *const *args, char **env) {
+  int pipes[3][2] = {{0, 0}, {0, 0}, {0, 0}};
+  int fds[MAX_IO_FDS], redirects[3], ring[3];
+  const char *stderr_str = modes[STDERR_FILENO];
+  pid_t pid;
+  int err;
+
+  err = open_redirects(modes, passed_fds, passed_count, redirects);
+  if (err != 0) {
+    error("failed to open redirect for %s: %s", args[0], strerror(err));
+    return send_reply(conn, REPLY_ERROR, req_id, err, NULL, 0);
+  }
+
+  err = open_ring(modes[STDOUT_FILENO], ring);
+  if (err != 0) {
+    error("failed to create ring for %s: %s", args[0], strerror(err));
+    close_fds(redirects, 3);
+    return send_reply(conn, REPLY_ERROR, req_id, err, NULL, 0);
+  }
+
+  if (create_pipes(pipes) != 0) {
+    err = errno;
+    close_fds(redirects, 3);
+    close_fds(ring, 3);
+    return send_reply(conn, REPLY_ERROR, req_id, err, NULL, 0);
+  }
+
+  if (cd[0] == '\0')
+    err = posix_spawn_command(&pid, pipes, redirects, ring, stderr_str, args,
+                              env);
+  else
+    err = fork_command(&pid, pipes, redirects, ring, stderr_str, cd, args,
+                       env);
+
+  /* redirects are dup'ed onto the stdio of the command */
+  close_fds(redirects, 3);
+
+  if (err != 0) {
+    error("failed to spawn %s: %s", args[0], strerror(err));
+    close_pipes(pipes);
+    close_fds(ring, 3);
+    return send_reply(conn, REPLY_ERROR, req_id, err, NULL, 0);
+  }
+
+  if (track_child(pid) != 0)
+    error("failed to track child %d", pid);
+
+  err = send_reply(conn, REPLY_SPAWNED, req_id, pid, fds,
+                   io_fds(pipes, ring, fds));
+
+  /* fds are owned by the VM and the command now */
+  close_pipes(pipes);
+  close_fds(ring, 3);
+
+  return err;
+}
+
+/* Returns 1 when a request is handled, 0 on EOF and -1 on error */
+static int handle_request(int conn) {
+  uint32_t size, req_id, argc, envc, count, i;
+  char *buf = NULL, *pos, *end, **strings = NULL;
+  const uint32_t header_size = 3 * sizeof(uint32_t);
+  const char *modes[3];
+  int passed_fds[MAX_PASSED_FDS] = {-1, -1, -1};
+  int passed_count = 0;
+  ssize_t ret;
+  int status = 1;
+
+  /* fds are sent along with the first byte of the request */
+  ret = recv_with_fds(conn, &size, sizeof(size), passed_fds, MAX_PASSED_FDS,
+                      &passed_count);
+  if (ret <= 0)
+    return ret;
+
+  if ((size_t)ret < sizeof(size) &&
+      read_full(conn, (char *)&size + ret, sizeof(size) - ret) <= 0) {
+    status = -1;
+    goto cleanup;
+  }
+
+  if (size < header_size || size > MAX_REQUEST_SIZE) {
+    error("invalid request size: %u", size);
+    status = -1;
+    goto cleanup;
+  }
+
+  buf = malloc(size);
+  if (buf == NULL || read_full(conn, buf, size) <= 0) {
+    status = -1;
+    goto cleanup;
+  }
+
+  memcpy(&req_id, buf, sizeof(uint32_t));
+  memcpy(&argc, buf + sizeof(uint32_t), sizeof(uint32_t));
+  memcpy(&envc, buf + 2 * sizeof(uint32_t), sizeof(uint32_t));
+
+  if (argc < 1 || argc > size || envc > size) {
+    error("invalid request, argc: %u envc: %u", argc, envc);
+    status = -1;
+    goto cleanup;
+  }
+
+  /* stdio modes, cd, args and env, both args and env are NULL
+   * terminated */
+  count = 4 + argc + envc;
+  strings = malloc((count + 2) * sizeof(char *));
+  if (strings == NULL) {
+    status = -1;
+    goto cleanup;
+  }
+
+  pos = buf + header_size;
+  for (i = 0; i < count; i++) {
+    end = memchr(pos, '\0', size - (pos - buf));
+    if (end == NULL) {
+      error("invalid request, malformed strings");
+      status = -1;
+      goto cleanup;
+    }
+    /* skip the slot for args NULL terminator */
+    strings[i < 4 + argc ? i : i + 1] = pos;
+    pos = end + 1;
+  }
+  strings[4 + argc] = NULL;
+  strings[count + 1] = NULL;
+
+  modes[STDIN_FILENO] = strings[0];
+  modes[STDOUT_FILENO] = strings[1];
+  modes[STDERR_FILENO] = strings[2];
+
+  if (spawn_child(conn, (int32_t)req_id, modes, passed_fds, passed_count,
+                  strings[3], strings + 4,
+                  strings + 5 + argc) != EXIT_SUCCESS) {
+    status = -1;
+  }
+
+cleanup:
+  close_fds(passed_fds, passed_count);
+  free(strings);
+  free(buf);
+  return status;
+}
+
+static int reap_children(int conn) {
+  char buf[64];
+  int status, exit_status;
+  pid_t pid;
+
+  while (read(sigchld_pipe[PIPE_READ], buf, sizeof(buf)) > 0)
+    ;
+
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    if (WIFEXITED(status))
+      exit_status = WEXITSTATUS(status);
+    else if (WIFSIGNALED(status))
+      exit_status = 128 + WTERMSIG(status);
+    else
+      continue;
+
+    untrack_child(pid);
+
+    if (send_reply(conn, REPLY_EXIT, pid, exit_status, NULL, 0) !=
+        EXIT_SUCCESS)
+      return -1;
+  }
+
+  return 0;
+}
+
+static int run_daemon(const char *socket_path) {
+  struct sigaction action;
+  struct pollfd fds[2];
+  int conn, ret;
+
+  /* commands must only inherit stdio, including the fds inherited from
+   * the VM. We can't close them since the Port uses them */
+  close_fds_from(STDERR_FILENO + 1, true);
+
+  conn = connect_socket(socket_path);
+  if (conn < 0 || set_cloexec(conn) < 0)
+    return EXIT_FAILURE;
+
+  if (pipe(sigchld_pipe) == -1 || set_cloexec(sigchld_pipe[PIPE_READ]) < 0 ||
+      set_cloexec(sigchld_pipe[PIPE_WRITE]) < 0 ||
+      set_flag(sigchld_pipe[PIPE_READ], O_NONBLOCK) < 0 ||
+      set_flag(sigchld_pipe[PIPE_WRITE], O_NONBLOCK) < 0) {
+    perror("[spawner] failed to create signal pipe");
+    return EXIT_FAILURE;
+  }
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handle_sigchld;
+  action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigemptyset(&action.sa_mask);
+
+  if (sigaction(SIGCHLD, &action, NULL) != 0) {
+    perror("[spawner] sigaction()");
+    return EXIT_FAILURE;
+  }
+
+  /* closed connection must be reported as an error, not a signal */
+  signal(SIGPIPE, SIG_IGN);
+
+  debug("daemon started");
+
+  fds[0].fd = conn;
+  fds[0].events = POLLIN;
+  fds[1].fd = sigchld_pipe[PIPE_READ];
+  fds[1].events = POLLIN;
+
+  for (;;) {
+    fds[0].revents = 0;
+    fds[1].revents = 0;
+
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("[spawner] poll()");
+      break;
+    }
+
+    if (fds[1].revents & POLLIN && reap_children(conn) != 0)
+      break;
+
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      ret = handle_request(conn);
+      if (ret <= 0)
+        break;
+    }
+  }
+
+  debug("daemon exiting, terminating %zu commands", children_count);
+
+  for (size_t i = 0; i < children_count; i++)
+    kill(children[i], SIGTERM);
+
+  free(children);
+  close(conn);
+
+  return EXIT_SUCCESS;
+}
+
 int main(int argc, const char *argv[]) {
   int status, i;
   const char **exec_argv;
 
-  if (argc < 4) {
-    debug("expected at least 3 arguments, passed %d", argc);
+  if (argc == 3 && strcmp(argv[1], "--daemon") == 0) {
+    status = run_daemon(argv[2]);
+  } else if (argc < 6) {
+    debug("expected at least 5 arguments, passed %d", argc);
     status = EXIT_FAILURE;
   } else {
-    exec_argv = malloc((argc - 3 + 1) * sizeof(char *));
+    exec_argv = malloc((argc - 5 + 1) * sizeof(char *));
 
-    for (i = 3; i < argc; i++)
-      exec_argv[i - 3] = argv[i];
+    for (i = 5; i < argc; i++)
+      exec_argv[i - 5] = argv[i];
 
-    exec_argv[i - 3] = NULL;
+    exec_argv[i - 5] = NULL;
 
-    debug("socket path: %s stderr: %s bin: %s", argv[1], argv[2], argv[3]);
-    status = spawn(argv[1], argv[2], argv[3], (char *const *)exec_argv);
+    debug("socket path: %s stdin: %s stdout: %s stderr: %s bin: %s",
+          argv[1], argv[2], argv[3], argv[4], argv[5]);
+    status = spawn(argv[1], argv + 2, argv[5], (char *const *)exec_argv);
   }
 
   exit(status);
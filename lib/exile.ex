@@ -110,6 +110,14 @@ defmodule Exile do
   500
   ```
 
+  With `framing` set, each element is a line without the trailing newline
+
+  ```
+  iex> Exile.stream!(~w(printf a\\nbb\\nccc), framing: :lines)
+  ...> |> Enum.to_list()
+  ["a", "bb", "ccc"]
+  ```
+
   When input and output run at different rate
 
   ```
@@ -145,14 +153,24 @@ defmodule Exile do
 
   @doc false
   def start(_type, _args) do
-    opts = [
-      name: Exile.WatcherSupervisor,
-      strategy: :one_for_one
+    :ok = Exile.Telemetry.setup()
+
+    children = [
+      # Watchers clean up external processes on :init.stop or SIGTERM,
+      # one watcher per scheduler
+      %{
+        id: Exile.WatcherSupervisor,
+        type: :supervisor,
+        start:
+          {Supervisor, :start_link,
+           [Exile.Watcher.shards(), [strategy: :one_for_one, name: Exile.WatcherSupervisor]]}
+      },
+      # daemon is started only when a process uses `spawner: :daemon`
+      Exile.Spawner,
+      Exile.ExecutableCache
     ]
 
-    # We use DynamicSupervisor for cleaning up external processes on
-    # :init.stop or SIGTERM
-    DynamicSupervisor.start_link(opts)
+    Supervisor.start_link(children, strategy: :one_for_one, name: Exile.Supervisor)
   end
 
   @doc ~S"""
@@ -186,14 +204,44 @@ defmodule Exile do
         |> Enum.to_list()
         ```
 
+      * File or fd:
+
+        `{:file, path}` or `{:fd, fd}` is connected directly to stdin of the
+        program. The program reads the file itself, so the input is not read
+        into the VM memory irrespective of the size. See `stdin` option of
+        `Exile.Process.start_link/2`.
+
+        ```
+        Exile.stream!(~w(gzip), input: {:file, "dump.sql"}) |> Enum.into(<<>>)
+        ```
+
         By defaults no input is sent to the command.
 
+    * `input_buffer_size` - Maximum size of the input buffered while the stdin pipe
+  is full. Input is written directly to the pipe, elements are coalesced into a
+  single write while the program is busy, and the input is consumed further only
+  after the buffer is written. Defaults to `65_536`
+
     * `exit_timeout` - Duration to wait for external program to exit after completion
   (when stream ends). Defaults to `:infinity`
 
     * `max_chunk_size` - Maximum size of iodata chunk emitted by the stream.
   Chunk size can be less than the `max_chunk_size` depending on the amount of
-  data available to be read. Defaults to `65_535`
+  data available to be read. Defaults to `65_535`. To get chunks larger than
+  the default pipe capacity in a single read, also set `pipe_size` (Linux only)
+
+    * `stdout` - `{:file, path}` or `{:fd, fd}` to write the output of the program
+  directly to a file or an fd instead of streaming it through the VM. The stream
+  then emits nothing, use `Exile.stream/2` to get the exit status. `stderr` can be
+  redirected the same way. See `Exile.Process.start_link/2`
+
+    * `framing` - Emit stdout as records instead of chunks: `:lines`,
+  `{:delimiter, byte}` or `{:length_prefixed, n}`. Records are split in the
+  NIF without copying, see `Exile.Process.start_link/2` for details. With
+  `stderr: :consume` records are emitted as `{:stdout, record}`
+
+    * `max_record_size` - Maximum size of a record with `framing`. The stream
+  raises `Exile.Process.Error` on a larger record. Defaults to `:infinity`
 
     * `stderr`  -  different ways to handle stderr stream. possible values `:console`, `:disable`, `:stream`.
         1. `:console`  -  stderr output is redirected to console (Default)
@@ -201,6 +249,8 @@ defmodule Exile do
         3. `:consume`  -  connects stderr for the consumption. The output stream will contain stderr
   data along with stdout. Stream data will be either `{:stdout, iodata}` or `{:stderr, iodata}`
   to differentiate different streams. See example below.
+        4. `:redirect_to_stdout`  -  stderr is written to the stdout of the program, same as
+  `2>&1`. Stream contains both in the order they are written, without tags
 
     * `ignore_epipe` - When set to true, reader can exit early without raising error.
   Typically writer gets `EPIPE` error on write when program terminate prematurely.
@@ -257,9 +307,12 @@ defmodule Exile do
   @spec stream!(nonempty_list(String.t()),
           input: Enum.t() | collectable_func(),
           exit_timeout: timeout(),
-          stderr: :console | :disable | :consume,
+          stderr: :console | :disable | :consume | :redirect_to_stdout,
           ignore_epipe: boolean(),
-          max_chunk_size: pos_integer()
+          max_chunk_size: pos_integer(),
+          pipe_size: pos_integer(),
+          framing: :lines | {:delimiter, byte} | {:length_prefixed, 1 | 2 | 4},
+          max_record_size: pos_integer() | :infinity
         ) :: Exile.Stream.t()
   def stream!(cmd_with_args, opts \\ []) do
     Exile.Stream.__build__(cmd_with_args, Keyword.put(opts, :stream_exit_status, false))
@@ -278,11 +331,64 @@ defmodule Exile do
   @spec stream(nonempty_list(String.t()),
           input: Enum.t() | collectable_func(),
           exit_timeout: timeout(),
-          stderr: :console | :disable | :consume,
+          stderr: :console | :disable | :consume | :redirect_to_stdout,
           ignore_epipe: boolean(),
-          max_chunk_size: pos_integer()
+          max_chunk_size: pos_integer(),
+          pipe_size: pos_integer(),
+          framing: :lines | {:delimiter, byte} | {:length_prefixed, 1 | 2 | 4},
+          max_record_size: pos_integer() | :infinity
         ) :: Exile.Stream.t()
   def stream(cmd_with_args, opts \\ []) do
     Exile.Stream.__build__(cmd_with_args, Keyword.put(opts, :stream_exit_status, true))
   end
+
+  @doc ~S"""
+  Runs the command to completion and returns its output and exit status
+  as `{stdout, stderr, exit_status}`.
+
+  Meant for short commands whose output fits in memory. Output is
+  accumulated by the NIF and returned as a single binary for each stream
+  at EOF, so it is cheaper than collecting `Exile.stream!/2`. stderr is
+  consumed by default and read together with stdout.
+
+  ```
+  iex> Exile.run(~w(cat), input: "hello")
+  {"hello", "", 0}
+  iex> Exile.run(["sh", "-c", "echo foo; echo bar >&2; exit 2"])
+  {"foo
+", "bar
+", 2}
+  ```
+
+  ### Options
+
+    * `input` - input for the program as a binary or iodata. It is written
+  in a separate process, so the program can produce output before reading
+  all of it. stdin is closed after the input is written. When not set stdin
+  is closed right away
+
+    * `max_output_size` - maximum number of bytes kept for each of stdout and
+  stderr. Output beyond this is read and discarded, so that the program is
+  not blocked. Defaults to `:infinity`
+
+    * `exit_timeout` - duration to wait for the program to exit after the
+  output is read, see `Exile.Process.await_exit/2`. Defaults to `5000`
+
+    * `stderr` - same as `Exile.Process.start_link/2`. stderr is returned only
+  when set to `:consume` (Default), otherwise it is `""`
+
+  Remaining options are passed to `Exile.Process.start_link/2`, except
+  `framing` and a `:ring` stdout which are not supported. Raises
+  `ArgumentError` for invalid options and `Exile.Process.Error` when the
+  output or the exit status can not be read.
+  """
+  @spec run(nonempty_list(String.t()),
+          input: iodata(),
+          max_output_size: non_neg_integer() | :infinity,
+          exit_timeout: timeout(),
+          stderr: :console | :disable | :consume | :redirect_to_stdout
+        ) :: {stdout :: binary, stderr :: binary, exit_status :: non_neg_integer()}
+  def run(cmd_with_args, opts \\ []) do
+    Exile.Run.run(cmd_with_args, opts)
+  end
 end
@@ -0,0 +1,76 @@
+defmodule Exile.ExecutableCache do
+  @moduledoc false
+
+  # Caches `System.find_executable/1` results.
+  #
+  # Resolving a command walks `$PATH` and stats files, which shows up
+  # at high spawn rates. Results are cached in a public ETS table, so
+  # lookups are done in the caller without going through this server.
+  #
+  # Entries are keyed by the command and the current `PATH`, so changing
+  # `PATH` invalidates them. Entries also expire after
+  # `:executable_cache_ttl` milliseconds (application env, default
+  # 5000) to pick up programs installed or removed later. TTL of `0`
+  # disables the cache. Commands containing `/` are relative to the
+  # working directory and are never cached.
+
+  use GenServer
+
+  @table __MODULE__
+  @default_ttl 5000
+
+  def start_link(args) do
+    GenServer.start_link(__MODULE__, args, name: __MODULE__)
+  end
+
+  @spec find_executable(String.t()) :: String.t() | nil
+  def find_executable(cmd) do
+    ttl = Application.get_env(:exile, :executable_cache_ttl, @default_ttl)
+
+    if ttl == 0 or String.contains?(cmd, "/") do
+      System.find_executable(cmd)
+    else
+      key = {cmd, System.get_env("PATH")}
+      now = System.monotonic_time(:millisecond)
+
+      case lookup(key) do
+        {path, inserted_at} when now - inserted_at < ttl ->
+          path
+
+        _ ->
+          path = System.find_executable(cmd)
+          # command not found is not cached, it is usually an error
+          if path, do: insert(key, path, now)
+          path
+      end
+    end
+  end
+
+  @spec clear() :: :ok
+  def clear do
+    true = :ets.delete_all_objects(@table)
+    :ok
+  end
+
+  @impl true
+  def init(_args) do
+    _ = :ets.new(@table, [:set, :public, :named_table, read_concurrency: true])
+    {:ok, nil}
+  end
+
+  # table might not be available when the application is not started
+  defp lookup(key) do
+    case :ets.lookup(@table, key) do
+      [{^key, path, inserted_at}] -> {path, inserted_at}
+      [] -> nil
+    end
+  rescue
+    ArgumentError -> nil
+  end
+
+  defp insert(key, path, now) do
+    :ets.insert(@table, {key, path, now})
+  rescue
+    ArgumentError -> false
+  end
+end
@@ -0,0 +1,468 @@
+defmodule Exile.Pool do
+  @moduledoc ~S"""
+  Pool of pre-spawned, long-running `Exile.Process` workers.
+
+  For persistent programs processing a stream of requests, such as
+  `jq --stream` or a custom encoder, starting the program can cost more
+  than the work done for a single request. Pool keeps `size` programs
+  running, so that checkout does not include the spawn time.
+
+  A checked out worker is a regular `Exile.Process`. On checkout the
+  pool transfers ownership of the worker pipes (stdin, stdout and stderr
+  when it is consumed) to the caller using
+  `Exile.Process.change_pipe_owner/3`, and takes it back on checkin. The
+  pool is the process owner, so the caller must not await the worker.
+  Worker is reused as is, the caller must consume all the output it
+  asked for before checking it in.
+
+  Worker is discarded when the program exits, when the caller exits
+  while holding it, or when it is checked in with a closed pipe. Workers
+  are replaced right away, ahead of the next checkout. When all workers
+  are busy the pool grows up to `max_size` for the waiting callers, and
+  workers above `size` which stay idle for `idle_timeout` are stopped.
+
+  ```
+  iex> {:ok, pool} = Exile.Pool.start_link(~w(cat), size: 1)
+  iex> Exile.Pool.transaction(pool, fn p ->
+  ...>   :ok = Exile.Process.write(p, "hello")
+  ...>   Exile.Process.read(p, 5)
+  ...> end)
+  {:ok, "hello"}
+  iex> Exile.Pool.stop(pool)
+  :ok
+  ```
+  """
+
+  use GenServer
+
+  alias Exile.Process
+  alias Exile.Process.Exec
+
+  @default_size 1
+  @default_idle_timeout 30_000
+  @default_checkout_timeout 5000
+
+  # time given to a discarded worker to exit before it is killed
+  @stop_timeout 5000
+
+  @type t :: GenServer.server()
+
+  @doc """
+  Starts the pool and `size` workers, each running `cmd_with_args`.
+
+  ### Options
+
+    * `size`  -  number of workers kept running. Defaults to `1`
+
+    * `max_size`  -  maximum number of workers when all of them are busy.
+  Defaults to `size`
+
+    * `idle_timeout`  -  workers above `size` are stopped after being idle
+  for `idle_timeout` milliseconds. Defaults to `30_000`
+
+    * `name`  -  name to register the pool
+
+  Rest of the options are passed to each worker, same as
+  `Exile.Process.start_link/2`. Workers are spawned by the spawner daemon
+  unless `spawner` is set.
+  """
+  @spec start_link(nonempty_list(String.t()), keyword()) :: GenServer.on_start()
+  def start_link(cmd_with_args, opts \\ []) do
+    {gen_opts, opts} = Keyword.split(opts, [:name])
+    GenServer.start_link(__MODULE__, {cmd_with_args, opts}, gen_opts)
+  end
+
+  @doc false
+  def child_spec({cmd_with_args, opts}) do
+    %{
+      id: Keyword.get(opts, :name, __MODULE__),
+      start: {__MODULE__, :start_link, [cmd_with_args, opts]}
+    }
+  end
+
+  @doc """
+  Stops the pool along with all the workers.
+  """
+  @spec stop(t) :: :ok
+  def stop(pool), do: GenServer.stop(pool)
+
+  @doc """
+  Checks out a worker, waiting up to `timeout` milliseconds when all
+  workers are busy and the pool can not grow.
+
+  Caller becomes the owner of the worker pipes till it is checked in
+  using `checkin/2`.
+  """
+  @spec checkout(t, timeout) :: {:ok, Process.t()} | {:error, :timeout}
+  def checkout(pool, timeout \\ @default_checkout_timeout) do
+    ref = make_ref()
+
+    try do
+      GenServer.call(pool, {:checkout, ref}, timeout)
+    catch
+      :exit, {:timeout, _} ->
+        # worker might be assigned already, it is checked in by the pool
+        GenServer.cast(pool, {:cancel_checkout, ref})
+        {:error, :timeout}
+    end
+  end
+
+  @doc """
+  Returns a worker checked out by the caller to the pool.
+  """
+  @spec checkin(t, Process.t()) :: :ok
+  def checkin(pool, process) do
+    GenServer.cast(pool, {:checkin, process.pid})
+  end
+
+  @doc """
+  Checks out a worker, runs `fun` with it and checks it in, even when
+  `fun` raises.
+  """
+  @spec transaction(t, (Process.t() -> result), timeout) :: result | {:error, :timeout}
+        when result: var
+  def transaction(pool, fun, timeout \\ @default_checkout_timeout) do
+    with {:ok, process} <- checkout(pool, timeout) do
+      try do
+        fun.(process)
+      after
+        checkin(pool, process)
+      end
+    end
+  end
+
+  @doc """
+  Returns number of workers in the pool, `idle` and `busy` workers and
+  the callers `waiting` for a worker.
+  """
+  @spec info(t) :: %{
+          size: non_neg_integer(),
+          idle: non_neg_integer(),
+          busy: non_neg_integer(),
+          waiting: non_neg_integer()
+        }
+  def info(pool), do: GenServer.call(pool, :info)
+
+  ## Server
+
+  @impl true
+  def init({cmd_with_args, opts}) do
+    {pool_opts, process_opts} = Keyword.split(opts, [:size, :max_size, :idle_timeout])
+    process_opts = Keyword.put_new(process_opts, :spawner, :daemon)
+
+    # options are validated once, instead of failing each worker
+    with {:ok, pool_opts} <- normalize_pool_opts(pool_opts),
+         {:ok, args} <- Exec.normalize_exec_args(cmd_with_args, process_opts) do
+      # workers are linked, they must not take down the pool
+      Elixir.Process.flag(:trap_exit, true)
+
+      state =
+        Map.merge(pool_opts, %{
+          cmd_with_args: cmd_with_args,
+          process_opts: process_opts,
+          pipes: pool_pipes(args.stderr),
+          # pid => worker
+          workers: %{},
+          # most recently used first
+          idle: [],
+          waiting: :queue.new(),
+          # monitor ref => {:busy, worker pid} | {:waiting, checkout ref}
+          clients: %{}
+        })
+
+      schedule_shrink(state)
+      {:ok, replenish(state)}
+    else
+      {:error, reason} ->
+        {:stop, reason}
+    end
+  end
+
+  @impl true
+  def handle_call({:checkout, ref}, {client, _} = from, state) do
+    client_ref = Elixir.Process.monitor(client)
+
+    state = %{
+      state
+      | waiting: :queue.in({ref, from, client_ref}, state.waiting),
+        clients: Map.put(state.clients, client_ref, {:waiting, ref})
+    }
+
+    {:noreply, serve(state)}
+  end
+
+  def handle_call(:info, _from, state) do
+    busy = Enum.count(state.workers, fn {_pid, worker} -> worker.status == :busy end)
+
+    info = %{
+      size: active_count(state),
+      idle: length(state.idle),
+      busy: busy,
+      waiting: :queue.len(state.waiting)
+    }
+
+    {:reply, info, state}
+  end
+
+  @impl true
+  def handle_cast({:checkin, pid}, state) do
+    case state.workers do
+      %{^pid => %{status: :busy}} ->
+        {:noreply, serve(checkin_worker(state, pid))}
+
+      _ ->
+        {:noreply, state}
+    end
+  end
+
+  def handle_cast({:cancel_checkout, ref}, state) do
+    busy =
+      Enum.find(state.workers, fn {_pid, worker} ->
+        worker.status == :busy and worker.checkout_ref == ref
+      end)
+
+    case busy do
+      {pid, _worker} ->
+        {:noreply, serve(checkin_worker(state, pid))}
+
+      nil ->
+        {:noreply, remove_waiting(state, ref)}
+    end
+  end
+
+  @impl true
+  def handle_info({:DOWN, ref, :process, pid, _reason}, state) do
+    case Map.pop(state.clients, ref) do
+      # worker pipes are closed by the worker when the owner exits
+      {{:busy, worker_pid}, clients} ->
+        state = put_worker(%{state | clients: clients}, worker_pid, client_ref: nil)
+        {:noreply, serve(discard(state, worker_pid))}
+
+      {{:waiting, checkout_ref}, clients} ->
+        {:noreply, remove_waiting(%{state | clients: clients}, checkout_ref)}
+
+      {nil, _clients} ->
+        {:noreply, serve(worker_down(state, pid))}
+    end
+  end
+
+  def handle_info(:shrink, state) do
+    schedule_shrink(state)
+    {:noreply, shrink(state)}
+  end
+
+  # exit status of a worker, sent to the owner
+  def handle_info({ref, _exit_status}, state) when is_reference(ref) do
+    case Enum.find(state.workers, fn {_pid, worker} -> worker.process.exit_ref == ref end) do
+      {pid, %{status: :idle}} ->
+        {:noreply, serve(discard(state, pid))}
+
+      # discarded on checkin
+      {pid, %{status: :busy}} ->
+        {:noreply, put_worker(state, pid, exited: true)}
+
+      _ ->
+        {:noreply, state}
+    end
+  end
+
+  # workers are cleaned up on `:DOWN`
+  def handle_info({:EXIT, _pid, _reason}, state), do: {:noreply, state}
+
+  # hands out workers to the waiting callers in the order of arrival,
+  # growing the pool when all workers are busy
+  defp serve(state) do
+    with {{:value, waiter}, waiting} <- :queue.out(state.waiting),
+         {:ok, pid, state} <- take_worker(state) do
+      serve(assign(%{state | waiting: waiting}, pid, waiter))
+    else
+      _ -> state
+    end
+  end
+
+  defp take_worker(%{idle: [pid | idle]} = state), do: {:ok, pid, %{state | idle: idle}}
+
+  defp take_worker(state) do
+    if active_count(state) < state.max_size do
+      {[pid], state} = start_workers(state, 1)
+      {:ok, pid, state}
+    else
+      :none
+    end
+  end
+
+  defp assign(state, pid, {ref, {client, _} = from, client_ref} = waiter) do
+    worker = Map.fetch!(state.workers, pid)
+
+    case change_owner(worker.process, state.pipes, client) do
+      :ok ->
+        GenServer.reply(from, {:ok, worker.process})
+
+        state = %{state | clients: Map.put(state.clients, client_ref, {:busy, pid})}
+        put_worker(state, pid, status: :busy, client_ref: client_ref, checkout_ref: ref)
+
+      {:error, _} ->
+        # caller gets the next worker
+        state = discard(state, pid)
+        %{state | waiting: :queue.in_r(waiter, state.waiting)}
+    end
+  end
+
+  defp checkin_worker(state, pid) do
+    worker = Map.fetch!(state.workers, pid)
+    Elixir.Process.demonitor(worker.client_ref, [:flush])
+
+    state = %{state | clients: Map.delete(state.clients, worker.client_ref)}
+    state = put_worker(state, pid, client_ref: nil, checkout_ref: nil)
+
+    if not worker.exited and change_owner(worker.process, state.pipes, self()) == :ok do
+      state = put_worker(state, pid, status: :idle, idle_since: now())
+      %{state | idle: [pid | state.idle]}
+    else
+      discard(state, pid)
+    end
+  end
+
+  # same as `Exile.Process.await_exit/2` without blocking the pool, exit
+  # status and `:DOWN` are handled when they arrive
+  defp discard(state, pid) do
+    worker = Map.fetch!(state.workers, pid)
+    GenServer.cast(worker.process.pid, {:prepare_exit, self(), @stop_timeout})
+
+    state = put_worker(state, pid, status: :stopping)
+    replenish(%{state | idle: List.delete(state.idle, pid)})
+  end
+
+  defp worker_down(state, pid) do
+    case Map.pop(state.workers, pid) do
+      {nil, _workers} ->
+        state
+
+      {worker, workers} ->
+        if worker.client_ref, do: Elixir.Process.demonitor(worker.client_ref, [:flush])
+
+        state = %{
+          state
+          | workers: workers,
+            idle: List.delete(state.idle, pid),
+            clients: Map.delete(state.clients, worker.client_ref)
+        }
+
+        replenish(state)
+    end
+  end
+
+  defp remove_waiting(state, ref) do
+    {removed, waiting} =
+      state.waiting
+      |> :queue.to_list()
+      |> Enum.split_with(fn {checkout_ref, _from, _client_ref} -> checkout_ref == ref end)
+
+    Enum.each(removed, fn {_ref, _from, client_ref} ->
+      Elixir.Process.demonitor(client_ref, [:flush])
+    end)
+
+    clients = Map.drop(state.clients, Enum.map(removed, &elem(&1, 2)))
+    %{state | waiting: :queue.from_list(waiting), clients: clients}
+  end
+
+  # stops workers above `size` which are idle for `idle_timeout`, least
+  # recently used first
+  defp shrink(state) do
+    deadline = now() - state.idle_timeout
+    excess = active_count(state) - state.size
+
+    state.idle
+    |> Enum.reverse()
+    |> Enum.filter(fn pid -> state.workers[pid].idle_since <= deadline end)
+    |> Enum.take(max(excess, 0))
+    |> Enum.reduce(state, &discard(&2, &1))
+  end
+
+  # replaces stopped workers, so that there are always `size` workers
+  defp replenish(state) do
+    missing = state.size - active_count(state)
+
+    if missing > 0 do
+      {pids, state} = start_workers(state, missing)
+      %{state | idle: state.idle ++ pids}
+    else
+      state
+    end
+  end
+
+  defp start_workers(state, count) do
+    {:ok, processes} =
+      Process.start_many(List.duplicate(state.cmd_with_args, count), state.process_opts)
+
+    workers =
+      Map.new(processes, fn process ->
+        worker = %{
+          process: process,
+          status: :idle,
+          idle_since: now(),
+          client_ref: nil,
+          checkout_ref: nil,
+          # program exited while the worker is checked out
+          exited: false
+        }
+
+        {process.pid, worker}
+      end)
+
+    {Enum.map(processes, & &1.pid), %{state | workers: Map.merge(state.workers, workers)}}
+  end
+
+  defp change_owner(process, pipes, pid) do
+    Enum.reduce_while(pipes, :ok, fn pipe, :ok ->
+      case Process.change_pipe_owner(process, pipe, pid) do
+        :ok -> {:cont, :ok}
+        error -> {:halt, error}
+      end
+    end)
+  catch
+    # worker is gone, `:DOWN` is not handled yet
+    :exit, reason -> {:error, reason}
+  end
+
+  # pipes owned by the caller while the worker is checked out
+  defp pool_pipes(:consume), do: [:stdin, :stdout, :stderr]
+  defp pool_pipes(_stderr), do: [:stdin, :stdout]
+
+  defp put_worker(state, pid, fields) do
+    %{state | workers: Map.update!(state.workers, pid, &Map.merge(&1, Map.new(fields)))}
+  end
+
+  defp active_count(state) do
+    Enum.count(state.workers, fn {_pid, worker} -> worker.status != :stopping end)
+  end
+
+  defp schedule_shrink(state) do
+    Elixir.Process.send_after(self(), :shrink, state.idle_timeout)
+  end
+
+  defp now, do: System.monotonic_time(:millisecond)
+
+  @spec normalize_pool_opts(keyword()) ::
+          {:ok, %{size: pos_integer(), max_size: pos_integer(), idle_timeout: pos_integer()}}
+          | {:error, String.t()}
+  defp normalize_pool_opts(opts) do
+    size = Keyword.get(opts, :size, @default_size)
+    max_size = Keyword.get(opts, :max_size, size)
+    idle_timeout = Keyword.get(opts, :idle_timeout, @default_idle_timeout)
+
+    cond do
+      not (is_integer(size) and size > 0) ->
+        {:error, ":size must be a positive integer"}
+
+      not (is_integer(max_size) and max_size >= size) ->
+        {:error, ":max_size must be an integer greater than or equal to :size"}
+
+      not (is_integer(idle_timeout) and idle_timeout > 0) ->
+        {:error, ":idle_timeout must be a positive integer"}
+
+      true ->
+        {:ok, %{size: size, max_size: max_size, idle_timeout: idle_timeout}}
+    end
+  end
+end
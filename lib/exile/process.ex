@@ -150,6 +150,27 @@ defmodule Exile.Process do
   {:ok, 0}
   ```
 
+  ### Direct Pipe IO
+
+  Every `read` and `write` is a call to the `Exile.Process` server. To
+  avoid the extra message hops, pipe owner can get a direct handle to
+  the pipe using `Exile.Process.direct_pipe/2` and do IO in its own
+  process using `Exile.Process.direct_read/2` and
+  `Exile.Process.direct_write/2`. Exile process still manages the
+  command life-cycle and exit status.
+
+  ```
+  iex> {:ok, p} = Process.start_link(~w(cat))
+  iex> {:ok, stdin} = Process.direct_pipe(p, :stdin)
+  iex> {:ok, stdout} = Process.direct_pipe(p, :stdout)
+  iex> Process.direct_write(stdin, ["Hello", " ", "World"])
+  :ok
+  iex> Process.direct_read(stdout, 100)
+  {:ok, "Hello World"}
+  iex> Process.await_exit(p)
+  {:ok, 0}
+  ```
+
   ### Process Termination
 
   When owner does (normally or abnormally) the Exile process always
@@ -183,6 +204,22 @@ defmodule Exile.Process do
   {:ok, 143} # 143 is the exit status when command exit due to SIGTERM
   ```
 
+  ### Resource Usage
+
+  Each running program costs the VM:
+
+    * the `Exile.Process` server, monitored by the owner
+    * a NIF resource holding the stdio pipes, with a monitor on the pipe
+  owner and one fd per pipe
+    * an entry in a shared watcher with a monitor on the server. Watchers
+  are started once, one per scheduler, and are not per program
+    * with `spawner: :port`, a Port and the spawner helper OS process for
+  the lifetime of the program. `spawner: :daemon` does not need either
+
+  So with `spawner: :daemon` a program needs a single BEAM process. Run
+  `mix bench.suite footprint` from `bench/` to measure the memory used
+  per program on your system.
+
   ## Examples
 
   Run a command without any input or output
@@ -256,11 +293,13 @@ defmodule Exile.Process do
 
   use GenServer
 
+  alias Exile.Process.DirectPipe
   alias Exile.Process.Exec
   alias Exile.Process.Nif
   alias Exile.Process.Operations
   alias Exile.Process.Pipe
   alias Exile.Process.State
+  alias Exile.Telemetry
 
   require Logger
 
@@ -270,19 +309,21 @@ defmodule Exile.Process do
 
   @type pipe_name :: :stdin | :stdout | :stderr
 
+  @opaque direct_pipe :: DirectPipe.t()
+
   @type t :: %__MODULE__{
           monitor_ref: reference(),
           exit_ref: reference(),
           pid: pid | nil,
-          owner: pid
+          owner: pid,
+          max_chunk_size: pos_integer()
         }
 
-  defstruct [:monitor_ref, :exit_ref, :pid, :owner]
+  defstruct [:monitor_ref, :exit_ref, :pid, :owner, :max_chunk_size]
 
   @type exit_status :: non_neg_integer
 
   @default_opts [env: [], stderr: :console]
-  @default_buffer_size 65_535
   @os_signal_timeout 1000
 
   @doc """
@@ -293,6 +334,10 @@ defmodule Exile.Process do
   `cmd_with_args` must be a list containing command with arguments.
   example: `["cat", "file.txt"]`.
 
+  Resolved path of the command is cached for a few seconds, see
+  `:executable_cache_ttl` application env (in milliseconds, `0`
+  disables the cache). The cache is invalidated when `PATH` changes.
+
   ### Options
 
     * `cd`   -  the directory to run the command in
@@ -306,6 +351,109 @@ defmodule Exile.Process do
         2. `:disable`  -  stderr output is redirected `/dev/null` suppressing all output
         3. `:consume`  -  connects stderr for the consumption. When set to stream the output must be consumed to
   avoid external program from blocking.
+        4. `:redirect_to_stdout`  -  stderr is written to the stdout of the program,
+  same as `2>&1` in a shell. Both streams are read with `read/2` in the order
+  they are written, with a single pipe. Follows stdout when it is redirected to
+  a file or an fd. Can not be used with a `:ring` stdout
+        5. `{:file, path}` or `{:fd, fd}`  -  same as `stdout` redirect below
+
+    * `stdout`  -  where stdout of the program goes.
+        1. `:pipe`  -  connects stdout for the consumption (Default)
+        2. `{:file, path}`  -  stdout is written directly to the file,
+  truncating it. The file is created if it does not exist. Relative paths
+  are relative to the current working directory of the VM, not `cd`
+        3. `{:fd, fd}`  -  stdout is written directly to the OS file descriptor
+  `fd` owned by the VM, such as a socket (`:inet.getfd/1`). The program gets
+  a duplicate, so `fd` stays open and owned by the caller
+        4. `{:ring, capacity}`  -  for cooperating programs. stdout is written to
+  a shared memory ring of `capacity` bytes (a power of two, at least 4096)
+  instead of the pipe, so the program and the VM only make a syscall when the
+  other side is waiting. Reads are served by copying out of the ring. The
+  program gets the ring as fd 3 and the doorbell as fd 4 (also set as
+  `EXILE_RING_FD` and `EXILE_RING_DOORBELL_FD` env) and must write using the
+  protocol described in `c_src/exile_ring.h`, a C program can include it.
+  Closing stdout is EOF. Can not be used with `framing`
+
+  When redirected to a file or an fd, data does not pass through the VM at
+  all, and `read/2` returns `:eof`.
+
+    * `stdin`  -  where stdin of the program comes from. `:pipe` (Default),
+  `{:file, path}` or `{:fd, fd}`, same as `stdout`. The program reads the file
+  or fd directly, and `write/2` returns `{:error, :epipe}`.
+
+    * `max_chunk_size`  -  default maximum size of the data returned by `read/2`,
+  `read_stderr/2` and `read_any/2` when size is not passed. Reads larger than the
+  pipe capacity drain the pipe in a loop. Defaults to `65_535`
+
+    * `pipe_size`  -  requested kernel pipe buffer capacity in bytes for the
+  stdio pipes. Larger pipe lets a single read return more data and reduces the
+  number of round-trips. Only supported on Linux (`F_SETPIPE_SZ`), ignored on
+  other platforms or when the size is not allowed. Defaults to the OS default
+
+    * `drain_reads`  -  when set to `true` each read keeps reading until the pipe
+  is empty, the requested size is read or the scheduler timeslice is used up,
+  instead of returning after a single read. This reduces wakeups for bursty
+  programs at the cost of latency. Returned data can be a list of binaries.
+  Defaults to `false`
+
+    * `buffer_pool`  -  when set to `true` stdout and stderr are read into
+  fixed size 64 KiB buffers kept in a free list by the process, instead of
+  allocating a new binary for every read. Data is returned as a binary
+  referring to the buffer, and the buffer is reused once the binary (and
+  any sub-binary of it) is garbage collected. Reads return at most a
+  buffer, and reads smaller than 4 KiB are copied to a regular binary so
+  that they do not hold a whole buffer. Not used together with
+  `drain_reads`, `framing` or a `:ring` stdout. Buffer counters are
+  returned by `stats/1`. Defaults to `false`
+
+    * `nif_scheduler`  -  scheduler used by the NIFs which read and write the
+  stdio pipes of the process.
+        1. `:dirty_io`  -  calls run on a dirty IO scheduler (Default)
+        2. `:normal`  -  calls run on the calling scheduler. Pipes are
+  non-blocking and each call is bounded to roughly a timeslice, so this
+  avoids the dirty scheduler hop and the contention for the dirty IO
+  schedulers when many processes do small reads and writes.
+  `splice/2` uses the normal scheduler only when both pipes use it, and an
+  `{:fd, fd}` destination always uses a dirty IO scheduler
+
+    * `framing`  -  split stdout into records in the NIF. When set, `read/2`
+  returns `{:ok, records}` where `records` is a non-empty list of complete
+  records. Records are sub-binaries of the read buffer, and an incomplete
+  record is kept by the NIF till the rest of it is read, so a record can be
+  larger than the requested size. stderr is not affected.
+        1. `:lines`  -  records separated by `"\n"`, same as `{:delimiter, ?\n}`
+        2. `{:delimiter, byte}`  -  records separated by `byte`. Delimiter is
+  not included in the record. Trailing data without delimiter is returned
+  as the last record
+        3. `{:length_prefixed, n}`  -  each record is preceded by its length as
+  `n` bytes (1, 2 or 4) big-endian unsigned integer, same as `{:packet, n}`
+  of `:gen_tcp`. Incomplete record at the end returns
+  `{:error, :incomplete_record}`
+
+    * `max_record_size`  -  maximum size of a record with `framing`. A larger
+  record returns `{:error, :record_too_large}` as soon as it exceeds the
+  size, and is dropped so that the following reads return the records
+  after it. Records read before it are returned first. Without a limit a
+  length prefixed record is allocated whole once its header is read.
+  Defaults to `:infinity`
+
+    * `spawner`  -  how the external program is spawned.
+        1. `:port`  -  a new spawner helper is started using a Port for every
+  program (Default)
+        2. `:daemon`  -  programs are spawned by a long-lived spawner daemon
+  shared by all processes. This avoids the Port and socket setup for every
+  program and is faster when starting many short-lived programs
+
+    * `notify_spawn`  -  `start_link/2` always returns before the program is
+  spawned, the handshake with the spawner runs in the process server and
+  calls made meanwhile are queued till the pipes are ready. When set to
+  `true` the owner is sent `{Exile.Process, :spawned, pid, result}` once spawn
+  finishes, where `result` is `{:ok, os_pid}` or `{:error, reason}`, see
+  `await_spawn/2`. Spawn failure then stops the process normally instead of
+  crashing the owner, and `await_exit/2` returns
+  `{:error, {:spawn_failed, reason}}`. Spawn is also reported with the
+  `[:exile, :spawn, :start | :stop | :exception]` telemetry events.
+  Defaults to `false`
 
   Caller of the process will be the owner owner of the Exile Process.
   And default owner of all opened pipes.
@@ -315,33 +463,91 @@ defmodule Exile.Process do
   @spec start_link(nonempty_list(String.t()),
           cd: String.t(),
           env: [{String.t(), String.t()}],
-          stderr: :console | :disable | :stream
+          stderr: :console | :disable | :consume | :redirect_to_stdout,
+          max_chunk_size: pos_integer(),
+          pipe_size: pos_integer(),
+          drain_reads: boolean(),
+          framing: :lines | {:delimiter, byte} | {:length_prefixed, 1 | 2 | 4},
+          max_record_size: pos_integer() | :infinity,
+          stdin: :pipe | {:file, String.t()} | {:fd, non_neg_integer()},
+          stdout:
+            :pipe | {:file, String.t()} | {:fd, non_neg_integer()} | {:ring, pos_integer()},
+          spawner: :port | :daemon,
+          notify_spawn: boolean(),
+          buffer_pool: boolean(),
+          nif_scheduler: :dirty_io | :normal
         ) :: {:ok, t} | {:error, any()}
   def start_link(cmd_with_args, opts \\ []) do
     opts = Keyword.merge(@default_opts, opts)
 
     case Exec.normalize_exec_args(cmd_with_args, opts) do
       {:ok, args} ->
-        owner = self()
-        exit_ref = make_ref()
-        args = Map.merge(args, %{owner: owner, exit_ref: exit_ref})
-        {:ok, pid} = GenServer.start_link(__MODULE__, args)
-        ref = Process.monitor(pid)
-
-        process = %__MODULE__{
-          pid: pid,
-          monitor_ref: ref,
-          exit_ref: exit_ref,
-          owner: owner
-        }
+        {:ok, start_server(args)}
 
-        {:ok, process}
+      error ->
+        error
+    end
+  end
+
+  @doc ~S"""
+  Starts an `Exile.Process` server for each command in `cmd_with_args_list`.
+
+  Options are same as `start_link/2` and are shared by all commands.
+  They are validated once for the whole batch, and each distinct
+  executable is resolved once. Programs are spawned concurrently.
+  Unlike `start_link/2`, `spawner` defaults to `:daemon` since batches
+  benefit the most from the long-lived spawner.
+
+  Returns the processes in the same order as the commands. Each of them
+  behaves exactly like the one returned by `start_link/2` and must be
+  awaited.
+
+  ```
+  iex> alias Exile.Process
+  iex> {:ok, [p1, p2]} = Process.start_many([~w(echo one), ~w(echo two)])
+  iex> {Process.read(p1), Process.read(p2)}
+  {{:ok, "one\n"}, {:ok, "two\n"}}
+  iex> {Process.await_exit(p1), Process.await_exit(p2)}
+  {{:ok, 0}, {:ok, 0}}
+  ```
+  """
+  @spec start_many([nonempty_list(String.t())], keyword()) :: {:ok, [t]} | {:error, any()}
+  def start_many(cmd_with_args_list, opts \\ []) do
+    opts = Keyword.merge(@default_opts ++ [spawner: :daemon], opts)
+
+    case Exec.normalize_many_exec_args(cmd_with_args_list, opts) do
+      {:ok, cmd_with_args_list, exec_opts} ->
+        # servers spawn the program in `handle_continue/2`, so starting
+        # them one after the other still spawns concurrently
+        processes =
+          Enum.map(cmd_with_args_list, fn cmd_with_args ->
+            start_server(Map.put(exec_opts, :cmd_with_args, cmd_with_args))
+          end)
+
+        {:ok, processes}
 
       error ->
         error
     end
   end
 
+  defp start_server(args) do
+    {max_chunk_size, args} = Map.pop!(args, :max_chunk_size)
+    owner = self()
+    exit_ref = make_ref()
+    args = Map.merge(args, %{owner: owner, exit_ref: exit_ref})
+    {:ok, pid} = GenServer.start_link(__MODULE__, args)
+    ref = Process.monitor(pid)
+
+    %__MODULE__{
+      pid: pid,
+      monitor_ref: ref,
+      exit_ref: exit_ref,
+      owner: owner,
+      max_chunk_size: max_chunk_size
+    }
+  end
+
   @doc """
   Closes external program's standard input pipe (stdin).
 
@@ -378,13 +584,16 @@ defmodule Exile.Process do
   @doc """
   Writes iodata `data` to external program's standard input pipe.
 
+  iodata is written as is using vectored IO, without flattening it to
+  a single binary.
+
   This call blocks when the pipe is full. Returns `:ok` when
   the complete data is written.
   """
-  @spec write(t, binary) :: :ok | {:error, any()}
+  @spec write(t, iodata) :: :ok | {:error, any()}
   def write(process, iodata) do
-    binary = IO.iodata_to_binary(iodata)
-    GenServer.call(process.pid, {:write_stdin, binary}, :infinity)
+    iovec = :erlang.iolist_to_iovec(iodata)
+    GenServer.call(process.pid, {:write_stdin, iovec}, :infinity)
   end
 
   @doc """
@@ -395,12 +604,16 @@ defmodule Exile.Process do
 
   Note that `max_size` is the maximum size of the returned data. But
   the returned data can be less than that depending on how the program
-  flush the data etc.
+  flush the data etc. Defaults to `:max_chunk_size` passed to `start_link/2`.
+
+  When started with `:framing`, returns `{:ok, records}` with a list of
+  complete records instead, or `{:error, :record_too_large}` for a record
+  larger than `:max_record_size`.
   """
-  @spec read(t, pos_integer()) :: {:ok, iodata} | :eof | {:error, any()}
-  def read(process, max_size \\ @default_buffer_size)
-      when is_integer(max_size) and max_size > 0 do
-    GenServer.call(process.pid, {:read_stdout, max_size}, :infinity)
+  @spec read(t, pos_integer() | nil) :: {:ok, iodata} | :eof | {:error, any()}
+  def read(process, max_size \\ nil)
+      when is_nil(max_size) or (is_integer(max_size) and max_size > 0) do
+    GenServer.call(process.pid, {:read_stdout, max_size || process.max_chunk_size}, :infinity)
   end
 
   @doc """
@@ -414,9 +627,10 @@ defmodule Exile.Process do
   the returned data can be less than that depending on how the program
   flush the data etc.
   """
-  @spec read_stderr(t, pos_integer()) :: {:ok, iodata} | :eof | {:error, any()}
-  def read_stderr(process, size \\ @default_buffer_size) when is_integer(size) and size > 0 do
-    GenServer.call(process.pid, {:read_stderr, size}, :infinity)
+  @spec read_stderr(t, pos_integer() | nil) :: {:ok, iodata} | :eof | {:error, any()}
+  def read_stderr(process, size \\ nil)
+      when is_nil(size) or (is_integer(size) and size > 0) do
+    GenServer.call(process.pid, {:read_stderr, size || process.max_chunk_size}, :infinity)
   end
 
   @doc """
@@ -426,14 +640,23 @@ defmodule Exile.Process do
   Blocks if no bytes are written to stdout or stderr yet. And returns
   as soon as data is available.
 
+  Both pipes are checked in a single call. When both have data they are
+  served alternately, so continuous output on one of them does not delay
+  the other.
+
   Note that `max_size` is the maximum size of the returned data. But
   the returned data can be less than that depending on how the program
   flush the data etc.
   """
-  @spec read_any(t, pos_integer()) ::
+  @spec read_any(t, pos_integer() | nil) ::
           {:ok, {:stdout, iodata}} | {:ok, {:stderr, iodata}} | :eof | {:error, any()}
-  def read_any(process, size \\ @default_buffer_size) when is_integer(size) and size > 0 do
-    GenServer.call(process.pid, {:read_stdout_or_stderr, size}, :infinity)
+  def read_any(process, size \\ nil)
+      when is_nil(size) or (is_integer(size) and size > 0) do
+    GenServer.call(
+      process.pid,
+      {:read_stdout_or_stderr, size || process.max_chunk_size},
+      :infinity
+    )
   end
 
   @doc """
@@ -452,6 +675,79 @@ defmodule Exile.Process do
     )
   end
 
+  @doc """
+  Returns a handle for doing IO on the pipe directly from the caller,
+  without going through the `Exile.Process` server.
+
+  Only the pipe owner can get the handle and the handle must only be
+  used by the pipe owner. Once pipe owner is changed or the pipe is closed
+  the handle becomes invalid. Avoid mixing direct IO and regular IO
+  on the same pipe concurrently.
+
+  For more details about Pipe Owner, please check module docs.
+  """
+  @spec direct_pipe(t, pipe_name) :: {:ok, direct_pipe} | {:error, any()}
+  def direct_pipe(process, pipe_name) do
+    GenServer.call(process.pid, {:direct_pipe, pipe_name}, :infinity)
+  end
+
+  @doc """
+  Same as `read/2`, but reads directly from the pipe in the caller process.
+
+  Pipe must be a readable pipe (`:stdout` or `:stderr`) obtained
+  with `direct_pipe/2`.
+  """
+  @spec direct_read(direct_pipe, pos_integer()) :: {:ok, iodata} | :eof | {:error, any()}
+  def direct_read(direct_pipe, max_size) when is_integer(max_size) and max_size > 0 do
+    DirectPipe.read(direct_pipe, max_size)
+  end
+
+  @doc """
+  Same as `write/2`, but writes directly to the pipe in the caller
+  process.
+
+  Pipe must be `:stdin` pipe obtained with `direct_pipe/2`.
+  """
+  @spec direct_write(direct_pipe, iodata) :: :ok | {:error, any()}
+  def direct_write(direct_pipe, iodata) do
+    DirectPipe.write(direct_pipe, iodata)
+  end
+
+  @doc """
+  Moves data from the `src` pipe to `dst` until `src` reaches EOF, and
+  returns the number of bytes moved.
+
+  Data is moved by the kernel (using `splice(2)` on Linux) without
+  copying it to the VM, so piping output of one command to another
+  is cheap. `src` must be a readable pipe and `dst` either `:stdin`
+  pipe of another process or `{:fd, fd}` for an arbitrary file or
+  socket fd, such as one returned by `:inet.getfd/1`. `fd` is
+  duplicated, the caller still owns it. Since the caller is blocked
+  till EOF, `dst` fd should be non-blocking or a regular file.
+
+  Both pipes must be obtained with `direct_pipe/2`, `dst` pipe is not
+  closed after EOF.
+
+  ```
+  iex> {:ok, echo} = Process.start_link(~w(echo hello))
+  iex> {:ok, cat} = Process.start_link(~w(cat))
+  iex> {:ok, src} = Process.direct_pipe(echo, :stdout)
+  iex> {:ok, dst} = Process.direct_pipe(cat, :stdin)
+  iex> Process.splice(src, dst)
+  {:ok, 6}
+  iex> :ok = Process.close_stdin(cat)
+  iex> Process.read(cat)
+  {:ok, "hello\n"}
+  iex> Process.await_exit(cat)
+  {:ok, 0}
+  ```
+  """
+  @spec splice(direct_pipe, direct_pipe | {:fd, non_neg_integer()}) ::
+          {:ok, non_neg_integer()} | {:error, any()}
+  def splice(src, dst) do
+    DirectPipe.splice(src, dst)
+  end
+
   @doc """
   Sends an system signal to external program
 
@@ -464,6 +760,41 @@ defmodule Exile.Process do
     GenServer.call(process.pid, {:kill, signal}, :infinity)
   end
 
+  @doc """
+  Wait for the program started with `notify_spawn: true` to be spawned.
+
+  **ONLY** the Process owner can call this function. Returns
+  `{:ok, os_pid}` once the program is running, or `{:error, reason}` if
+  spawn failed. In that case the process is already stopped and
+  `await_exit/2` returns `{:error, {:spawn_failed, reason}}`.
+
+  Returns `{:error, :timeout}` if the spawn does not finish within
+  `timeout`, the notification is still delivered later.
+
+  ```
+  iex> alias Exile.Process
+  iex> {:ok, p} = Process.start_link(~w(echo hello), notify_spawn: true)
+  iex> {:ok, os_pid} = Process.await_spawn(p)
+  iex> is_integer(os_pid)
+  true
+  iex> Process.await_exit(p)
+  {:ok, 0}
+  ```
+  """
+  @spec await_spawn(t, timeout :: timeout()) :: {:ok, pos_integer()} | {:error, term}
+  def await_spawn(%__MODULE__{pid: pid, owner: owner} = process, timeout \\ 5000) do
+    if self() != owner do
+      raise ArgumentError,
+            "task #{inspect(process)} spawn can only be awaited by owner but was awaited from #{inspect(self())}"
+    end
+
+    receive do
+      {__MODULE__, :spawned, ^pid, result} -> result
+    after
+      timeout -> {:error, :timeout}
+    end
+  end
+
   @doc """
   Wait for the program to terminate and get exit status.
 
@@ -539,6 +870,43 @@ defmodule Exile.Process do
     GenServer.call(process.pid, :os_pid, :infinity)
   end
 
+  @doc """
+  Returns IO counters of the stdio pipes.
+
+  Counters are maintained by the NIF for each pipe, including the IO
+  done by the pipe owner directly, so this is cheap compared to
+  measuring each read or write. Returned map contains `:bytes_read`,
+  `:bytes_written`, `:reads`, `:writes` (number of system calls),
+  `:partial_writes` and `:selects` (number of times an operation had to
+  wait for the pipe). `stderr` is `nil` unless it is consumed.
+
+  `buffer_pool` contains the counters of the pooled read buffers when
+  the process is started with `buffer_pool: true`, otherwise it is
+  `nil`. `:allocated` is the number of buffers allocated because none
+  was free, `:reused` the number of reads served by a recycled buffer,
+  `:copied` the number of small reads copied to a regular binary and
+  `:free` the number of buffers currently in the free list. Compare
+  `:allocated` with `:erlang.system_info({:allocator, :binary_alloc})`
+  to see the effect on binary allocations.
+
+  ```
+  iex> alias Exile.Process
+  iex> {:ok, p} = Process.start_link(~w(cat))
+  iex> :ok = Process.write(p, "hello")
+  iex> {:ok, "hello"} = Process.read(p, 5)
+  iex> {:ok, %{stdin: %{bytes_written: 5}, stdout: %{bytes_read: 5}}} = Process.stats(p)
+  iex> :ok = Process.close_stdin(p)
+  iex> Process.await_exit(p)
+  {:ok, 0}
+  ```
+  """
+  @spec stats(t) ::
+          {:ok, %{stdin: map, stdout: map, stderr: map | nil, buffer_pool: map | nil}}
+          | {:error, :process_not_started}
+  def stats(process) do
+    GenServer.call(process.pid, :stats, :infinity)
+  end
+
   ## Server
 
   @impl true
@@ -561,6 +929,20 @@ defmodule Exile.Process do
   end
 
   @impl true
+  def handle_continue(nil, %State{args: %{notify_spawn: true}} = state) do
+    state = exec(state)
+    send(state.owner, {__MODULE__, :spawned, self(), {:ok, state.os_pid}})
+    {:noreply, state}
+  catch
+    kind, reason ->
+      # owner is linked, stop normally so that spawn failure is reported
+      # as a message instead of crashing the owner
+      reason = spawn_error(kind, reason)
+      send(state.owner, {__MODULE__, :spawned, self(), {:error, reason}})
+      send(state.owner, {state.exit_ref, {:error, {:spawn_failed, reason}}})
+      {:stop, :normal, State.set_status(state, {:exit, {:error, reason}})}
+  end
+
   def handle_continue(nil, state) do
     {:noreply, exec(state)}
   end
@@ -606,6 +988,19 @@ defmodule Exile.Process do
     end
   end
 
+  def handle_call({:direct_pipe, pipe_name}, {caller, _}, state) do
+    with {:ok, pipe} <- State.pipe(state, pipe_name),
+         true <- Pipe.open?(pipe) && pipe.owner == caller do
+      {:reply, {:ok, DirectPipe.new(self(), pipe)}, state}
+    else
+      false ->
+        {:reply, {:error, :pipe_closed_or_invalid_caller}, state}
+
+      {:error, _} = error ->
+        {:reply, error, state}
+    end
+  end
+
   def handle_call({:close_pipe, pipe_name}, {caller, _} = from, state) do
     with {:ok, pipe} <- State.pipe(state, pipe_name),
          {:ok, new_pipe} <- Pipe.close(pipe, caller),
@@ -648,8 +1043,8 @@ defmodule Exile.Process do
     end
   end
 
-  def handle_call({:write_stdin, binary}, from, state) do
-    case Operations.write(state, {:write_stdin, from, binary}) do
+  def handle_call({:write_stdin, iovec}, from, state) do
+    case Operations.write(state, {:write_stdin, from, iovec}) do
       {:noreply, state} ->
         {:noreply, state}
 
@@ -659,22 +1054,30 @@ defmodule Exile.Process do
   end
 
   def handle_call(:os_pid, _from, state) do
-    case Port.info(state.port, :os_pid) do
-      {:os_pid, os_pid} ->
-        {:reply, {:ok, os_pid}, state}
-
-      nil ->
-        Logger.debug("Process not alive")
-        {:reply, :undefined, state}
+    if state.status == :running do
+      {:reply, {:ok, state.os_pid}, state}
+    else
+      Logger.debug("Process not alive")
+      {:reply, :undefined, state}
     end
   end
 
   def handle_call({:kill, signal}, _from, state) do
-    {:reply, signal(state.port, signal), state}
+    {:reply, signal(state, signal), state}
+  end
+
+  def handle_call(:stats, _from, state) do
+    if state.status == :init do
+      {:reply, {:error, :process_not_started}, state}
+    else
+      {:ok, buffer_pool} = Nif.nif_buffer_pool_stats(state.pipes.stdout.fd)
+      buffer_pool = if buffer_pool == :undefined, do: nil, else: buffer_pool
+      {:reply, {:ok, Map.put(pipe_stats(state), :buffer_pool, buffer_pool)}, state}
+    end
   end
 
   @impl true
-  def handle_info({:prepare_exit, current_stage, timeout}, %{status: status, port: port} = state) do
+  def handle_info({:prepare_exit, current_stage, timeout}, %{status: status} = state) do
     cond do
       status != :running ->
         {:noreply, state}
@@ -684,12 +1087,12 @@ defmodule Exile.Process do
         {:noreply, state}
 
       current_stage == :sigterm ->
-        signal(port, :sigterm)
+        signal(state, :sigterm)
         Elixir.Process.send_after(self(), {:prepare_exit, :sigkill, timeout}, timeout)
         {:noreply, state}
 
       current_stage == :sigkill ->
-        signal(port, :sigkill)
+        signal(state, :sigkill)
         Elixir.Process.send_after(self(), {:prepare_exit, :stop, timeout}, timeout)
         {:noreply, state}
 
@@ -745,7 +1148,7 @@ defmodule Exile.Process do
 
   def handle_info({:stop, :sigterm}, state) do
     if state.status == :running do
-      signal(state.port, :sigkill)
+      signal(state, :sigkill)
       Elixir.Process.send_after(self(), {:stop, :sigkill}, @os_signal_timeout)
     end
 
@@ -778,6 +1181,20 @@ defmodule Exile.Process do
     maybe_shutdown(state)
   end
 
+  # program spawned by the spawner daemon
+  def handle_info({Exile.Spawner, :exit, os_pid, result}, %State{os_pid: os_pid} = state) do
+    send(state.owner, {state.exit_ref, result})
+
+    status =
+      case result do
+        {:ok, exit_status} -> exit_status
+        error -> error
+      end
+
+    state = State.set_status(state, {:exit, status})
+    maybe_shutdown(state)
+  end
+
   # shutdown unconditionally when process owner exit normally.
   # Since Exile process is linked to the owner, in case of owner crash,
   # exile process will be killed by the VM.
@@ -804,19 +1221,67 @@ defmodule Exile.Process do
     maybe_shutdown(state)
   end
 
+  @impl true
+  # spawn failed with `notify_spawn: true`, there are no pipes to report
+  def terminate(_reason, %State{status: status, pipes: nil} = state) when status != :init do
+    Telemetry.stop(
+      [:exile, :process],
+      state.start_time,
+      %{cmd: command(state), os_pid: state.os_pid, status: status, stats: nil}
+    )
+  end
+
+  def terminate(_reason, %State{status: status} = state) when status != :init do
+    stats = pipe_stats(state)
+    read_stats = Enum.reject([stats.stdout, stats.stderr], &is_nil/1)
+    all_stats = [stats.stdin | read_stats]
+
+    measurements = %{
+      bytes_read: sum_stats(read_stats, :bytes_read),
+      bytes_written: stats.stdin.bytes_written,
+      partial_writes: stats.stdin.partial_writes,
+      selects: sum_stats(all_stats, :selects)
+    }
+
+    Telemetry.stop(
+      [:exile, :process],
+      state.start_time,
+      %{cmd: command(state), os_pid: state.os_pid, status: status, stats: stats},
+      measurements
+    )
+  end
+
+  def terminate(_reason, _state), do: :ok
+
+  defp pipe_stats(state) do
+    Map.new(state.pipes, fn
+      {name, %Pipe{fd: nil}} ->
+        {name, nil}
+
+      {name, %Pipe{fd: fd}} ->
+        {:ok, stats} = Nif.nif_fd_stats(fd)
+        {name, stats}
+    end)
+  end
+
+  defp sum_stats(stats, key), do: Enum.reduce(stats, 0, &(&1[key] + &2))
+
+  defp command(state), do: to_string(hd(state.args.cmd_with_args))
+
   @type signal :: :sigkill | :sigterm
 
-  @spec signal(port, signal) :: :ok | {:error, :invalid_signal} | {:error, :process_not_alive}
-  defp signal(port, signal) do
-    with true <- signal in [:sigkill, :sigterm],
-         {:os_pid, os_pid} <- Port.info(port, :os_pid) do
-      Nif.nif_kill(os_pid, signal)
-    else
-      false ->
+  @spec signal(State.t(), signal) ::
+          :ok | {:error, :invalid_signal} | {:error, :process_not_alive}
+  defp signal(state, signal) do
+    cond do
+      signal not in [:sigkill, :sigterm] ->
         {:error, :invalid_signal}
 
-      nil ->
+      state.status != :running ->
         {:error, :process_not_alive}
+
+      true ->
+        Nif.nif_kill(state.os_pid, signal)
     end
   end
 
@@ -834,18 +1299,33 @@ defmodule Exile.Process do
     end
   end
 
+  # `Exec.start/2` fails with a match error on `{:error, reason}`
+  defp spawn_error(:error, %MatchError{term: {:error, reason}}), do: reason
+  defp spawn_error(_kind, reason), do: reason
+
   @spec exec(State.t()) :: State.t()
   defp exec(state) do
+    metadata = %{cmd: command(state), spawner: state.args.spawner}
+    start_time = System.monotonic_time()
+
     %{
       port: port,
+      os_pid: os_pid,
       stdin: stdin_fd,
       stdout: stdout_fd,
       stderr: stderr_fd
-    } = Exec.start(state.args, state.stderr)
+    } =
+      Telemetry.span([:exile, :spawn], metadata, fn ->
+        result = Exec.start(state.args, state.stderr)
+        {result, Map.put(metadata, :os_pid, result.os_pid)}
+      end)
+
+    scheduler = state.args.nif_scheduler
+    pipe_opts = [drain_reads: state.args.drain_reads, scheduler: scheduler]
 
     stderr =
       if state.stderr == :consume do
-        Pipe.new(:stderr, stderr_fd, state.owner)
+        Pipe.new(:stderr, stderr_fd, state.owner, pipe_opts)
       else
         Pipe.new(:stderr)
       end
@@ -853,10 +1333,12 @@ defmodule Exile.Process do
     %State{
       state
       | port: port,
+        os_pid: os_pid,
+        start_time: start_time,
         status: :running,
         pipes: %{
-          stdin: Pipe.new(:stdin, stdin_fd, state.owner),
-          stdout: Pipe.new(:stdout, stdout_fd, state.owner),
+          stdin: Pipe.new(:stdin, stdin_fd, state.owner, scheduler: scheduler),
+          stdout: Pipe.new(:stdout, stdout_fd, state.owner, pipe_opts),
           stderr: stderr
         }
     }
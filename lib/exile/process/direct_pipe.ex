@@ -0,0 +1,247 @@
+defmodule Exile.Process.DirectPipe do
+  @moduledoc false
+
+  # Pipe handle to do IO directly from the pipe owner process,
+  # bypassing `Exile.Process` server. NIF calls are made in the caller
+  # process, so `enif_select` notifications are delivered to the caller.
+
+  alias Exile.Process.Nif
+  alias Exile.Process.Pipe
+
+  @type t :: %__MODULE__{
+          server: pid,
+          pipe: Pipe.t()
+        }
+
+  defstruct [:server, :pipe]
+
+  alias __MODULE__
+
+  @spec new(pid, Pipe.t()) :: t
+  def new(server, pipe), do: %DirectPipe{server: server, pipe: pipe}
+
+  @spec read(t, pos_integer) :: {:ok, iodata} | :eof | {:error, term}
+  def read(%DirectPipe{pipe: pipe} = direct_pipe, size) do
+    case Pipe.read(pipe, size, self()) do
+      {:error, :eagain} ->
+        with :ok <- await_select(direct_pipe, :ready_input) do
+          read(direct_pipe, size)
+        end
+
+      ret ->
+        ret
+    end
+  end
+
+  # Reads stdout, and stderr when given, of a process till EOF and
+  # returns the output of each of them as a single binary. Output is
+  # accumulated by the NIF, data beyond `max_size` bytes of a pipe is
+  # discarded. Pipes are read together, so that a program blocked
+  # writing to one of them does not block the other
+  @spec read_all([t], non_neg_integer) :: {:ok, [binary]} | {:error, term}
+  def read_all([%DirectPipe{server: server, pipe: pipe} | _] = direct_pipes, max_size)
+      when length(direct_pipes) <= 2 do
+    if Enum.all?(direct_pipes, &(owner?(&1) and &1.server == server)) do
+      ref = Process.monitor(server)
+      fds = Enum.map(direct_pipes, & &1.pipe.fd)
+      # pipes of a process share the scheduler
+      read_opts = {max_size, pipe.scheduler}
+
+      try do
+        do_read_all(Enum.map(fds, &{&1, :pending}), read_opts, ref)
+      after
+        Process.demonitor(ref, [:flush])
+        flush_read_select(fds)
+      end
+    else
+      {:error, :pipe_closed_or_invalid_caller}
+    end
+  end
+
+  defp do_read_all(entries, read_opts, ref) do
+    entries =
+      Enum.map(entries, fn
+        {fd, :pending} -> {fd, read_all_step(fd, read_opts)}
+        entry -> entry
+      end)
+
+    cond do
+      error = Enum.find_value(entries, &read_all_error/1) ->
+        error
+
+      Enum.all?(entries, &match?({_fd, {:ok, _}}, &1)) ->
+        {:ok, Enum.map(entries, fn {_fd, {:ok, data}} -> data end)}
+
+      true ->
+        with {:ok, ready_fd} <- await_read_all(entries, ref) do
+          entries = Enum.map(entries, &mark_pending(&1, ready_fd))
+          do_read_all(entries, read_opts, ref)
+        end
+    end
+  end
+
+  defp read_all_step(fd, {max_size, scheduler} = read_opts) do
+    case Nif.read_all(fd, max_size, scheduler) do
+      # timeslice is used up
+      :continue -> read_all_step(fd, read_opts)
+      {:error, :eagain} -> :waiting
+      ret -> ret
+    end
+  end
+
+  defp read_all_error({_fd, {:error, _} = error}), do: error
+  defp read_all_error(_entry), do: nil
+
+  defp mark_pending({fd, :waiting}, fd), do: {fd, :pending}
+  defp mark_pending(entry, _ready_fd), do: entry
+
+  defp await_read_all(entries, ref) do
+    {fd1, fd2} =
+      case for {fd, :waiting} <- entries, do: fd do
+        [fd] -> {fd, fd}
+        [fd1, fd2] -> {fd1, fd2}
+      end
+
+    receive do
+      {:select, fd, _ref, :ready_input} when fd in [fd1, fd2] ->
+        {:ok, fd}
+
+      {:DOWN, ^ref, :process, _pid, _reason} ->
+        {:error, :pipe_closed_or_invalid_caller}
+    end
+  end
+
+  # select is re-armed by every read that hits EAGAIN, so there might
+  # be a notification left
+  defp flush_read_select([fd]), do: flush_select(fd, fd)
+  defp flush_read_select([fd1, fd2]), do: flush_select(fd1, fd2)
+
+  @spec write(t, iodata) :: :ok | {:error, term}
+  def write(direct_pipe, iodata) do
+    do_write(direct_pipe, :erlang.iolist_to_iovec(iodata))
+  end
+
+  defp do_write(%DirectPipe{pipe: pipe} = direct_pipe, iovec) do
+    case Pipe.write(pipe, iovec, self()) do
+      {:error, :eagain} ->
+        # unwritten data is retained by the NIF resource
+        with :ok <- await_select(direct_pipe, :ready_output) do
+          do_write(direct_pipe, [])
+        end
+
+      ret ->
+        ret
+    end
+  end
+
+  # Moves data from `src` to `dst` in the kernel until EOF. `dst` can be
+  # another pipe or an arbitrary fd, which is duplicated so that the
+  # caller still owns the original fd
+  @spec splice(t, t | {:fd, non_neg_integer}) :: {:ok, non_neg_integer} | {:error, term}
+  def splice(%DirectPipe{} = src, %DirectPipe{} = dst) do
+    if owner?(src) and owner?(dst) do
+      scheduler = splice_scheduler(src.pipe.scheduler, dst.pipe.scheduler)
+      monitored_splice(src.pipe.fd, dst.pipe.fd, scheduler, {src.server, dst.server})
+    else
+      {:error, :pipe_closed_or_invalid_caller}
+    end
+  end
+
+  def splice(%DirectPipe{} = src, {:fd, fd}) when is_integer(fd) and fd >= 0 do
+    if owner?(src) do
+      with {:ok, dst_fd} <- dup_fd(fd) do
+        try do
+          # writes to an arbitrary fd might block
+          monitored_splice(src.pipe.fd, dst_fd, :dirty_io, {src.server, src.server})
+        after
+          Nif.nif_close(dst_fd)
+        end
+      end
+    else
+      {:error, :pipe_closed_or_invalid_caller}
+    end
+  end
+
+  defp owner?(%DirectPipe{pipe: pipe}), do: Pipe.open?(pipe) && pipe.owner == self()
+
+  defp splice_scheduler(:normal, :normal), do: :normal
+  defp splice_scheduler(_src, _dst), do: :dirty_io
+
+  defp dup_fd(fd) do
+    case Nif.nif_dup_fd(fd) do
+      :error -> {:error, :invalid_fd}
+      ret -> ret
+    end
+  end
+
+  defp monitored_splice(src_fd, dst_fd, scheduler, {src_server, dst_server}) do
+    src_ref = Process.monitor(src_server)
+    dst_ref = Process.monitor(dst_server)
+
+    try do
+      do_splice({src_fd, dst_fd, scheduler}, {src_ref, dst_ref}, 0)
+    after
+      Process.demonitor(src_ref, [:flush])
+      Process.demonitor(dst_ref, [:flush])
+      # when it is not clear which side is blocking both are selected,
+      # so there might be a notification left
+      flush_select(src_fd, dst_fd)
+    end
+  end
+
+  defp do_splice({src_fd, dst_fd, scheduler} = fds, refs, total) do
+    case Nif.splice(src_fd, dst_fd, scheduler) do
+      {:ok, 0} ->
+        {:ok, total}
+
+      {:ok, size} ->
+        do_splice(fds, refs, total + size)
+
+      {:error, :eagain} ->
+        with :ok <- await_splice(src_fd, dst_fd, refs) do
+          do_splice(fds, refs, total)
+        end
+
+      error ->
+        error
+    end
+  end
+
+  defp await_splice(src_fd, dst_fd, {src_ref, dst_ref}) do
+    receive do
+      {:select, ^src_fd, _ref, :ready_input} ->
+        :ok
+
+      {:select, ^dst_fd, _ref, :ready_output} ->
+        :ok
+
+      {:DOWN, ref, :process, _pid, _reason} when ref in [src_ref, dst_ref] ->
+        {:error, :pipe_closed_or_invalid_caller}
+    end
+  end
+
+  defp flush_select(src_fd, dst_fd) do
+    receive do
+      {:select, fd, _ref, _mode} when fd in [src_fd, dst_fd] ->
+        flush_select(src_fd, dst_fd)
+    after
+      0 -> :ok
+    end
+  end
+
+  # Pipe is closed when the server exits, since select is cancelled we
+  # won't get any notification, so we have to watch the server
+  @spec await_select(t, :ready_input | :ready_output) :: :ok | {:error, term}
+  def await_select(%DirectPipe{server: server, pipe: %Pipe{fd: fd}}, mode) do
+    ref = Process.monitor(server)
+
+    receive do
+      {:select, ^fd, _ref, ^mode} ->
+        Process.demonitor(ref, [:flush])
+        :ok
+
+      {:DOWN, ^ref, :process, _pid, _reason} ->
+        {:error, :pipe_closed_or_invalid_caller}
+    end
+  end
+end
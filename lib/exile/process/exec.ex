@@ -1,24 +1,64 @@
 defmodule Exile.Process.Exec do
   @moduledoc false
 
+  alias Exile.ExecutableCache
   alias Exile.Process.Nif
   alias Exile.Process.Pipe
   alias Exile.Process.State
 
+  require Logger
+
   @type args :: %{
           cmd_with_args: [String.t()],
           cd: String.t(),
-          env: [{String.t(), String.t()}]
+          env: [{String.t(), String.t()}],
+          pipe_size: pos_integer() | nil,
+          drain_reads: boolean(),
+          framing: framing | nil,
+          max_record_size: pos_integer() | :infinity,
+          stdin: :pipe | redirect,
+          stdout: :pipe | redirect | ring,
+          spawner: :port | :daemon,
+          notify_spawn: boolean(),
+          buffer_pool: boolean(),
+          nif_scheduler: :dirty_io | :normal
         }
 
+  # stdio stream of the program connected directly to a file or an fd
+  # instead of a pipe, data never passes through the VM
+  @type redirect :: {:file, String.t()} | {:fd, non_neg_integer()}
+
+  # stdout written by a cooperating program to a shared memory ring of
+  # the given capacity, see `c_src/exile_ring.h`
+  @type ring :: {:ring, pos_integer()}
+
+  # stdio pipes, followed by the ring and its doorbell in ring mode
+  @type fds ::
+          {integer, integer, integer} | {integer, integer, integer, integer, integer}
+
+  @type framing :: {:delimiter, byte} | {:length_prefixed, 1 | 2 | 4}
+
   @spec start(args, State.stderr_mode()) :: %{
-          port: port,
+          port: port | nil,
+          os_pid: pos_integer(),
           stdin: non_neg_integer(),
           stdout: non_neg_integer(),
           stderr: non_neg_integer()
         }
+  def start(%{spawner: :daemon, pipe_size: pipe_size} = args, stderr) do
+    {:ok, os_pid, fds} = Exile.Spawner.spawn_command(args, stderr)
+    Exile.Watcher.watch(self(), os_pid, nil)
+
+    {stdin_fd, stdout_fd, stderr_fd} = create_pipes(os_pid, fds, stderr)
+    :ok = set_pipe_size([stdin_fd, stdout_fd, stderr_fd], pipe_size)
+    :ok = set_framing(stdout_fd, args.framing, args.max_record_size)
+    :ok = set_buffer_pool(stdout_fd, args.buffer_pool)
+
+    %{port: nil, os_pid: os_pid, stdin: stdin_fd, stdout: stdout_fd, stderr: stderr_fd}
+  end
+
   def start(args, stderr) do
-    %{cmd_with_args: cmd_with_args, cd: cd, env: env} = args
+    %{cmd_with_args: cmd_with_args, cd: cd, env: env, pipe_size: pipe_size} = args
     socket_path = socket_path()
     {:ok, sock} = :socket.open(:local, :stream, :default)
 
@@ -26,7 +66,12 @@ defmodule Exile.Process.Exec do
       :ok = socket_bind(sock, socket_path)
       :ok = :socket.listen(sock)
 
-      spawner_cmdline_args = [socket_path, to_string(stderr) | cmd_with_args]
+      spawner_cmdline_args = [
+        socket_path,
+        redirect_arg(args.stdin),
+        redirect_arg(args.stdout),
+        redirect_arg(stderr) | cmd_with_args
+      ]
 
       port_opts =
         [:nouse_stdio, :exit_status, :binary, args: spawner_cmdline_args] ++
@@ -35,78 +80,262 @@ defmodule Exile.Process.Exec do
       port = Port.open({:spawn_executable, spawner_path()}, port_opts)
 
       {:os_pid, os_pid} = Port.info(port, :os_pid)
-      Exile.Watcher.watch(self(), os_pid, socket_path)
+      Exile.Watcher.watch(self(), os_pid, socket_file(socket_path))
 
-      {stdin_fd, stdout_fd, stderr_fd} = receive_fds(sock, stderr)
+      fds = receive_fds(sock, os_pid, redirect_fds([args.stdin, args.stdout, stderr]))
+      {stdin_fd, stdout_fd, stderr_fd} = create_pipes(os_pid, fds, stderr)
+      :ok = set_pipe_size([stdin_fd, stdout_fd, stderr_fd], pipe_size)
+      :ok = set_framing(stdout_fd, args.framing, args.max_record_size)
+      :ok = set_buffer_pool(stdout_fd, args.buffer_pool)
 
-      %{port: port, stdin: stdin_fd, stdout: stdout_fd, stderr: stderr_fd}
+      %{port: port, os_pid: os_pid, stdin: stdin_fd, stdout: stdout_fd, stderr: stderr_fd}
     after
       :socket.close(sock)
-      File.rm!(socket_path)
+      remove_socket_file(socket_path)
     end
   end
 
+  @type exec_opts :: %{
+          cd: charlist,
+          env: env,
+          stderr: :console | :disable | :consume | :redirect_to_stdout,
+          pipe_size: pos_integer() | nil,
+          max_chunk_size: pos_integer(),
+          drain_reads: boolean(),
+          framing: framing | nil,
+          max_record_size: pos_integer() | :infinity,
+          stdin: :pipe | redirect,
+          stdout: :pipe | redirect | ring,
+          spawner: :port | :daemon,
+          notify_spawn: boolean(),
+          buffer_pool: boolean(),
+          nif_scheduler: :dirty_io | :normal
+        }
+
   @spec normalize_exec_args(nonempty_list(), keyword()) ::
           {:ok,
            %{
              cmd_with_args: nonempty_list(),
              cd: charlist,
              env: env,
-             stderr: :console | :disable | :consume
+             stderr: :console | :disable | :consume | :redirect_to_stdout,
+             pipe_size: pos_integer() | nil,
+             max_chunk_size: pos_integer(),
+             drain_reads: boolean(),
+             framing: framing | nil,
+             max_record_size: pos_integer() | :infinity,
+             stdin: :pipe | redirect,
+             stdout: :pipe | redirect | ring,
+             spawner: :port | :daemon,
+             notify_spawn: boolean(),
+             buffer_pool: boolean(),
+             nif_scheduler: :dirty_io | :normal
            }}
           | {:error, String.t()}
   def normalize_exec_args(cmd_with_args, opts) do
-    with {:ok, cmd} <- normalize_cmd(cmd_with_args),
-         {:ok, args} <- normalize_cmd_args(cmd_with_args),
-         :ok <- validate_opts_fields(opts),
+    with {:ok, cmd_with_args} <- normalize_cmd_with_args(cmd_with_args, %{}),
+         {:ok, exec_opts} <- normalize_exec_opts(opts) do
+      {:ok, Map.put(exec_opts, :cmd_with_args, cmd_with_args)}
+    end
+  end
+
+  # to start many commands with the same options. Options are
+  # normalized once and each distinct executable is resolved once
+  @spec normalize_many_exec_args([nonempty_list()], keyword()) ::
+          {:ok, [nonempty_list()], exec_opts} | {:error, String.t()}
+  def normalize_many_exec_args(cmd_with_args_list, opts) when is_list(cmd_with_args_list) do
+    with {:ok, exec_opts} <- normalize_exec_opts(opts),
+         {:ok, cmd_with_args_list} <- normalize_cmd_with_args_list(cmd_with_args_list) do
+      {:ok, cmd_with_args_list, exec_opts}
+    end
+  end
+
+  def normalize_many_exec_args(_cmd_with_args_list, _opts) do
+    {:error, "`cmd_with_args_list` must be a list of commands, Please check the documentation"}
+  end
+
+  @spec normalize_exec_opts(keyword()) :: {:ok, exec_opts} | {:error, String.t()}
+  defp normalize_exec_opts(opts) do
+    with :ok <- validate_opts_fields(opts),
          {:ok, cd} <- normalize_cd(opts[:cd]),
          {:ok, stderr} <- normalize_stderr(opts[:stderr]),
-         {:ok, env} <- normalize_env(opts[:env]) do
-      {:ok, %{cmd_with_args: [cmd | args], cd: cd, env: env, stderr: stderr}}
+         {:ok, env} <- normalize_env(opts[:env]),
+         {:ok, pipe_size} <- normalize_pipe_size(opts[:pipe_size]),
+         {:ok, max_chunk_size} <- normalize_max_chunk_size(opts[:max_chunk_size]),
+         {:ok, drain_reads} <- normalize_drain_reads(opts[:drain_reads]),
+         {:ok, framing} <- normalize_framing(opts[:framing]),
+         {:ok, max_record_size} <- normalize_max_record_size(opts[:max_record_size]),
+         {:ok, stdin} <- normalize_stdio(:stdin, opts[:stdin]),
+         {:ok, stdout} <- normalize_stdio(:stdout, opts[:stdout]),
+         :ok <- validate_ring_framing(stdout, framing),
+         :ok <- validate_ring_stderr(stdout, stderr),
+         {:ok, spawner} <- normalize_spawner(opts[:spawner]),
+         {:ok, notify_spawn} <- normalize_notify_spawn(opts[:notify_spawn]),
+         {:ok, buffer_pool} <- normalize_buffer_pool(opts[:buffer_pool]),
+         {:ok, nif_scheduler} <- normalize_nif_scheduler(opts[:nif_scheduler]) do
+      {:ok,
+       %{
+         cd: cd,
+         env: ring_env(stdout) ++ env,
+         stderr: stderr,
+         pipe_size: pipe_size,
+         max_chunk_size: max_chunk_size,
+         drain_reads: drain_reads,
+         framing: framing,
+         max_record_size: max_record_size,
+         stdin: stdin,
+         stdout: stdout,
+         spawner: spawner,
+         notify_spawn: notify_spawn,
+         buffer_pool: buffer_pool,
+         nif_scheduler: nif_scheduler
+       }}
     end
   end
 
   @spec spawner_path :: String.t()
-  defp spawner_path do
+  def spawner_path do
     :filename.join(:code.priv_dir(:exile), "spawner")
   end
 
   @socket_timeout 2000
 
-  @spec receive_fds(:socket.socket(), State.stderr_mode()) :: {Pipe.fd(), Pipe.fd(), Pipe.fd()}
-  defp receive_fds(lsock, stderr_mode) do
-    {:ok, sock} = :socket.accept(lsock, @socket_timeout)
+  @spec receive_fds(:socket.socket(), pos_integer(), [non_neg_integer()]) :: fds
+  defp receive_fds(lsock, os_pid, redirect_fds) do
+    {:ok, sock} = accept_spawner(lsock, os_pid)
 
     try do
+      # spawner waits for the redirect fds before creating the pipes
+      if redirect_fds != [] do
+        :ok = :socket.sendmsg(sock, %{iov: [<<0>>], ctrl: [rights(redirect_fds)]})
+      end
+
       {:ok, msg} = :socket.recvmsg(sock, @socket_timeout)
       %{ctrl: [%{data: data, level: :socket, type: :rights}]} = msg
+      decode_fds(data)
+    after
+      :socket.close(sock)
+    end
+  end
+
+  # Any local user can connect to an abstract socket address before the
+  # spawner does, and would get the redirect fds or could hand us fake
+  # stdio. So connections from anyone other than the spawner `os_pid`
+  # are closed, and we keep waiting for the spawner
+  @spec accept_spawner(:socket.socket(), pos_integer()) ::
+          {:ok, :socket.socket()} | {:error, term}
+  def accept_spawner(lsock, os_pid) do
+    deadline = System.monotonic_time(:millisecond) + @socket_timeout
+    accept_spawner(lsock, os_pid, deadline)
+  end
 
-      <<stdin_fd::native-32, stdout_fd::native-32, stderr_fd::native-32, _::binary>> = data
+  defp accept_spawner(lsock, os_pid, deadline) do
+    timeout = max(deadline - System.monotonic_time(:millisecond), 0)
 
-      # FDs are managed by the NIF resource life-cycle
-      {:ok, stdout} = Nif.nif_create_fd(stdout_fd)
-      {:ok, stdin} = Nif.nif_create_fd(stdin_fd)
-      {:ok, stderr} = Nif.nif_create_fd(stderr_fd)
+    with {:ok, sock} <- :socket.accept(lsock, timeout) do
+      {:ok, fd} = :socket.getopt(sock, :otp, :fd)
 
-      stderr =
-        if stderr_mode == :consume do
-          stderr
-        else
-          # we have to explicitly close FD passed over socket.
-          # Since it will be tracked by the OS and kept open until we close.
-          Nif.nif_close(stderr)
-          nil
-        end
+      case Nif.nif_verify_peer(fd, os_pid) do
+        :ok ->
+          {:ok, sock}
 
-      {stdin, stdout, stderr}
-    after
-      :socket.close(sock)
+        {:error, reason} ->
+          Logger.error("rejected spawner connection. reason: #{inspect(reason)}")
+          :socket.close(sock)
+          accept_spawner(lsock, os_pid, deadline)
+      end
     end
   end
 
+  @spec decode_fds(binary) :: fds
+  def decode_fds(data), do: List.to_tuple(for <<fd::native-32 <- data>>, do: fd)
+
+  # All pipes are held by a single process resource and each pipe is
+  # referred as `{process_resource, pipe_name}`
+  @spec create_pipes(pos_integer(), fds, State.stderr_mode()) ::
+          {Pipe.fd(), Pipe.fd(), Pipe.fd() | nil}
+  defp create_pipes(
+         os_pid,
+         {stdin_fd, stdout_fd, stderr_fd, ring_fd, doorbell_fd},
+         stderr_mode
+       ) do
+    {{process, :stdin}, _, _} =
+      pipes = create_pipes(os_pid, {stdin_fd, stdout_fd, stderr_fd}, stderr_mode)
+
+    # stdout reads are served from the ring, pipe is only the doorbell
+    :ok = Nif.nif_attach_ring(process, ring_fd, doorbell_fd)
+    pipes
+  end
+
+  defp create_pipes(os_pid, {stdin_fd, stdout_fd, stderr_fd}, stderr_mode) do
+    # FDs are managed by the NIF resource life-cycle. stderr fd passed
+    # over socket is closed by the NIF unless it is consumed, since it
+    # is tracked by the OS and kept open until we close.
+    consume_stderr = stderr_mode == :consume
+
+    {:ok, process} =
+      Nif.nif_create_process(os_pid, stdin_fd, stdout_fd, stderr_fd, consume_stderr)
+
+    stderr = if consume_stderr, do: {process, :stderr}, else: nil
+    {{process, :stdin}, {process, :stdout}, stderr}
+  end
+
+  # pipe size is only a hint, OS might not support it or might not
+  # allow the requested size.
+  @spec set_pipe_size([Pipe.fd() | nil], pos_integer() | nil) :: :ok
+  defp set_pipe_size(_fds, nil), do: :ok
+
+  defp set_pipe_size(fds, size) do
+    fds
+    |> Enum.reject(&is_nil/1)
+    |> Enum.each(fn fd ->
+      case Nif.nif_set_pipe_size(fd, size) do
+        {:ok, _size} ->
+          :ok
+
+        {:error, reason} ->
+          Logger.debug(fn -> "Failed to set pipe size to #{size}: #{inspect(reason)}" end)
+      end
+    end)
+  end
+
+  # records are split by the NIF, reads return list of complete records
+  # record size limit of 0 is no limit for the NIF
+  @spec set_framing(Pipe.fd(), framing | nil, pos_integer() | :infinity) :: :ok
+  defp set_framing(_fd, nil, _max_record_size), do: :ok
+  defp set_framing(fd, framing, :infinity), do: Nif.nif_set_framing(fd, framing, 0)
+
+  defp set_framing(fd, framing, max_record_size),
+    do: Nif.nif_set_framing(fd, framing, max_record_size)
+
+  # pool is shared by stdout and stderr of the process
+  @spec set_buffer_pool(Pipe.fd(), boolean()) :: :ok
+  defp set_buffer_pool(_fd, false), do: :ok
+  defp set_buffer_pool({process, :stdout}, true), do: Nif.nif_enable_buffer_pool(process)
+
+  # mode of a stdio stream as understood by the spawner
+  @spec redirect_arg(:pipe | State.stderr_mode()) :: String.t()
+  def redirect_arg({:file, path}), do: "file:" <> path
+  def redirect_arg({:fd, _fd}), do: "fd"
+  def redirect_arg({:ring, capacity}), do: "ring:#{capacity}"
+  def redirect_arg(mode) when is_atom(mode), do: to_string(mode)
+
+  # fds are passed to the spawner over the socket, in the order of the
+  # streams
+  @spec redirect_fds([:pipe | State.stderr_mode()]) :: [non_neg_integer()]
+  def redirect_fds(modes), do: for({:fd, fd} <- modes, do: fd)
+
+  @spec rights([non_neg_integer()]) :: map
+  def rights(fds) do
+    %{level: :socket, type: :rights, data: for(fd <- fds, into: <<>>, do: <<fd::native-32>>)}
+  end
+
   # skip type warning till we change min OTP version to 24.
-  @dialyzer {:nowarn_function, socket_bind: 2}
-  defp socket_bind(sock, path) do
+  def socket_bind(sock, "@" <> name), do: bind_address(sock, <<0, name::binary>>)
+  def socket_bind(sock, path), do: bind_address(sock, path)
+
+  @dialyzer {:nowarn_function, bind_address: 2}
+  defp bind_address(sock, path) do
     case :socket.bind(sock, %{family: :local, path: path}) do
       :ok -> :ok
       # for compatibility with OTP version < 24
@@ -115,12 +344,77 @@ defmodule Exile.Process.Exec do
     end
   end
 
+  # On Linux the handshake uses an abstract socket address, written as
+  # `"@name"` for the spawner, so nothing is created in the filesystem.
+  # Such an address has no permissions, see `accept_spawner/2`.
+  # Otherwise it is a socket file in the tmp dir
   @spec socket_path() :: String.t()
-  defp socket_path do
-    str = :crypto.strong_rand_bytes(16) |> Base.url_encode64() |> binary_part(0, 16)
-    path = Path.join(System.tmp_dir!(), str)
-    _ = :file.delete(path)
-    path
+  def socket_path do
+    str = random_name()
+
+    if abstract_socket?() do
+      "@exile-" <> str
+    else
+      path = Path.join(System.tmp_dir!(), str)
+      _ = :file.delete(path)
+      path
+    end
+  end
+
+  # socket file to remove once the handshake is done, if any
+  @spec socket_file(String.t()) :: String.t() | nil
+  def socket_file("@" <> _name), do: nil
+  def socket_file(path), do: path
+
+  @spec remove_socket_file(String.t()) :: :ok
+  def remove_socket_file(socket_path) do
+    if path = socket_file(socket_path) do
+      File.rm!(path)
+    end
+
+    :ok
+  end
+
+  defp random_name do
+    :crypto.strong_rand_bytes(16) |> Base.url_encode64() |> binary_part(0, 16)
+  end
+
+  # `:socket` accepts abstract addresses (path starting with a NUL byte)
+  # only from OTP 24, older versions might bind a different address. So
+  # the bound address is checked once and the result is cached
+  @spec abstract_socket?() :: boolean()
+  defp abstract_socket? do
+    case :persistent_term.get({__MODULE__, :abstract_socket}, nil) do
+      nil ->
+        supported = probe_abstract_socket()
+        :persistent_term.put({__MODULE__, :abstract_socket}, supported)
+        supported
+
+      supported ->
+        supported
+    end
+  end
+
+  defp probe_abstract_socket do
+    if :os.type() == {:unix, :linux} do
+      path = <<0, "exile-probe-", random_name()::binary>>
+      {:ok, sock} = :socket.open(:local, :stream, :default)
+
+      try do
+        with :ok <- bind_address(sock, path),
+             {:ok, %{path: ^path}} <- :socket.sockname(sock) do
+          true
+        else
+          _ -> false
+        end
+      catch
+        _kind, _reason -> false
+      after
+        :socket.close(sock)
+      end
+    else
+      false
+    end
   end
 
   @spec prune_nils(keyword()) :: keyword()
@@ -128,11 +422,39 @@ defmodule Exile.Process.Exec do
     Enum.reject(kv, fn {_, v} -> is_nil(v) end)
   end
 
-  @spec normalize_cmd(nonempty_list()) :: {:ok, nonempty_list()} | {:error, binary()}
-  defp normalize_cmd(arg) do
+  @spec normalize_cmd_with_args(nonempty_list(), %{String.t() => charlist}) ::
+          {:ok, nonempty_list()} | {:error, String.t()}
+  defp normalize_cmd_with_args(cmd_with_args, resolved) do
+    with {:ok, cmd} <- normalize_cmd(cmd_with_args, resolved),
+         {:ok, args} <- normalize_cmd_args(cmd_with_args) do
+      {:ok, [cmd | args]}
+    end
+  end
+
+  defp normalize_cmd_with_args_list(cmd_with_args_list) do
+    cmd_with_args_list
+    |> Enum.reduce_while({[], %{}}, fn cmd_with_args, {acc, resolved} ->
+      case normalize_cmd_with_args(cmd_with_args, resolved) do
+        {:ok, [path | _] = normalized} ->
+          resolved = Map.put(resolved, hd(cmd_with_args), path)
+          {:cont, {[normalized | acc], resolved}}
+
+        error ->
+          {:halt, error}
+      end
+    end)
+    |> case do
+      {:error, _} = error -> error
+      {cmd_with_args_list, _resolved} -> {:ok, Enum.reverse(cmd_with_args_list)}
+    end
+  end
+
+  @spec normalize_cmd(nonempty_list(), %{String.t() => charlist}) ::
+          {:ok, charlist()} | {:error, binary()}
+  defp normalize_cmd(arg, resolved) do
     case arg do
       [cmd | _] when is_binary(cmd) ->
-        path = System.find_executable(cmd)
+        path = Map.get_lazy(resolved, cmd, fn -> ExecutableCache.find_executable(cmd) end)
 
         if path do
           {:ok, to_charlist(path)}
@@ -192,24 +514,258 @@ defmodule Exile.Process.Exec do
     end
   end
 
-  @spec normalize_stderr(stderr :: :console | :disable | :consume | nil) ::
-          {:ok, :console | :disable | :consume} | {:error, String.t()}
+  @spec normalize_stderr(stderr :: State.stderr_mode() | nil) ::
+          {:ok, State.stderr_mode()} | {:error, String.t()}
   defp normalize_stderr(stderr) do
     case stderr do
       nil ->
         {:ok, :console}
 
-      stderr when stderr in [:console, :disable, :consume] ->
+      stderr when stderr in [:console, :disable, :consume, :redirect_to_stdout] ->
         {:ok, stderr}
 
+      stderr ->
+        case normalize_redirect(stderr) do
+          {:ok, redirect} ->
+            {:ok, redirect}
+
+          :error ->
+            {:error,
+             ":stderr must be one of :console, :disable, :consume, :redirect_to_stdout, " <>
+               "{:file, path}, {:fd, fd}"}
+        end
+    end
+  end
+
+  # see `c_src/exile_ring.h`
+  @ring_min_capacity 4096
+  @ring_max_capacity 1_073_741_824
+
+  @spec normalize_stdio(:stdin | :stdout, :pipe | redirect | ring | nil) ::
+          {:ok, :pipe | redirect | ring} | {:error, String.t()}
+  defp normalize_stdio(name, mode) do
+    case mode do
+      nil ->
+        {:ok, :pipe}
+
+      :pipe ->
+        {:ok, :pipe}
+
+      {:ring, capacity} when name == :stdout ->
+        if is_integer(capacity) and capacity >= @ring_min_capacity and
+             capacity <= @ring_max_capacity and :erlang.band(capacity, capacity - 1) == 0 do
+          {:ok, mode}
+        else
+          {:error,
+           ":stdout ring capacity must be a power of two between " <>
+             "#{@ring_min_capacity} and #{@ring_max_capacity}"}
+        end
+
+      mode ->
+        case normalize_redirect(mode) do
+          {:ok, redirect} -> {:ok, redirect}
+          :error -> {:error, "#{inspect(name)} must be one of :pipe, {:file, path}, {:fd, fd}"}
+        end
+    end
+  end
+
+  # ring carries raw bytes, records would have to be split in the ring
+  @spec validate_ring_framing(:pipe | redirect | ring, framing | nil) ::
+          :ok | {:error, String.t()}
+  defp validate_ring_framing({:ring, _}, framing) when framing != nil,
+    do: {:error, ":framing is not supported with :ring stdout"}
+
+  defp validate_ring_framing(_stdout, _framing), do: :ok
+
+  # stdout pipe of a ring only carries the doorbell
+  @spec validate_ring_stderr(:pipe | redirect | ring, State.stderr_mode()) ::
+          :ok | {:error, String.t()}
+  defp validate_ring_stderr({:ring, _}, :redirect_to_stdout),
+    do: {:error, ":stderr :redirect_to_stdout is not supported with :ring stdout"}
+
+  defp validate_ring_stderr(_stdout, _stderr), do: :ok
+
+  # fds the program gets the ring and the doorbell as
+  @spec ring_env(:pipe | redirect | ring) :: env
+  defp ring_env({:ring, _}), do: [{~c"EXILE_RING_FD", ~c"3"}, {~c"EXILE_RING_DOORBELL_FD", ~c"4"}]
+  defp ring_env(_stdout), do: []
+
+  # file is opened by the spawner, so relative path must be resolved here
+  @spec normalize_redirect(term) :: {:ok, redirect} | :error
+  defp normalize_redirect(redirect) do
+    case redirect do
+      {:file, path} when is_binary(path) ->
+        {:ok, {:file, Path.expand(path)}}
+
+      {:fd, fd} when is_integer(fd) and fd >= 0 ->
+        {:ok, redirect}
+
+      _ ->
+        :error
+    end
+  end
+
+  @spec normalize_pipe_size(pos_integer() | nil) ::
+          {:ok, pos_integer() | nil} | {:error, String.t()}
+  defp normalize_pipe_size(pipe_size) do
+    case pipe_size do
+      nil ->
+        {:ok, nil}
+
+      pipe_size when is_integer(pipe_size) and pipe_size > 0 ->
+        {:ok, pipe_size}
+
+      _ ->
+        {:error, ":pipe_size must be a positive integer"}
+    end
+  end
+
+  @default_max_chunk_size 65_535
+
+  @spec normalize_max_chunk_size(pos_integer() | nil) ::
+          {:ok, pos_integer()} | {:error, String.t()}
+  defp normalize_max_chunk_size(max_chunk_size) do
+    case max_chunk_size do
+      nil ->
+        {:ok, @default_max_chunk_size}
+
+      max_chunk_size when is_integer(max_chunk_size) and max_chunk_size > 0 ->
+        {:ok, max_chunk_size}
+
+      _ ->
+        {:error, ":max_chunk_size must be a positive integer"}
+    end
+  end
+
+  @spec normalize_drain_reads(boolean() | nil) :: {:ok, boolean()} | {:error, String.t()}
+  defp normalize_drain_reads(drain_reads) do
+    case drain_reads do
+      nil ->
+        {:ok, false}
+
+      drain_reads when is_boolean(drain_reads) ->
+        {:ok, drain_reads}
+
+      _ ->
+        {:error, ":drain_reads must be a boolean"}
+    end
+  end
+
+  @spec normalize_framing(term) :: {:ok, framing | nil} | {:error, String.t()}
+  defp normalize_framing(framing) do
+    case framing do
+      nil ->
+        {:ok, nil}
+
+      :lines ->
+        {:ok, {:delimiter, ?\n}}
+
+      {:delimiter, byte} when is_integer(byte) and byte >= 0 and byte <= 255 ->
+        {:ok, framing}
+
+      {:length_prefixed, size} when size in [1, 2, 4] ->
+        {:ok, framing}
+
+      _ ->
+        {:error,
+         ":framing must be one of :lines, {:delimiter, byte}, {:length_prefixed, 1 | 2 | 4}"}
+    end
+  end
+
+  @spec normalize_max_record_size(pos_integer() | :infinity | nil) ::
+          {:ok, pos_integer() | :infinity} | {:error, String.t()}
+  defp normalize_max_record_size(max_record_size) do
+    case max_record_size do
+      nil ->
+        {:ok, :infinity}
+
+      :infinity ->
+        {:ok, :infinity}
+
+      max_record_size when is_integer(max_record_size) and max_record_size > 0 ->
+        {:ok, max_record_size}
+
+      _ ->
+        {:error, ":max_record_size must be a positive integer or :infinity"}
+    end
+  end
+
+  @spec normalize_spawner(:port | :daemon | nil) :: {:ok, :port | :daemon} | {:error, String.t()}
+  defp normalize_spawner(spawner) do
+    case spawner do
+      nil ->
+        {:ok, :port}
+
+      spawner when spawner in [:port, :daemon] ->
+        {:ok, spawner}
+
+      _ ->
+        {:error, ":spawner must be one of :port, :daemon"}
+    end
+  end
+
+  @spec normalize_notify_spawn(boolean() | nil) :: {:ok, boolean()} | {:error, String.t()}
+  defp normalize_notify_spawn(notify_spawn) do
+    case notify_spawn do
+      nil ->
+        {:ok, false}
+
+      notify_spawn when is_boolean(notify_spawn) ->
+        {:ok, notify_spawn}
+
+      _ ->
+        {:error, ":notify_spawn must be a boolean"}
+    end
+  end
+
+  @spec normalize_buffer_pool(boolean() | nil) :: {:ok, boolean()} | {:error, String.t()}
+  defp normalize_buffer_pool(buffer_pool) do
+    case buffer_pool do
+      nil ->
+        {:ok, false}
+
+      buffer_pool when is_boolean(buffer_pool) ->
+        {:ok, buffer_pool}
+
+      _ ->
+        {:error, ":buffer_pool must be a boolean"}
+    end
+  end
+
+  @spec normalize_nif_scheduler(:dirty_io | :normal | nil) ::
+          {:ok, :dirty_io | :normal} | {:error, String.t()}
+  defp normalize_nif_scheduler(nif_scheduler) do
+    case nif_scheduler do
+      nil ->
+        {:ok, :dirty_io}
+
+      nif_scheduler when nif_scheduler in [:dirty_io, :normal] ->
+        {:ok, nif_scheduler}
+
       _ ->
-        {:error, ":stderr must be an atom and one of :console, :disable, :consume"}
+        {:error, ":nif_scheduler must be either :dirty_io or :normal"}
     end
   end
 
   @spec validate_opts_fields(keyword) :: :ok | {:error, String.t()}
   defp validate_opts_fields(opts) do
-    {_, additional_opts} = Keyword.split(opts, [:cd, :env, :stderr])
+    {_, additional_opts} =
+      Keyword.split(opts, [
+        :cd,
+        :env,
+        :stderr,
+        :pipe_size,
+        :max_chunk_size,
+        :drain_reads,
+        :framing,
+        :max_record_size,
+        :stdin,
+        :stdout,
+        :spawner,
+        :notify_spawn,
+        :buffer_pool,
+        :nif_scheduler
+      ])
 
     if Enum.empty?(additional_opts) do
       :ok
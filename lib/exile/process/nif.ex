@@ -9,13 +9,89 @@ defmodule Exile.Process.Nif do
 
   def nif_is_os_pid_alive(_os_pid), do: :erlang.nif_error(:nif_library_not_loaded)
 
+  def nif_verify_peer(_fd, _os_pid), do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_watch_process_exit(_os_pid), do: :erlang.nif_error(:nif_library_not_loaded)
+
   def nif_kill(_os_pid, _signal), do: :erlang.nif_error(:nif_library_not_loaded)
 
   def nif_read(_fd, _max_size), do: :erlang.nif_error(:nif_library_not_loaded)
 
-  def nif_create_fd(_fd), do: :erlang.nif_error(:nif_library_not_loaded)
+  def nif_read_normal(_fd, _max_size), do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_read_drain(_fd, _max_size), do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_read_drain_normal(_fd, _max_size), do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_read_any(_process, _max_size, _drain), do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_read_any_normal(_process, _max_size, _drain),
+    do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_read_all(_fd, _max_size), do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_read_all_normal(_fd, _max_size), do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_create_process(_os_pid, _stdin_fd, _stdout_fd, _stderr_fd, _consume_stderr),
+    do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_dup_fd(_fd), do: :erlang.nif_error(:nif_library_not_loaded)
 
   def nif_close(_fd), do: :erlang.nif_error(:nif_library_not_loaded)
 
+  def nif_set_pipe_size(_fd, _size), do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_set_framing(_fd, _framing, _max_record_size),
+    do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_attach_ring(_process, _ring_fd, _doorbell_fd),
+    do: :erlang.nif_error(:nif_library_not_loaded)
+
   def nif_write(_fd, _bin), do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_write_normal(_fd, _bin), do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_write_iov(_fd, _iovec), do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_write_iov_normal(_fd, _iovec), do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_splice(_src_fd, _dst_fd), do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_splice_normal(_src_fd, _dst_fd), do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_fd_stats(_fd), do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_enable_buffer_pool(_process), do: :erlang.nif_error(:nif_library_not_loaded)
+
+  def nif_buffer_pool_stats(_fd), do: :erlang.nif_error(:nif_library_not_loaded)
+
+  # IO functions are registered for both dirty IO and normal schedulers,
+  # the variant is chosen by the `nif_scheduler` option of the process
+  @type scheduler :: :dirty_io | :normal
+
+  @spec read(term, integer, scheduler) :: term
+  def read(fd, max_size, :dirty_io), do: nif_read(fd, max_size)
+  def read(fd, max_size, :normal), do: nif_read_normal(fd, max_size)
+
+  @spec read_drain(term, integer, scheduler) :: term
+  def read_drain(fd, max_size, :dirty_io), do: nif_read_drain(fd, max_size)
+  def read_drain(fd, max_size, :normal), do: nif_read_drain_normal(fd, max_size)
+
+  @spec read_any(reference, integer, boolean, scheduler) :: term
+  def read_any(process, max_size, drain, :dirty_io), do: nif_read_any(process, max_size, drain)
+
+  def read_any(process, max_size, drain, :normal),
+    do: nif_read_any_normal(process, max_size, drain)
+
+  @spec read_all(term, non_neg_integer, scheduler) :: term
+  def read_all(fd, max_size, :dirty_io), do: nif_read_all(fd, max_size)
+  def read_all(fd, max_size, :normal), do: nif_read_all_normal(fd, max_size)
+
+  @spec write_iov(term, [binary], scheduler) :: term
+  def write_iov(fd, iovec, :dirty_io), do: nif_write_iov(fd, iovec)
+  def write_iov(fd, iovec, :normal), do: nif_write_iov_normal(fd, iovec)
+
+  @spec splice(term, term, scheduler) :: term
+  def splice(src_fd, dst_fd, :dirty_io), do: nif_splice(src_fd, dst_fd)
+  def splice(src_fd, dst_fd, :normal), do: nif_splice_normal(src_fd, dst_fd)
 end
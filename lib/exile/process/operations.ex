@@ -17,7 +17,7 @@ defmodule Exile.Process.Operations do
   def new, do: %__MODULE__{}
 
   @type write_operation ::
-          {:write_stdin, GenServer.from(), binary}
+          {:write_stdin, GenServer.from(), [binary]}
 
   @type read_operation ::
           {:read_stdout, GenServer.from(), non_neg_integer()}
@@ -56,7 +56,7 @@ defmodule Exile.Process.Operations do
   @spec read_any(State.t(), read_any_operation()) ::
           :eof
           | {:noreply, State.t()}
-          | {:ok, {:stdout | :stderr, binary}}
+          | {:ok, {:stdout | :stderr, iodata}}
           | {:error, term}
   def read_any(state, {:read_stdout_or_stderr, _from, _size} = operation) do
     with {:ok, {_name, {caller, _}, arg}} <- validate_read_any_operation(operation),
@@ -74,7 +74,7 @@ defmodule Exile.Process.Operations do
   @spec read(State.t(), read_operation()) ::
           :eof
           | {:noreply, State.t()}
-          | {:ok, binary}
+          | {:ok, iodata}
           | {:error, term}
   def read(state, operation) do
     with {:ok, {_name, {caller, _}, arg}} <- validate_read_operation(operation),
@@ -91,15 +91,17 @@ defmodule Exile.Process.Operations do
           | {:error, :epipe}
           | {:error, term}
   def write(state, operation) do
-    with {:ok, {_name, {caller, _}, bin}} <- validate_write_operation(operation),
+    with {:ok, {name, {caller, _} = from, iovec}} <- validate_write_operation(operation),
          pipe_name <- pipe_name(operation),
          {:ok, pipe} <- State.pipe(state, pipe_name) do
-      case Pipe.write(pipe, bin, caller) do
-        {:ok, size} ->
-          handle_successful_write(state, size, operation)
+      case Pipe.write(pipe, iovec, caller) do
+        :ok ->
+          :ok
 
         {:error, :eagain} ->
-          case State.put_operation(state, operation) do
+          # unwritten data is retained by the NIF, so pending operation
+          # only has to flush it once the pipe is ready
+          case State.put_operation(state, {name, from, []}) do
             {:ok, new_state} ->
               {:noreply, new_state}
 
@@ -139,29 +141,22 @@ defmodule Exile.Process.Operations do
     end
   end
 
-  @spec handle_successful_write(State.t(), non_neg_integer(), write_operation()) ::
-          :ok | {:noreply, State.t()} | {:error, term}
-  defp handle_successful_write(state, written_size, {name, from, bin}) do
-    bin_size = byte_size(bin)
-
-    # check if it is partial write
-    if written_size < bin_size do
-      new_bin = binary_part(bin, written_size, bin_size - written_size)
-
-      case State.put_operation(state, {name, from, new_bin}) do
-        {:ok, new_state} ->
-          {:noreply, new_state}
-
-        error ->
-          error
-      end
+  @spec do_read_any(pid, non_neg_integer(), Pipe.t(), Pipe.t()) ::
+          :eof | {:ok, {Pipe.name(), iodata}} | {:error, term}
+  defp do_read_any(
+         caller,
+         size,
+         %Pipe{status: :open, owner: caller} = primary,
+         %Pipe{status: :open, owner: caller} = secondary
+       ) do
+    if primary.name == :stdout do
+      Pipe.read_any(primary, secondary, size)
     else
-      :ok
+      Pipe.read_any(secondary, primary, size)
     end
   end
 
-  @spec do_read_any(pid, non_neg_integer(), Pipe.t(), Pipe.t()) ::
-          :eof | {:ok, {Pipe.name(), binary}} | {:error, term}
+  # only one of the pipes can be read by the caller
   defp do_read_any(caller, size, primary, secondary) do
     case Pipe.read(primary, size, caller) do
       ret1 when ret1 in [:eof, {:error, :eagain}, {:error, :pipe_closed_or_invalid_caller}] ->
@@ -218,7 +213,7 @@ defmodule Exile.Process.Operations do
           {:ok, write_operation()} | {:error, :invalid_operation}
   defp validate_write_operation(operation) do
     case operation do
-      {:write_stdin, _from, bin} when is_binary(bin) ->
+      {:write_stdin, _from, iovec} when is_list(iovec) ->
         {:ok, operation}
 
       _ ->
@@ -5,25 +5,48 @@ defmodule Exile.Process.Pipe do
 
   @type name :: Exile.Process.pipe_name()
 
-  @type fd :: non_neg_integer()
+  # `{process_resource, name}` for the stdio pipes of a process, see
+  # `Exile.Process.Exec`
+  @type fd :: {reference(), name} | reference()
 
   @type t :: %__MODULE__{
           name: name,
-          fd: pos_integer() | nil,
+          fd: fd | nil,
           monitor_ref: reference() | nil,
           owner: pid | nil,
-          status: :open | :closed
+          status: :open | :closed,
+          drain_reads: boolean(),
+          scheduler: Nif.scheduler()
         }
 
-  defstruct [:name, :fd, :monitor_ref, :owner, status: :init]
+  defstruct [
+    :name,
+    :fd,
+    :monitor_ref,
+    :owner,
+    status: :init,
+    drain_reads: false,
+    scheduler: :dirty_io
+  ]
 
   alias __MODULE__
 
-  @spec new(name, pos_integer, pid) :: t
-  def new(name, fd, owner) do
+  @spec new(name, fd, pid, keyword) :: t
+  def new(name, fd, owner, opts \\ []) do
     if name in [:stdin, :stdout, :stderr] do
       ref = Process.monitor(owner)
-      %Pipe{name: name, fd: fd, status: :open, owner: owner, monitor_ref: ref}
+      drain_reads = Keyword.get(opts, :drain_reads, false)
+      scheduler = Keyword.get(opts, :scheduler, :dirty_io)
+
+      %Pipe{
+        name: name,
+        fd: fd,
+        status: :open,
+        owner: owner,
+        monitor_ref: ref,
+        drain_reads: drain_reads,
+        scheduler: scheduler
+      }
     else
       raise "invalid pipe name"
     end
@@ -41,12 +64,12 @@ defmodule Exile.Process.Pipe do
   @spec open?(t) :: boolean()
   def open?(pipe), do: pipe.status == :open
 
-  @spec read(t, non_neg_integer, pid) :: :eof | {:ok, binary} | {:error, :eagain} | {:error, term}
+  @spec read(t, non_neg_integer, pid) :: :eof | {:ok, iodata} | {:error, :eagain} | {:error, term}
   def read(pipe, size, caller) do
     if caller != pipe.owner do
       {:error, :pipe_closed_or_invalid_caller}
     else
-      case Nif.nif_read(pipe.fd, size) do
+      case nif_read(pipe, size) do
         # normalize return value
         {:ok, <<>>} -> :eof
         ret -> ret
@@ -54,12 +77,34 @@ defmodule Exile.Process.Pipe do
     end
   end
 
-  @spec write(t, binary, pid) :: {:ok, size :: non_neg_integer()} | {:error, term}
-  def write(pipe, bin, caller) do
+  # Polls both stdout and stderr in a single NIF call. When both are
+  # ready they are served in round-robin by the NIF, and when neither is
+  # ready select is armed for both.
+  @spec read_any(t, t, non_neg_integer) ::
+          :eof | {:ok, {name, iodata}} | {:error, :eagain} | {:error, term}
+  def read_any(%Pipe{fd: {process, :stdout}} = stdout, %Pipe{fd: {process, :stderr}}, size) do
+    case Nif.read_any(process, size, stdout.drain_reads, stdout.scheduler) do
+      # normalize return value
+      {:ok, <<>>} -> :eof
+      ret -> ret
+    end
+  end
+
+  # draining read returns list of binaries when it reads more than once
+  defp nif_read(%Pipe{drain_reads: true} = pipe, size),
+    do: Nif.read_drain(pipe.fd, size, pipe.scheduler)
+
+  defp nif_read(pipe, size), do: Nif.read(pipe.fd, size, pipe.scheduler)
+
+  # When the pipe is full the unwritten data is kept by the NIF resource
+  # and `{:error, :eagain}` is returned. Call again with `[]` to write
+  # the pending data.
+  @spec write(t, [binary], pid) :: :ok | {:error, :eagain} | {:error, term}
+  def write(pipe, iovec, caller) do
     if caller != pipe.owner do
       {:error, :pipe_closed_or_invalid_caller}
     else
-      Nif.nif_write(pipe.fd, bin)
+      Nif.write_iov(pipe.fd, iovec, pipe.scheduler)
     end
   end
 
@@ -9,7 +9,7 @@ defmodule Exile.Process.State do
 
   @type read_mode :: :stdout | :stderr | :stdout_or_stderr
 
-  @type stderr_mode :: :console | :disable | :consume
+  @type stderr_mode :: :console | :disable | :consume | :redirect_to_stdout | Exec.redirect()
 
   @type pipes :: %{
           stdin: Pipe.t(),
@@ -26,7 +26,9 @@ defmodule Exile.Process.State do
   @type t :: %__MODULE__{
           args: Exec.args(),
           owner: pid,
-          port: port(),
+          port: port() | nil,
+          os_pid: pos_integer() | nil,
+          start_time: integer() | nil,
           pipes: pipes,
           status: status,
           stderr: stderr_mode,
@@ -39,6 +41,8 @@ defmodule Exile.Process.State do
     :args,
     :owner,
     :port,
+    :os_pid,
+    :start_time,
     :pipes,
     :status,
     :stderr,
@@ -0,0 +1,162 @@
+defmodule Exile.Run do
+  @moduledoc false
+
+  # Implementation of `Exile.run/2`.
+  #
+  # Output is accumulated by the NIF in a binary attached to the pipe
+  # resource (`nif_read_all/2`) and returned once at EOF, so there is
+  # no message or binary per chunk. Reads are done by the caller using
+  # direct pipes, `Exile.Process` server is only involved for start and
+  # exit. Input is written by a separate task, so that a program which
+  # writes before consuming all of its input does not deadlock.
+
+  alias Exile.Process
+  alias Exile.Process.DirectPipe
+  alias Exile.Process.Error
+
+  # largest value accepted by the NIF
+  @unlimited 0xFFFF_FFFF_FFFF_FFFF
+
+  @run_opts [:input, :max_output_size, :exit_timeout]
+
+  @spec run(nonempty_list(String.t()), keyword()) :: {binary, binary, non_neg_integer()}
+  def run(cmd_with_args, opts) do
+    {run_opts, process_opts} = Keyword.split(opts, @run_opts)
+    process_opts = Keyword.put_new(process_opts, :stderr, :consume)
+
+    opts =
+      with {:ok, input} <- normalize_input(run_opts[:input]),
+           {:ok, max_output_size} <- normalize_max_output_size(run_opts[:max_output_size]),
+           {:ok, exit_timeout} <- normalize_exit_timeout(run_opts[:exit_timeout]),
+           :ok <- validate_process_opts(process_opts) do
+        %{input: input, max_output_size: max_output_size, exit_timeout: exit_timeout}
+      end
+
+    case opts do
+      {:error, error} ->
+        raise ArgumentError, message: error
+
+      opts ->
+        start_and_collect(cmd_with_args, process_opts, opts)
+    end
+  end
+
+  defp start_and_collect(cmd_with_args, process_opts, opts) do
+    process =
+      case Process.start_link(cmd_with_args, process_opts) do
+        {:ok, process} -> process
+        {:error, error} -> raise ArgumentError, message: to_string(error)
+      end
+
+    writer = start_writer(process, opts.input)
+    consume_stderr = process_opts[:stderr] == :consume
+
+    output =
+      with {:ok, stdout} <- Process.direct_pipe(process, :stdout),
+           {:ok, pipes} <- stderr_pipe(process, stdout, consume_stderr) do
+        DirectPipe.read_all(pipes, opts.max_output_size)
+      end
+
+    :ok = await_writer(writer)
+    exit_result = Process.await_exit(process, opts.exit_timeout)
+
+    case {output, exit_result} do
+      {{:ok, [stdout]}, {:ok, exit_status}} ->
+        {stdout, "", exit_status}
+
+      {{:ok, [stdout, stderr]}, {:ok, exit_status}} ->
+        {stdout, stderr, exit_status}
+
+      {{:error, reason}, _} ->
+        raise Error, "failed to read from the external process. error: #{inspect(reason)}"
+
+      {_, {:error, reason}} ->
+        raise Error, "failed to get the exit status. error: #{inspect(reason)}"
+    end
+  end
+
+  defp stderr_pipe(_process, stdout, false), do: {:ok, [stdout]}
+
+  defp stderr_pipe(process, stdout, true) do
+    with {:ok, stderr} <- Process.direct_pipe(process, :stderr) do
+      {:ok, [stdout, stderr]}
+    end
+  end
+
+  defp start_writer(process, nil) do
+    :ok = Process.close_stdin(process)
+    nil
+  end
+
+  defp start_writer(process, input) do
+    Task.async(fn ->
+      :ok = Process.change_pipe_owner(process, :stdin, self())
+
+      with :ok <- Process.write(process, input) do
+        Process.close_stdin(process)
+      end
+    end)
+  end
+
+  # program might exit without reading the input, so epipe is ignored
+  defp await_writer(nil), do: :ok
+
+  defp await_writer(writer) do
+    _ = Task.await(writer, :infinity)
+    :ok
+  end
+
+  defp normalize_input(input) do
+    if is_nil(input) or is_binary(input) or is_list(input) do
+      {:ok, input}
+    else
+      {:error, ":input must be a binary or iodata"}
+    end
+  end
+
+  defp normalize_max_output_size(max_output_size) do
+    case max_output_size do
+      nil ->
+        {:ok, @unlimited}
+
+      :infinity ->
+        {:ok, @unlimited}
+
+      size when is_integer(size) and size >= 0 ->
+        {:ok, min(size, @unlimited)}
+
+      _ ->
+        {:error, ":max_output_size must be :infinity or a non-negative integer"}
+    end
+  end
+
+  defp normalize_exit_timeout(timeout) do
+    case timeout do
+      nil ->
+        {:ok, 5000}
+
+      :infinity ->
+        {:ok, :infinity}
+
+      timeout when is_integer(timeout) and timeout > 0 ->
+        {:ok, timeout}
+
+      _ ->
+        {:error, ":exit_timeout must be either :infinity or an integer"}
+    end
+  end
+
+  # output is read as raw bytes
+  defp validate_process_opts(process_opts) do
+    cond do
+      process_opts[:framing] != nil ->
+        {:error, ":framing is not supported by Exile.run/2"}
+
+      match?({:ring, _}, process_opts[:stdout]) ->
+        {:error, ":ring stdout is not supported by Exile.run/2"}
+
+      true ->
+        :ok
+    end
+  end
+end
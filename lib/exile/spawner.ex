@@ -0,0 +1,232 @@
+defmodule Exile.Spawner do
+  @moduledoc false
+
+  # Owns the long-lived spawner daemon (`spawner --daemon`).
+  #
+  # Starting a command with a Port involves creating a socket, starting
+  # the spawner using a Port and waiting for the fds for every command.
+  # Daemon keeps a single persistent socket connection instead, and
+  # spawns commands on request. Daemon is started lazily on the first
+  # request.
+  #
+  # Exit of a command is sent to the process which requested the spawn
+  # as `{Exile.Spawner, :exit, os_pid, {:ok, exit_status} | {:error, reason}}`
+
+  use GenServer
+
+  require Logger
+
+  alias Exile.Process.Exec
+  alias Exile.Process.State
+
+  # see `daemon_reply_t` in `c_src/spawner.c`
+  @reply_size 16
+  @ctrl_size 64
+
+  @spawned ?S
+  @error ?E
+  @exit ?X
+
+  def start_link(args) do
+    GenServer.start_link(__MODULE__, args, name: __MODULE__)
+  end
+
+  @spec spawn_command(Exec.args(), State.stderr_mode()) ::
+          {:ok, pos_integer(), Exec.fds()} | {:error, term}
+  def spawn_command(args, stderr) do
+    # request is encoded in the caller to keep the server light
+    fds = Exec.redirect_fds([args.stdin, args.stdout, stderr])
+    GenServer.call(__MODULE__, {:spawn, encode_request(args, stderr), fds}, :infinity)
+  end
+
+  @impl true
+  def init(_args) do
+    Process.flag(:trap_exit, true)
+
+    {:ok,
+     %{
+       port: nil,
+       sock: nil,
+       reader: nil,
+       next_id: 0,
+       requests: %{},
+       commands: %{}
+     }}
+  end
+
+  @impl true
+  def handle_call({:spawn, request, fds}, from, state) do
+    id = state.next_id
+
+    with {:ok, state} <- ensure_daemon(state),
+         :ok <- send_request(state.sock, frame(id, request), fds) do
+      requests = Map.put(state.requests, id, from)
+      {:noreply, %{state | next_id: next_id(id), requests: requests}}
+    else
+      {:error, reason} ->
+        {:reply, {:error, reason}, state}
+    end
+  end
+
+  @impl true
+  def handle_info({:daemon_reply, reply}, state) do
+    {:noreply, handle_reply(reply, state)}
+  end
+
+  def handle_info({:EXIT, pid, reason}, %{port: port, reader: reader} = state)
+      when pid in [port, reader] do
+    Logger.debug(fn -> "Spawner daemon exited. reason: #{inspect(reason)}" end)
+    {:noreply, daemon_down(state, {:spawner_exit, reason})}
+  end
+
+  def handle_info(_msg, state) do
+    # exit status of the daemon port and exit of the previous daemon
+    {:noreply, state}
+  end
+
+  @impl true
+  def terminate(reason, state) do
+    daemon_down(state, {:spawner_exit, reason})
+  end
+
+  defp handle_reply({@spawned, id, os_pid, fds}, state) do
+    {{pid, _} = from, requests} = Map.pop(state.requests, id)
+    GenServer.reply(from, {:ok, os_pid, fds})
+    %{state | requests: requests, commands: Map.put(state.commands, os_pid, pid)}
+  end
+
+  defp handle_reply({@error, id, errno, _fds}, state) do
+    {from, requests} = Map.pop(state.requests, id)
+    GenServer.reply(from, {:error, errno})
+    %{state | requests: requests}
+  end
+
+  defp handle_reply({@exit, os_pid, exit_status, _fds}, state) do
+    case Map.pop(state.commands, os_pid) do
+      {nil, _commands} ->
+        state
+
+      {pid, commands} ->
+        send(pid, {__MODULE__, :exit, os_pid, {:ok, exit_status}})
+        %{state | commands: commands}
+    end
+  end
+
+  # commands are terminated by the daemon when the connection is closed
+  defp daemon_down(%{port: nil} = state, _reason), do: state
+
+  defp daemon_down(state, reason) do
+    :socket.close(state.sock)
+
+    if Port.info(state.port) do
+      Port.close(state.port)
+    end
+
+    Enum.each(state.requests, fn {_id, from} -> GenServer.reply(from, {:error, reason}) end)
+
+    Enum.each(state.commands, fn {os_pid, pid} ->
+      send(pid, {__MODULE__, :exit, os_pid, {:error, reason}})
+    end)
+
+    %{state | port: nil, sock: nil, reader: nil, requests: %{}, commands: %{}}
+  end
+
+  defp ensure_daemon(%{port: nil} = state) do
+    with {:ok, port, sock} <- start_daemon() do
+      server = self()
+      reader = spawn_link(fn -> recv_loop(sock, server) end)
+      {:ok, %{state | port: port, sock: sock, reader: reader}}
+    end
+  end
+
+  defp ensure_daemon(state), do: {:ok, state}
+
+  defp start_daemon do
+    socket_path = Exec.socket_path()
+    {:ok, lsock} = :socket.open(:local, :stream, :default)
+
+    try do
+      :ok = Exec.socket_bind(lsock, socket_path)
+      :ok = :socket.listen(lsock)
+
+      port_opts = [:nouse_stdio, :exit_status, :binary, args: ["--daemon", socket_path]]
+      port = Port.open({:spawn_executable, Exec.spawner_path()}, port_opts)
+      {:os_pid, os_pid} = Port.info(port, :os_pid)
+
+      # every later spawn request goes over this connection
+      case Exec.accept_spawner(lsock, os_pid) do
+        {:ok, sock} ->
+          {:ok, port, sock}
+
+        {:error, reason} ->
+          if Port.info(port), do: Port.close(port)
+          {:error, reason}
+      end
+    after
+      :socket.close(lsock)
+      Exec.remove_socket_file(socket_path)
+    end
+  end
+
+  # replies are of fixed size, so that each recvmsg reads exactly one
+  # reply along with its fds
+  defp recv_loop(sock, server) do
+    case :socket.recvmsg(sock, @reply_size, @ctrl_size, [], :infinity) do
+      {:ok, msg} ->
+        send(server, {:daemon_reply, decode_reply(msg)})
+        recv_loop(sock, server)
+
+      {:error, reason} ->
+        exit({:shutdown, reason})
+    end
+  end
+
+  defp decode_reply(%{iov: iov} = msg) do
+    <<tag::native-32, id::native-signed-32, value::native-signed-32, _::native-32>> =
+      IO.iodata_to_binary(iov)
+
+    fds =
+      case msg do
+        %{ctrl: [%{data: data, level: :socket, type: :rights}]} ->
+          Exec.decode_fds(data)
+
+        _ ->
+          nil
+      end
+
+    {tag, id, value, fds}
+  end
+
+  # redirect fds are sent along with the request
+  defp send_request(sock, frame, []), do: :socket.send(sock, frame)
+  defp send_request(sock, frame, fds) do
+    :socket.sendmsg(sock, %{iov: frame, ctrl: [Exec.rights(fds)]})
+  end
+
+  defp frame(id, request) do
+    [<<byte_size(request) + 4::native-32, id::native-32>>, request]
+  end
+
+  # request id is an unsigned 32-bit integer in the daemon
+  defp next_id(id), do: rem(id + 1, 0x1_0000_0000)
+
+  # daemon environment is fixed at start, so we send the complete env
+  # including the changes to the VM env, same as a Port
+  @spec encode_request(Exec.args(), State.stderr_mode()) :: binary
+  defp encode_request(args, stderr) do
+    %{cmd_with_args: cmd_with_args, cd: cd, env: env, stdin: stdin, stdout: stdout} = args
+
+    env =
+      System.get_env()
+      |> Map.merge(Map.new(env, fn {key, value} -> {to_string(key), to_string(value)} end))
+      |> Enum.map(fn {key, value} -> [key, ?=, value] end)
+
+    modes = Enum.map([stdin, stdout, stderr], &Exec.redirect_arg/1)
+    strings = modes ++ [cd | cmd_with_args] ++ env
+
+    IO.iodata_to_binary([
+      <<length(cmd_with_args)::native-32, length(env)::native-32>>
+      | Enum.map(strings, &[:unicode.characters_to_binary(&1), 0])
+    ])
+  end
+end
@@ -5,6 +5,7 @@ defmodule Exile.Stream do
 
   alias Exile.Process
   alias Exile.Process.Error
+  alias Exile.Telemetry
 
   require Logger
 
@@ -26,32 +27,140 @@ defmodule Exile.Stream do
   defmodule Sink do
     @moduledoc false
 
-    @type t :: %__MODULE__{process: Process.t(), ignore_epipe: boolean}
+    # Collectable for the program input. Input is written directly to
+    # the pipe from the collecting process, bypassing the server.
+    #
+    # When the pipe is ready, elements are written as they arrive. When
+    # the pipe is full the unwritten data is kept by the NIF, and the
+    # following elements are coalesced into a single vectored write,
+    # which is issued once the pipe is ready again. Collecting blocks
+    # only when the buffered data reaches `buffer_size`.
+
+    alias Exile.Process.DirectPipe
+    alias Exile.Process.Pipe
+
+    @type t :: %__MODULE__{
+            process: Process.t(),
+            ignore_epipe: boolean,
+            buffer_size: pos_integer
+          }
+
+    defstruct [:process, :ignore_epipe, :buffer_size]
+
+    @type writer :: %{
+            pipe: DirectPipe.t(),
+            buffer_size: pos_integer,
+            buffer: iodata,
+            size: non_neg_integer,
+            pending: boolean
+          }
 
-    defstruct [:process, :ignore_epipe]
+    @doc false
+    @spec writer(t) :: writer
+    def writer(%__MODULE__{process: process, buffer_size: buffer_size}) do
+      case Process.direct_pipe(process, :stdin) do
+        {:ok, pipe} ->
+          %{pipe: pipe, buffer_size: buffer_size, buffer: [], size: 0, pending: false}
+
+        {:error, _} ->
+          raise Error, "epipe"
+      end
+    end
+
+    @doc false
+    @spec write(writer, iodata) :: writer
+    def write(writer, data) do
+      size = writer.size + IO.iodata_length(data)
+      writer = %{writer | buffer: [writer.buffer | data], size: size}
+
+      # flush the data retained by the NIF if the pipe is ready
+      writer =
+        if writer.pending && ready?(writer) do
+          nif_write(writer, [])
+        else
+          writer
+        end
+
+      cond do
+        not writer.pending ->
+          write_buffer(writer)
+
+        writer.size >= writer.buffer_size ->
+          writer |> await_ready() |> write_buffer()
+
+        true ->
+          writer
+      end
+    end
+
+    @doc false
+    @spec flush(writer) :: :ok
+    def flush(writer) do
+      %{pending: false} = writer |> await_ready() |> write_buffer() |> await_ready()
+      :ok
+    end
+
+    # pipe is selected for output after a partial write, check if we
+    # already got the notification without blocking
+    defp ready?(%{pipe: %DirectPipe{pipe: %Pipe{fd: fd}}}) do
+      receive do
+        {:select, ^fd, _ref, :ready_output} -> true
+      after
+        0 -> false
+      end
+    end
+
+    defp await_ready(%{pending: false} = writer), do: writer
+
+    defp await_ready(writer) do
+      case DirectPipe.await_select(writer.pipe, :ready_output) do
+        :ok ->
+          # flush the data retained by the NIF
+          writer |> nif_write([]) |> await_ready()
+
+        {:error, _} ->
+          raise Error, "epipe"
+      end
+    end
+
+    defp write_buffer(%{size: 0} = writer), do: writer
+
+    defp write_buffer(writer) do
+      nif_write(%{writer | buffer: [], size: 0}, :erlang.iolist_to_iovec(writer.buffer))
+    end
+
+    defp nif_write(writer, iovec) do
+      case Pipe.write(writer.pipe.pipe, iovec, self()) do
+        :ok ->
+          %{writer | pending: false}
+
+        {:error, :eagain} ->
+          %{writer | pending: true}
+
+        {:error, :epipe} ->
+          # there is no other way to stop a Collectable than to
+          # raise error, we catch this error and return `{:error, :epipe}`
+          raise Error, "epipe"
+
+        {:error, reason} ->
+          raise Error, "failed to write to the external process. error: #{inspect(reason)}"
+      end
+    end
 
     defimpl Collectable do
-      def into(%{process: process}) do
+      def into(sink) do
         collector_fun = fn
-          :ok, {:cont, x} ->
-            case Process.write(process, x) do
-              {:error, :epipe} ->
-                # there is no other way to stop a Collectable than to
-                # raise error, we catch this error and return `{:error, :epipe}`
-                raise Error, "epipe"
-
-              :ok ->
-                :ok
-            end
+          writer, {:cont, x} ->
+            @for.write(writer, x)
 
-          acc, :done ->
-            acc
+          writer, :done ->
+            @for.flush(writer)
 
-          acc, :halt ->
-            acc
+          _writer, :halt ->
+            :ok
         end
 
-        {:ok, collector_fun}
+        {@for.writer(sink), collector_fun}
       end
     end
   end
@@ -71,7 +180,8 @@ defmodule Exile.Stream do
     :input,
     :stderr,
     :ignore_epipe,
-    :stream_exit_status
+    :stream_exit_status,
+    :input_buffer_size
   ]
 
   @doc false
@@ -100,6 +210,9 @@ defmodule Exile.Stream do
         {state, :running}
       end
 
+      # stdout is already split into records by the NIF
+      framed = arg.process_opts[:framing] != nil
+
       next_fun = fn
         {state, :exited} ->
           {:halt, {state, :exited}}
@@ -122,6 +235,13 @@ defmodule Exile.Stream do
               elem = [await_exit(state, :eof)]
               {elem, {state, :exited}}
 
+            {:ok, {:stdout, records}} when framed and stderr != :consume ->
+              {records, {state, exit_state}}
+
+            {:ok, {:stdout, records}} when framed ->
+              elem = Enum.map(records, &{:stdout, &1})
+              {elem, {state, exit_state}}
+
             {:ok, {:stdout, x}} when stderr != :consume ->
               elem = [IO.iodata_to_binary(x)]
               {elem, {state, exit_state}}
@@ -136,11 +256,14 @@ defmodule Exile.Stream do
       end
 
       after_fun = fn
-        {_state, :exited} ->
-          :ok
+        {state, :exited} ->
+          stream_stop(state)
 
         {state, exit_state} ->
-          case await_exit(state, exit_state) do
+          result = await_exit(state, exit_state)
+          stream_stop(state)
+
+          case result do
             {:exit, {:status, 0}} ->
               :ok
 
@@ -173,11 +296,32 @@ defmodule Exile.Stream do
            cmd_with_args: cmd_with_args
          }) do
       process_opts = Keyword.put(process_opts, :stderr, stream_opts[:stderr])
+
+      {process_opts, input} =
+        case stream_opts.input do
+          {:redirect, redirect} -> {Keyword.put(process_opts, :stdin, redirect), :no_input}
+          input -> {process_opts, input}
+        end
+      metadata = %{cmd: List.first(cmd_with_args)}
+      start_time = Telemetry.start([:exile, :stream], metadata)
       {:ok, process} = Process.start_link(cmd_with_args, process_opts)
-      sink = %Sink{process: process, ignore_epipe: stream_opts[:ignore_epipe]}
-      writer_task = start_input_streamer(sink, stream_opts.input)
+      sink = %Sink{
+        process: process,
+        ignore_epipe: stream_opts[:ignore_epipe],
+        buffer_size: stream_opts[:input_buffer_size]
+      }
+      writer_task = start_input_streamer(sink, input)
+
+      %{
+        process: process,
+        stream_opts: stream_opts,
+        writer_task: writer_task,
+        telemetry: {start_time, metadata}
+      }
+    end
 
-      %{process: process, stream_opts: stream_opts, writer_task: writer_task}
+    defp stream_stop(%{telemetry: {start_time, metadata}}) do
+      Telemetry.stop([:exile, :stream], start_time, metadata)
     end
 
     @doc false
@@ -249,12 +393,20 @@ defmodule Exile.Stream do
   end
 
   @spec normalize_input(term) ::
-          {:ok, :no_input} | {:ok, {:enumerable, term}} | {:ok, {:collectable, function}}
+          {:ok, :no_input}
+          | {:ok, {:enumerable, term}}
+          | {:ok, {:collectable, function}}
+          | {:ok, {:redirect, term}}
   defp normalize_input(term) do
     cond do
       is_nil(term) ->
         {:ok, :no_input}
 
+      # connected to stdin of the program by the spawner, validated by
+      # `Exile.Process`
+      match?({:file, _}, term) or match?({:fd, _}, term) ->
+        {:ok, {:redirect, term}}
+
       !is_function(term, 1) && Enumerable.impl_for(term) ->
         {:ok, {:enumerable, term}}
 
@@ -279,6 +431,19 @@ defmodule Exile.Stream do
     end
   end
 
+  defp normalize_input_buffer_size(input_buffer_size) do
+    case input_buffer_size do
+      nil ->
+        {:ok, 65_536}
+
+      size when is_integer(size) and size > 0 ->
+        {:ok, size}
+
+      _ ->
+        {:error, ":input_buffer_size must be a positive integer"}
+    end
+  end
+
   defp normalize_exit_timeout(timeout) do
     case timeout do
       nil ->
@@ -297,11 +462,17 @@ defmodule Exile.Stream do
       nil ->
         {:ok, :console}
 
-      stderr when stderr in [:console, :disable, :consume] ->
+      stderr when stderr in [:console, :disable, :consume, :redirect_to_stdout] ->
+        {:ok, stderr}
+
+      # validated by `Exile.Process`
+      {kind, _} when kind in [:file, :fd] ->
         {:ok, stderr}
 
       _ ->
-        {:error, ":stderr must be an atom and one of :console, :disable, :consume"}
+        {:error,
+         ":stderr must be one of :console, :disable, :consume, :redirect_to_stdout, " <>
+           "{:file, path}, {:fd, fd}"}
     end
   end
 
@@ -337,9 +508,11 @@ defmodule Exile.Stream do
          {:ok, max_chunk_size} <- normalize_max_chunk_size(opts[:max_chunk_size]),
          {:ok, stderr} <- normalize_stderr(opts[:stderr]),
          {:ok, ignore_epipe} <- normalize_ignore_epipe(opts[:ignore_epipe]),
-         {:ok, stream_exit_status} <- normalize_stream_exit_status(opts[:stream_exit_status]) do
+         {:ok, stream_exit_status} <- normalize_stream_exit_status(opts[:stream_exit_status]),
+         {:ok, input_buffer_size} <- normalize_input_buffer_size(opts[:input_buffer_size]) do
       {:ok,
        %{
+         input_buffer_size: input_buffer_size,
          input: input,
          exit_timeout: exit_timeout,
          max_chunk_size: max_chunk_size,
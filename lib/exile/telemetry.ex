@@ -0,0 +1,119 @@
+defmodule Exile.Telemetry do
+  @moduledoc """
+  [Telemetry](https://hexdocs.pm/telemetry) events emitted by Exile.
+
+  `:telemetry` is an optional dependency. Events are emitted only when
+  it is available, add `{:telemetry, "~> 1.0"}` to your dependencies to
+  receive them. All durations are in `:native` time unit.
+
+  IO is not instrumented per chunk. Instead each pipe keeps counters in
+  the NIF resource, which are reported once when the process stops and
+  can be read any time with `Exile.Process.stats/1`.
+
+  ### Spawn
+
+    * `[:exile, :spawn, :start]`  -  before the external program is spawned.
+      * measurements: `:system_time`, `:monotonic_time`
+      * metadata: `:cmd`, `:spawner`
+
+    * `[:exile, :spawn, :stop]`  -  after the program is spawned and the pipes
+  are set up.
+      * measurements: `:duration`, `:monotonic_time`
+      * metadata: `:cmd`, `:spawner`, `:os_pid`
+
+    * `[:exile, :spawn, :exception]`  -  when spawn fails.
+      * measurements: `:duration`, `:monotonic_time`
+      * metadata: `:cmd`, `:spawner`, `:kind`, `:reason`, `:stacktrace`
+
+  ### Process
+
+    * `[:exile, :process, :stop]`  -  when `Exile.Process` server stops.
+      * measurements: `:duration` (since spawn), `:bytes_read` (stdout and
+  stderr), `:bytes_written` (stdin), `:partial_writes`, `:selects` (number
+  of times an IO operation had to wait for the pipe). Only `:duration`
+  when the spawn failed
+      * metadata: `:cmd`, `:os_pid`, `:status`, `:stats` (per pipe counters,
+  same as `Exile.Process.stats/1`, `nil` when the spawn failed)
+
+  ### Exit
+
+    * `[:exile, :kill, :start]`  -  when the external program is still alive
+  after `Exile.Process` is terminated and the watcher starts killing it.
+      * measurements: `:system_time`, `:monotonic_time`
+      * metadata: `:os_pid`
+
+    * `[:exile, :kill, :stop]`  -  when the external program is gone.
+      * measurements: `:duration`, `:monotonic_time`
+      * metadata: `:os_pid`
+
+  ### Stream
+
+    * `[:exile, :stream, :start]`  -  when `Exile.stream!/2` is started.
+      * measurements: `:system_time`, `:monotonic_time`
+      * metadata: `:cmd`
+
+    * `[:exile, :stream, :stop]`  -  when the stream is completed or halted.
+      * measurements: `:duration`, `:monotonic_time`
+      * metadata: `:cmd`
+  """
+
+  @compile {:no_warn_undefined, :telemetry}
+
+  @enabled_key {__MODULE__, :enabled}
+
+  # `:telemetry` is an optional dependency, so it is started before us
+  # only when it is present. We also start it here, since events must not
+  # be emitted before its handler table exists
+  @doc false
+  @spec setup :: :ok
+  def setup do
+    enabled = match?({:ok, _}, Application.ensure_all_started(:telemetry))
+    :persistent_term.put(@enabled_key, enabled)
+  end
+
+  @doc false
+  @spec execute([atom], map, map) :: :ok
+  def execute(event, measurements, metadata) do
+    if enabled?(), do: :telemetry.execute(event, measurements, metadata)
+    :ok
+  end
+
+  @doc false
+  @spec span([atom], map, (() -> {term, map})) :: term
+  def span(event, metadata, fun) do
+    if enabled?() do
+      :telemetry.span(event, metadata, fun)
+    else
+      {result, _metadata} = fun.()
+      result
+    end
+  end
+
+  @doc false
+  @spec start([atom], map) :: integer
+  def start(event, metadata) do
+    start_time = System.monotonic_time()
+
+    execute(
+      event ++ [:start],
+      %{system_time: System.system_time(), monotonic_time: start_time},
+      metadata
+    )
+
+    start_time
+  end
+
+  @doc false
+  @spec stop([atom], integer, map, map) :: :ok
+  def stop(event, start_time, metadata, measurements \\ %{}) do
+    stop_time = System.monotonic_time()
+
+    execute(
+      event ++ [:stop],
+      Map.merge(%{duration: stop_time - start_time, monotonic_time: stop_time}, measurements),
+      metadata
+    )
+  end
+
+  defp enabled?, do: :persistent_term.get(@enabled_key, false)
+end
@@ -1,82 +1,292 @@
 defmodule Exile.Watcher do
   @moduledoc false
 
-  use GenServer, restart: :temporary
+  # Cleans up the external program when the owning `Exile.Process`
+  # exits.
+  #
+  # Watchers are sharded, one per scheduler, and each watcher tracks
+  # many programs. A program is watched by the shard of the scheduler
+  # which spawned it, so neither spawns nor exits go through a single
+  # process, and a program costs a monitor and a map entry instead of a
+  # process of its own.
+  #
+  # Exit of the program is detected using an exit notification fd
+  # (pidfd on Linux, kqueue on BSD and macOS) which is selected for
+  # input, so the watcher never blocks while waiting. Escalation from
+  # SIGTERM to SIGKILL is driven by timers. On platforms without exit
+  # notification we fall back to checking the pid when timer fires.
+
+  use GenServer
 
   require Logger
   alias Exile.Process.Nif, as: Nif
+  alias Exile.Telemetry
+
+  # time given to the program at each stage before escalating
+  @exit_timeout 50
+  @sigterm_timeout 100
+  @sigkill_timeout 200
+
+  # interval for checking the programs while shutting down
+  @poll_interval 10
+
+  def start_link(shard) do
+    GenServer.start_link(__MODULE__, shard, name: name(shard))
+  end
 
-  def start_link(args) do
-    {:ok, _pid} = GenServer.start_link(__MODULE__, args)
+  def child_spec(shard) do
+    %{id: {__MODULE__, shard}, start: {__MODULE__, :start_link, [shard]}}
   end
 
+  # children of `Exile.WatcherSupervisor`
+  @spec shards :: [Supervisor.child_spec()]
+  def shards do
+    Enum.map(1..shard_count(), &child_spec/1)
+  end
+
+  @spec watch(pid, pos_integer(), String.t() | nil) :: :ok
   def watch(pid, os_pid, socket_path) do
-    spec = {Exile.Watcher, %{pid: pid, os_pid: os_pid, socket_path: socket_path}}
-    DynamicSupervisor.start_child(Exile.WatcherSupervisor, spec)
+    GenServer.call(name(shard()), {:watch, pid, os_pid, socket_path})
+  end
+
+  # number of programs watched by all shards
+  @spec count :: non_neg_integer()
+  def count do
+    Enum.reduce(1..shard_count(), 0, fn shard, acc ->
+      acc + GenServer.call(name(shard), :count)
+    end)
   end
 
   @impl true
-  def init(args) do
-    %{pid: pid, os_pid: os_pid, socket_path: socket_path} = args
+  def init(_shard) do
     Process.flag(:trap_exit, true)
+    {:ok, %{programs: %{}, exit_fds: %{}}}
+  end
+
+  # programs are keyed by the monitor ref, since os pid of an exited
+  # program can be reused by a new program before we get the `:DOWN`
+  @impl true
+  def handle_call({:watch, pid, os_pid, socket_path}, _from, state) do
     ref = Elixir.Process.monitor(pid)
-    {:ok, %{pid: pid, os_pid: os_pid, socket_path: socket_path, ref: ref}}
+
+    program = %{
+      ref: ref,
+      pid: pid,
+      os_pid: os_pid,
+      socket_path: socket_path,
+      exit_fd: nil,
+      timer: nil,
+      kill_start: nil
+    }
+
+    {:reply, :ok, put_program(state, program)}
+  end
+
+  def handle_call(:count, _from, state) do
+    {:reply, map_size(state.programs), state}
   end
 
   @impl true
-  def handle_info({:DOWN, ref, :process, pid, _reason}, %{
-        pid: pid,
-        socket_path: socket_path,
-        os_pid: os_pid,
-        ref: ref
-      }) do
-    _ = File.rm(socket_path)
-    # at max we wait for 50ms for program to exit
-    if process_exit?(os_pid, 50) do
-      :ok
-    else
-      attempt_graceful_exit(os_pid)
+  def handle_info({:DOWN, ref, :process, _pid, _reason}, state) do
+    case Map.fetch(state.programs, ref) do
+      {:ok, program} ->
+        {:noreply, owner_down(state, program)}
+
+      :error ->
+        {:noreply, state}
     end
+  end
+
+  def handle_info({:select, fd, _ref, :ready_input}, state) do
+    case Map.fetch(state.exit_fds, fd) do
+      {:ok, ref} ->
+        Logger.debug(fn -> "External program exited successfully" end)
+        {:noreply, exited(state, Map.fetch!(state.programs, ref))}
 
-    {:stop, :normal, nil}
+      :error ->
+        {:noreply, state}
+    end
   end
 
-  def handle_info({:EXIT, _, reason}, nil), do: {:stop, reason, nil}
+  def handle_info({:escalate, ref, stage}, state) do
+    case Map.fetch(state.programs, ref) do
+      {:ok, program} ->
+        if process_exit?(program.os_pid) do
+          {:noreply, exited(state, program)}
+        else
+          {:noreply, escalate(state, program, stage)}
+        end
+
+      # stale timer
+      :error ->
+        {:noreply, state}
+    end
+  end
 
   # when watcher is attempted to be killed, we forcefully kill external os process.
   # This can happen when beam receive SIGTERM
-  def handle_info({:EXIT, _, reason}, %{pid: pid, socket_path: socket_path, os_pid: os_pid}) do
+  def handle_info({:EXIT, _, reason}, state) do
     Logger.debug(fn -> "Watcher exiting. reason: #{inspect(reason)}" end)
-    File.rm!(socket_path)
-    Elixir.Process.exit(pid, :watcher_exit)
-    attempt_graceful_exit(os_pid)
-    {:stop, reason, nil}
+
+    programs =
+      Enum.map(state.programs, fn {_ref, %{os_pid: os_pid} = program} ->
+        _ = remove_socket(program.socket_path)
+        Elixir.Process.exit(program.pid, :watcher_exit)
+        cancel_timer(program)
+        kill_start = program.kill_start || Telemetry.start([:exile, :kill], %{os_pid: os_pid})
+        %{program | kill_start: kill_start}
+      end)
+
+    attempt_graceful_exit(programs)
+
+    Enum.each(programs, fn program ->
+      Telemetry.stop([:exile, :kill], program.kill_start, %{os_pid: program.os_pid})
+    end)
+
+    {:stop, reason, state}
   end
 
-  defp attempt_graceful_exit(os_pid) do
+  def handle_info(_msg, state), do: {:noreply, state}
+
+  @impl true
+  def terminate(_reason, state) do
+    Enum.each(state.exit_fds, fn {exit_fd, _ref} -> Nif.nif_close(exit_fd) end)
+  end
+
+  defp owner_down(state, program) do
+    _ = remove_socket(program.socket_path)
+
+    if process_exit?(program.os_pid) do
+      forget(state, program)
+    else
+      kill_start = Telemetry.start([:exile, :kill], %{os_pid: program.os_pid})
+      program = %{program | exit_fd: watch_exit(program.os_pid), kill_start: kill_start}
+      state = put_exit_fd(state, program)
+      put_program(state, schedule(program, :sigterm, @exit_timeout))
+    end
+  end
+
+  defp escalate(state, program, :sigterm) do
     Logger.debug("Failed to stop external program gracefully. attempting SIGTERM")
-    Nif.nif_kill(os_pid, :sigterm)
-    process_exit?(os_pid, 100) && throw(:done)
+    Nif.nif_kill(program.os_pid, :sigterm)
+    put_program(state, schedule(program, :sigkill, @sigterm_timeout))
+  end
 
+  defp escalate(state, program, :sigkill) do
     Logger.debug("Failed to stop external program with SIGTERM. attempting SIGKILL")
-    Nif.nif_kill(os_pid, :sigkill)
-    process_exit?(os_pid, 200) && throw(:done)
+    Nif.nif_kill(program.os_pid, :sigkill)
+    put_program(state, schedule(program, :failed, @sigkill_timeout))
+  end
 
-    Logger.error("failed to kill external process")
-    raise "Failed to kill external process"
-  catch
-    :done ->
+  # other programs of the shard are still watched, so we only give up
+  # on this one
+  defp escalate(state, program, :failed) do
+    Logger.error("failed to kill external process. os_pid: #{program.os_pid}")
+    forget(state, program)
+  end
+
+  defp exited(state, program) do
+    Telemetry.stop([:exile, :kill], program.kill_start, %{os_pid: program.os_pid})
+    forget(state, program)
+  end
+
+  defp forget(state, program) do
+    cancel_timer(program)
+
+    exit_fds =
+      case program.exit_fd do
+        nil ->
+          state.exit_fds
+
+        exit_fd ->
+          Nif.nif_close(exit_fd)
+          Map.delete(state.exit_fds, exit_fd)
+      end
+
+    %{state | programs: Map.delete(state.programs, program.ref), exit_fds: exit_fds}
+  end
+
+  defp put_program(state, program) do
+    %{state | programs: Map.put(state.programs, program.ref, program)}
+  end
+
+  defp put_exit_fd(state, %{exit_fd: nil}), do: state
+
+  defp put_exit_fd(state, %{exit_fd: exit_fd, ref: ref}) do
+    %{state | exit_fds: Map.put(state.exit_fds, exit_fd, ref)}
+  end
+
+  # commands spawned by the spawner daemon do not have a socket path
+  defp remove_socket(nil), do: :ok
+  defp remove_socket(socket_path), do: File.rm(socket_path)
+
+  defp watch_exit(os_pid) do
+    case Nif.nif_watch_process_exit(os_pid) do
+      {:ok, exit_fd} ->
+        exit_fd
+
+      # not supported by the platform or the program is already reaped
+      _ ->
+        nil
+    end
+  end
+
+  defp schedule(program, stage, timeout) do
+    timer = Elixir.Process.send_after(self(), {:escalate, program.ref, stage}, timeout)
+    %{program | timer: timer}
+  end
+
+  defp cancel_timer(%{timer: nil}), do: :ok
+  defp cancel_timer(%{timer: timer}), do: Elixir.Process.cancel_timer(timer)
+
+  # We are shutting down, so there is no room for an asynchronous
+  # escalation here. All programs of the shard go through each stage
+  # together, so shutdown takes at most the sum of the stage timeouts
+  # irrespective of the number of programs
+  defp attempt_graceful_exit(programs) do
+    os_pids = Enum.map(programs, & &1.os_pid)
+
+    Logger.debug("Failed to stop external program gracefully. attempting SIGTERM")
+    os_pids = signal_alive(os_pids, :sigterm)
+    os_pids = await_exit(os_pids, @sigterm_timeout)
+
+    Logger.debug("Failed to stop external program with SIGTERM. attempting SIGKILL")
+    os_pids = signal_alive(os_pids, :sigkill)
+    os_pids = await_exit(os_pids, @sigkill_timeout)
+
+    if os_pids == [] do
       Logger.debug(fn -> "External program exited successfully" end)
+    else
+      Logger.error("failed to kill external process. os_pids: #{inspect(os_pids)}")
+    end
   end
 
-  defp process_exit?(os_pid), do: !Nif.nif_is_os_pid_alive(os_pid)
+  defp signal_alive(os_pids, signal) do
+    os_pids = Enum.reject(os_pids, &process_exit?/1)
+    Enum.each(os_pids, &Nif.nif_kill(&1, signal))
+    os_pids
+  end
+
+  # returns the programs which are still alive after the timeout
+  defp await_exit([], _timeout), do: []
 
-  defp process_exit?(os_pid, timeout) do
-    if process_exit?(os_pid) do
-      true
+  defp await_exit(os_pids, timeout) do
+    os_pids = Enum.reject(os_pids, &process_exit?/1)
+
+    if os_pids == [] or timeout <= 0 do
+      os_pids
     else
-      :timer.sleep(timeout)
-      process_exit?(os_pid)
+      :timer.sleep(@poll_interval)
+      await_exit(os_pids, timeout - @poll_interval)
     end
   end
+
+  defp process_exit?(os_pid), do: !Nif.nif_is_os_pid_alive(os_pid)
+
+  defp shard, do: rem(:erlang.system_info(:scheduler_id) - 1, shard_count()) + 1
+
+  defp shard_count, do: :erlang.system_info(:schedulers)
+
+  # names are created once per shard at start
+  defp name(shard), do: :"#{__MODULE__}.#{shard}"
 end
@@ -54,6 +54,7 @@ defmodule Exile.MixProject do
   defp deps do
     [
       {:elixir_make, "~> 0.6", runtime: false},
+      {:telemetry, "~> 1.0", optional: true},
 
       # development & test
       {:credo, "~> 1.6", only: [:dev, :test], runtime: false},
@@ -0,0 +1,68 @@
+defmodule Exile.ExecutableCacheTest do
+  # modifies PATH and application env
+  use ExUnit.Case, async: false
+  alias Exile.ExecutableCache
+
+  setup do
+    path = System.get_env("PATH")
+    dir = Path.join(System.tmp_dir!(), "exile_cache_#{System.unique_integer([:positive])}")
+    File.mkdir_p!(dir)
+    ExecutableCache.clear()
+
+    on_exit(fn ->
+      System.put_env("PATH", path)
+      Application.delete_env(:exile, :executable_cache_ttl)
+      File.rm_rf!(dir)
+    end)
+
+    %{dir: dir, path: path}
+  end
+
+  test "caches resolved path", %{dir: dir, path: path} do
+    script = create_script(dir, "exile-cache-test")
+    System.put_env("PATH", dir <> ":" <> path)
+
+    assert ExecutableCache.find_executable("exile-cache-test") == script
+
+    # served from the cache even though the file is gone
+    File.rm!(script)
+    assert ExecutableCache.find_executable("exile-cache-test") == script
+  end
+
+  test "PATH change invalidates the cache", %{dir: dir, path: path} do
+    script = create_script(dir, "exile-cache-test")
+    System.put_env("PATH", dir <> ":" <> path)
+    assert ExecutableCache.find_executable("exile-cache-test") == script
+
+    System.put_env("PATH", path)
+    assert ExecutableCache.find_executable("exile-cache-test") == nil
+  end
+
+  test "entries expire after ttl", %{dir: dir, path: path} do
+    Application.put_env(:exile, :executable_cache_ttl, 50)
+    script = create_script(dir, "exile-cache-test")
+    System.put_env("PATH", dir <> ":" <> path)
+    assert ExecutableCache.find_executable("exile-cache-test") == script
+
+    File.rm!(script)
+    :timer.sleep(100)
+    assert ExecutableCache.find_executable("exile-cache-test") == nil
+  end
+
+  test "when cache is disabled", %{dir: dir, path: path} do
+    Application.put_env(:exile, :executable_cache_ttl, 0)
+    script = create_script(dir, "exile-cache-test")
+    System.put_env("PATH", dir <> ":" <> path)
+    assert ExecutableCache.find_executable("exile-cache-test") == script
+
+    File.rm!(script)
+    assert ExecutableCache.find_executable("exile-cache-test") == nil
+  end
+
+  defp create_script(dir, name) do
+    script = Path.join(dir, name)
+    File.write!(script, "#!/bin/sh\necho hello\n")
+    File.chmod!(script, 0o755)
+    script
+  end
+end
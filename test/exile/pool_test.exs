@@ -0,0 +1,125 @@
+defmodule Exile.PoolTest do
+  use ExUnit.Case, async: true
+
+  alias Exile.Pool
+  alias Exile.Process
+
+  doctest Exile.Pool
+
+  test "worker is reused after checkin" do
+    {:ok, pool} = Pool.start_link(~w(cat), size: 1)
+
+    {:ok, p} = Pool.checkout(pool)
+    assert :ok == Process.write(p, "hello")
+    assert {:ok, "hello"} == Process.read(p, 5)
+    {:ok, os_pid} = Process.os_pid(p)
+    Pool.checkin(pool, p)
+
+    {:ok, p} = Pool.checkout(pool)
+    assert {:ok, ^os_pid} = Process.os_pid(p)
+    assert :ok == Process.write(p, "world")
+    assert {:ok, "world"} == Process.read(p, 5)
+    Pool.checkin(pool, p)
+
+    assert :ok == Pool.stop(pool)
+  end
+
+  test "pipes are owned by the caller" do
+    {:ok, pool} = Pool.start_link(~w(cat), size: 1)
+
+    result =
+      Task.async(fn ->
+        Pool.transaction(pool, fn p ->
+          :ok = Process.write(p, "hello")
+          Process.read(p, 5)
+        end)
+      end)
+      |> Task.await()
+
+    assert {:ok, "hello"} == result
+
+    {:ok, p} = Pool.checkout(pool)
+    assert {:ok, _} = Process.direct_pipe(p, :stdout)
+
+    assert {:error, :pipe_closed_or_invalid_caller} =
+             Task.async(fn -> Process.direct_pipe(p, :stdout) end) |> Task.await()
+
+    Pool.checkin(pool, p)
+  end
+
+  test "grows up to max_size and shrinks when idle" do
+    {:ok, pool} = Pool.start_link(~w(cat), size: 1, max_size: 2, idle_timeout: 100)
+
+    {:ok, p1} = Pool.checkout(pool)
+    {:ok, p2} = Pool.checkout(pool)
+    assert %{size: 2, busy: 2, idle: 0} = Pool.info(pool)
+
+    assert {:error, :timeout} == Pool.checkout(pool, 100)
+    assert %{waiting: 0} = Pool.info(pool)
+
+    Pool.checkin(pool, p1)
+    Pool.checkin(pool, p2)
+    assert %{size: 2, idle: 2} = Pool.info(pool)
+
+    :timer.sleep(300)
+    assert %{size: 1, idle: 1} = Pool.info(pool)
+  end
+
+  test "waiting caller gets the worker on checkin" do
+    {:ok, pool} = Pool.start_link(~w(cat), size: 1)
+    {:ok, p} = Pool.checkout(pool)
+
+    waiter = Task.async(fn -> Pool.checkout(pool) end)
+    :timer.sleep(50)
+    assert %{waiting: 1} = Pool.info(pool)
+
+    Pool.checkin(pool, p)
+    assert {:ok, %Process{pid: pid}} = Task.await(waiter)
+    assert pid == p.pid
+  end
+
+  test "worker is replaced when the caller exits holding it" do
+    {:ok, pool} = Pool.start_link(~w(cat), size: 1)
+
+    {:ok, os_pid} =
+      Task.async(fn ->
+        {:ok, p} = Pool.checkout(pool)
+        Process.os_pid(p)
+      end)
+      |> Task.await()
+
+    :timer.sleep(100)
+    assert %{size: 1, idle: 1} = Pool.info(pool)
+
+    {:ok, p} = Pool.checkout(pool)
+    assert {:ok, new_os_pid} = Process.os_pid(p)
+    assert new_os_pid != os_pid
+    assert :ok == Process.write(p, "hello")
+    assert {:ok, "hello"} == Process.read(p, 5)
+  end
+
+  test "worker is replaced when the program exits" do
+    {:ok, pool} = Pool.start_link(~w(cat), size: 1)
+
+    {:ok, p} = Pool.checkout(pool)
+    {:ok, os_pid} = Process.os_pid(p)
+    :ok = Process.close_stdin(p)
+    assert :eof == Process.read(p)
+    Pool.checkin(pool, p)
+
+    {:ok, p} = Pool.checkout(pool)
+    assert {:ok, new_os_pid} = Process.os_pid(p)
+    assert new_os_pid != os_pid
+    Pool.checkin(pool, p)
+  end
+
+  test "when options are invalid" do
+    Elixir.Process.flag(:trap_exit, true)
+
+    assert {:error, ":size must be a positive integer"} = Pool.start_link(~w(cat), size: 0)
+
+    assert {:error, ":max_size must be" <> _} = Pool.start_link(~w(cat), size: 2, max_size: 1)
+
+    assert {:error, "command not found: " <> _} = Pool.start_link(~w(nonexistent-command))
+  end
+end
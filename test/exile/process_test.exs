@@ -2,7 +2,7 @@ defmodule Exile.ProcessTest do
   use ExUnit.Case, async: true
 
   alias Exile.Process
-  alias Exile.Process.{Pipe, State}
+  alias Exile.Process.{Exec, Pipe, State}
 
   doctest Exile.Process
 
@@ -43,6 +43,20 @@ defmodule Exile.ProcessTest do
       refute Elixir.Process.alive?(s.pid)
     end
 
+    test "write iodata to stdin" do
+      {:ok, s} = Process.start_link(~w(cat))
+
+      assert :ok == Process.write(s, ["he", [?l, "l"], [[], "o"]])
+      assert {:ok, iodata} = Process.read(s, 5)
+      assert IO.iodata_to_binary(iodata) == "hello"
+
+      assert :ok == Process.write(s, "")
+
+      assert :ok == Process.close_stdin(s)
+      assert :eof == Process.read(s)
+      assert {:ok, 0} == Process.await_exit(s, 100)
+    end
+
     test "when stdin is closed" do
       logger = start_events_collector()
 
@@ -78,6 +92,185 @@ defmodule Exile.ProcessTest do
              ] == get_events(logger)
     end
 
+    test "reading with drain_reads" do
+      size = 5 * 65_535
+
+      {:ok, s} =
+        Process.start_link(~w(head -c #{size} /dev/zero), drain_reads: true, max_chunk_size: size)
+
+      iodata =
+        Stream.unfold(nil, fn _ ->
+          case Process.read(s) do
+            {:ok, data} -> {data, nil}
+            :eof -> nil
+          end
+        end)
+        |> Enum.to_list()
+
+      assert IO.iodata_length(iodata) == size
+      assert {:ok, 0} == Process.await_exit(s, 500)
+    end
+
+    test "reading with line framing" do
+      {:ok, s} = Process.start_link(~w(cat), framing: :lines, max_chunk_size: 4)
+
+      :ok = Process.write(s, "one\ntw")
+      assert {:ok, ["one"]} = Process.read(s)
+
+      # record larger than the read size is not split
+      :ok = Process.write(s, "o\nthree\nfour five six")
+      assert {:ok, records} = read_records(s, 2)
+      assert records == ["two", "three"]
+
+      :ok = Process.close_stdin(s)
+      assert {:ok, ["four five six"]} = Process.read(s)
+      assert :eof = Process.read(s)
+      assert {:ok, 0} == Process.await_exit(s, 500)
+    end
+
+    test "reading length prefixed records" do
+      {:ok, s} = Process.start_link(~w(cat), framing: {:length_prefixed, 2})
+
+      :ok = Process.write(s, [<<3::16>>, "foo", <<0::16>>, <<5::16>>, "ba"])
+      assert {:ok, ["foo", ""]} = Process.read(s)
+
+      :ok = Process.write(s, ["rrr", <<4::16>>, "ba"])
+      assert {:ok, ["barrr"]} = Process.read(s)
+
+      :ok = Process.close_stdin(s)
+      assert {:error, :incomplete_record} = Process.read(s)
+      assert {:ok, 0} == Process.await_exit(s, 500)
+    end
+
+    test "reading records much larger than the pipe" do
+      {:ok, s} = Process.start_link(~w(cat), framing: {:length_prefixed, 4})
+      record = :binary.copy("a", 4 * 1024 * 1024)
+
+      writer =
+        Task.async(fn ->
+          :ok = Process.change_pipe_owner(s, :stdin, self())
+          :ok = Process.write(s, [<<byte_size(record)::32>>, record, <<2::32>>, "ok"])
+          :ok = Process.close_stdin(s)
+        end)
+
+      assert {:ok, [^record, "ok"]} = read_records(s, 2)
+      assert :eof = Process.read(s)
+      assert :ok = Task.await(writer)
+      assert {:ok, 0} == Process.await_exit(s, 500)
+    end
+
+    test "reading records larger than max_record_size" do
+      {:ok, s} = Process.start_link(~w(cat), framing: :lines, max_record_size: 8)
+      long = :binary.copy("x", 1024 * 1024)
+
+      writer =
+        Task.async(fn ->
+          :ok = Process.change_pipe_owner(s, :stdin, self())
+          :ok = Process.write(s, ["short\n", long, "\nafter\n"])
+          :ok = Process.close_stdin(s)
+        end)
+
+      assert {:ok, ["short"]} = Process.read(s)
+      assert {:error, :record_too_large} = Process.read(s)
+      # rest of the long record is dropped
+      assert {:ok, ["after"]} = Process.read(s)
+      assert :eof = Process.read(s)
+      assert :ok = Task.await(writer)
+      assert {:ok, 0} == Process.await_exit(s, 500)
+
+      {:ok, s} =
+        Process.start_link(~w(cat), framing: {:length_prefixed, 2}, max_record_size: 8)
+
+      :ok = Process.write(s, [<<3::16>>, "foo", <<9::16>>, "123456789", <<2::16>>, "ok"])
+      :ok = Process.close_stdin(s)
+      assert {:ok, ["foo"]} = Process.read(s)
+      assert {:error, :record_too_large} = Process.read(s)
+      assert {:ok, ["ok"]} = Process.read(s)
+      assert {:ok, 0} == Process.await_exit(s, 500)
+    end
+
+    test "direct read and write" do
+      {:ok, s} = Process.start_link(~w(cat))
+      {:ok, stdin} = Process.direct_pipe(s, :stdin)
+      {:ok, stdout} = Process.direct_pipe(s, :stdout)
+
+      assert :ok == Process.direct_write(stdin, ["hello", [" ", "world"]])
+      assert {:ok, "hello world"} = Process.direct_read(stdout, 100)
+
+      assert :ok == Process.close_stdin(s)
+      assert :eof == Process.direct_read(stdout, 100)
+      assert {:ok, 0} == Process.await_exit(s, 100)
+    end
+
+    test "direct write larger than pipe buffer size from pipe owner" do
+      large_bin = generate_binary(5 * 65_535)
+      {:ok, s} = Process.start_link(~w(cat))
+
+      writer =
+        Task.async(fn ->
+          :ok = Process.change_pipe_owner(s, :stdin, self())
+          {:ok, stdin} = Process.direct_pipe(s, :stdin)
+          Process.direct_write(stdin, large_bin)
+        end)
+
+      {:ok, stdout} = Process.direct_pipe(s, :stdout)
+
+      iodata =
+        Stream.unfold(nil, fn _ ->
+          case Process.direct_read(stdout, 65_535) do
+            {:ok, data} -> {data, nil}
+            :eof -> nil
+          end
+        end)
+        |> Enum.to_list()
+
+      assert :ok == Task.await(writer)
+      assert IO.iodata_length(iodata) == 5 * 65_535
+      assert {:ok, 0} == Process.await_exit(s, 500)
+    end
+
+    test "direct pipe can only be taken by the pipe owner" do
+      {:ok, s} = Process.start_link(~w(cat))
+
+      assert {:error, :pipe_closed_or_invalid_caller} =
+               Task.async(fn -> Process.direct_pipe(s, :stdin) end) |> Task.await()
+
+      assert {:error, :pipe_closed_or_invalid_caller} = Process.direct_pipe(s, :stderr)
+      assert {:ok, 0} == Process.await_exit(s, 100)
+    end
+
+    test "splice output of one process to another" do
+      size = 5 * 65_535
+      {:ok, src_proc} = Process.start_link(["head", "-c", to_string(size), "/dev/zero"])
+      {:ok, dst_proc} = Process.start_link(~w(wc -c))
+
+      {:ok, src} = Process.direct_pipe(src_proc, :stdout)
+      {:ok, dst} = Process.direct_pipe(dst_proc, :stdin)
+
+      assert {:ok, ^size} = Process.splice(src, dst)
+      assert :ok == Process.close_stdin(dst_proc)
+      assert {:ok, output} = Process.read(dst_proc)
+      assert String.trim(output) == to_string(size)
+
+      assert {:ok, 0} == Process.await_exit(src_proc, 500)
+      assert {:ok, 0} == Process.await_exit(dst_proc, 500)
+    end
+
+    test "splice output to a socket fd" do
+      {:ok, listen} = :gen_tcp.listen(0, [:binary, active: false])
+      {:ok, port} = :inet.port(listen)
+      {:ok, client} = :gen_tcp.connect({127, 0, 0, 1}, port, [:binary, active: false])
+      {:ok, server} = :gen_tcp.accept(listen)
+      {:ok, fd} = :inet.getfd(client)
+
+      {:ok, s} = Process.start_link(~w(echo hello))
+      {:ok, stdout} = Process.direct_pipe(s, :stdout)
+
+      assert {:ok, 6} == Process.splice(stdout, {:fd, fd})
+      assert {:ok, "hello\n"} == :gen_tcp.recv(server, 6, 1000)
+      assert {:ok, 0} == Process.await_exit(s, 500)
+    end
+
     test "reading from stderr" do
       {:ok, s} = Process.start_link(["sh", "-c", "echo foo >>/dev/stderr"], stderr: :consume)
       assert {:ok, "foo\n"} = Process.read_stderr(s, 100)
@@ -100,6 +293,22 @@ defmodule Exile.ProcessTest do
       assert :eof = Process.read_any(s, 100)
     end
 
+    test "read_any does not starve stderr" do
+      script = """
+      echo "bar" >&2
+      head -c 200000 /dev/zero
+      """
+
+      {:ok, s} = Process.start_link(["sh", "-c", script], stderr: :consume)
+      # let both pipes fill up
+      :timer.sleep(200)
+
+      {:ok, {stream1, _}} = Process.read_any(s, 1000)
+      {:ok, {stream2, _}} = Process.read_any(s, 1000)
+
+      assert Enum.sort([stream1, stream2]) == [:stderr, :stdout]
+    end
+
     test "reading from stderr_read when stderr disabled" do
       {:ok, s} = Process.start_link(["sh", "-c", "echo foo >>/dev/stderr"], stderr: :console)
 
@@ -268,6 +477,68 @@ defmodule Exile.ProcessTest do
       assert {:ok, 0} == Process.await_exit(s, 500)
     end
 
+    test "writing iodata larger than pipe buffer size" do
+      chunks = Enum.map(1..10_000, fn i -> ["chunk-", Integer.to_string(i), ?\n] end)
+      expected = IO.iodata_to_binary(chunks)
+      {:ok, s} = Process.start_link(~w(cat))
+
+      writer =
+        Task.async(fn ->
+          Process.change_pipe_owner(s, :stdin, self())
+          Process.write(s, chunks)
+        end)
+
+      iodata =
+        Stream.unfold(nil, fn _ ->
+          case Process.read(s) do
+            {:ok, data} -> {data, nil}
+            :eof -> nil
+          end
+        end)
+        |> Enum.to_list()
+
+      assert :ok == Task.await(writer)
+      assert IO.iodata_to_binary(iodata) == expected
+      assert {:ok, 0} == Process.await_exit(s, 500)
+    end
+
+    test "writing a multi-megabyte binary in chunks" do
+      size = 16 * 1024 * 1024
+      {:ok, s} = Process.start_link(["sh", "-c", "cat > /dev/null"])
+
+      assert :ok == Process.write(s, :binary.copy("A", size))
+      assert {:ok, %{stdin: %{bytes_written: ^size}}} = Process.stats(s)
+
+      :ok = Process.close_stdin(s)
+      assert {:ok, 0} == Process.await_exit(s, 500)
+    end
+
+    @tag :linux
+    test "reading more than default pipe buffer size in a single read" do
+      size = 1024 * 1024
+
+      {:ok, s} =
+        Process.start_link(~w(head -c #{size} /dev/zero), max_chunk_size: size, pipe_size: size)
+
+      # let the command fill the pipe
+      :timer.sleep(200)
+
+      assert {:ok, data} = Process.read(s)
+      assert IO.iodata_length(data) > 65_535
+
+      rest =
+        Stream.unfold(nil, fn _ ->
+          case Process.read(s) do
+            {:ok, data} -> {data, nil}
+            :eof -> nil
+          end
+        end)
+        |> Enum.to_list()
+
+      assert IO.iodata_length([data | rest]) == size
+      assert {:ok, 0} == Process.await_exit(s, 500)
+    end
+
     test "if exile process is terminated on owner exit even if pipe owner is alive" do
       parent = self()
 
@@ -490,6 +761,56 @@ defmodule Exile.ProcessTest do
            ] = open_files
   end
 
+  @tag :linux
+  test "spawner handshake does not create a socket file" do
+    # abstract socket addresses are supported by `:socket` from OTP 24
+    if String.to_integer(System.otp_release()) >= 24 do
+      assert "@exile-" <> _ = socket_path = Exec.socket_path()
+      assert nil == Exec.socket_file(socket_path)
+    end
+
+    for spawner <- [:port, :daemon] do
+      {:ok, s} = Process.start_link(~w(echo hello), spawner: spawner)
+      assert {:ok, "hello\n"} == Process.read(s)
+      assert {:ok, 0} == Process.await_exit(s)
+    end
+  end
+
+  @tag :linux
+  test "spawner handshake rejects a foreign peer" do
+    socket_path = Exec.socket_path()
+    {:ok, lsock} = :socket.open(:local, :stream, :default)
+    :ok = Exec.socket_bind(lsock, socket_path)
+    :ok = :socket.listen(lsock)
+
+    address =
+      case socket_path do
+        "@" <> name -> <<0, name::binary>>
+        path -> path
+      end
+
+    # connects before the spawner
+    {:ok, foreign} = :socket.open(:local, :stream, :default)
+    :ok = :socket.connect(foreign, %{family: :local, path: address})
+
+    args = [socket_path, "pipe", "pipe", "console", "true"]
+    port = Port.open({:spawn_executable, Exec.spawner_path()}, [:nouse_stdio, args: args])
+    {:os_pid, os_pid} = Port.info(port, :os_pid)
+
+    log =
+      ExUnit.CaptureLog.capture_log(fn ->
+        assert {:ok, sock} = Exec.accept_spawner(lsock, os_pid)
+        :socket.close(sock)
+      end)
+
+    assert log =~ "rejected spawner connection. reason: :invalid_peer"
+    assert {:error, :closed} = :socket.recv(foreign, 0, 1000)
+
+    :socket.close(foreign)
+    :socket.close(lsock)
+    Exec.remove_socket_file(socket_path)
+  end
+
   describe "options and validation" do
     test "cd option" do
       parent = Path.expand("..", File.cwd!())
@@ -504,6 +825,32 @@ defmodule Exile.ProcessTest do
       assert {:error, _} = Process.start_link(~w(sh -c pwd), cd: "invalid")
     end
 
+    test "when pipe_size or max_chunk_size is invalid" do
+      assert {:error, ":pipe_size must be a positive integer"} =
+               Process.start_link(~w(cat), pipe_size: 0)
+
+      assert {:error, ":max_chunk_size must be a positive integer"} =
+               Process.start_link(~w(cat), max_chunk_size: :infinity)
+    end
+
+    test "when framing is invalid" do
+      assert {:error, ":framing must be one of" <> _} =
+               Process.start_link(~w(cat), framing: {:length_prefixed, 3})
+
+      assert {:error, ":framing must be one of" <> _} =
+               Process.start_link(~w(cat), framing: {:delimiter, 256})
+    end
+
+    test "when max_record_size is invalid" do
+      assert {:error, ":max_record_size must be a positive integer or :infinity"} =
+               Process.start_link(~w(cat), framing: :lines, max_record_size: 0)
+    end
+
+    test "when nif_scheduler is invalid" do
+      assert {:error, ":nif_scheduler must be either :dirty_io or :normal"} =
+               Process.start_link(~w(cat), nif_scheduler: :dirty_cpu)
+    end
+
     test "when user pass invalid option" do
       assert {:error, "invalid opts: [invalid: :test]"} =
                Process.start_link(~w(cat), invalid: :test)
@@ -535,6 +882,452 @@ defmodule Exile.ProcessTest do
     end
   end
 
+  describe "spawner daemon" do
+    test "read and write" do
+      {:ok, s} = Process.start_link(~w(cat), spawner: :daemon)
+
+      assert :ok == Process.write(s, "hello")
+      assert {:ok, "hello"} = Process.read(s)
+      assert :ok == Process.close_stdin(s)
+      assert :eof == Process.read(s)
+      assert {:ok, 0} == Process.await_exit(s)
+    end
+
+    test "exit status" do
+      {:ok, s} = Process.start_link(["sh", "-c", "exit 10"], spawner: :daemon)
+      assert {:ok, 10} == Process.await_exit(s)
+    end
+
+    test "exit status when killed" do
+      {:ok, s} = Process.start_link(~w(cat), spawner: :daemon)
+      {:ok, os_pid} = Process.os_pid(s)
+      assert os_process_alive?(os_pid)
+
+      assert :ok == Process.kill(s, :sigkill)
+      assert {:ok, 137} == Process.await_exit(s)
+      refute os_process_alive?(os_pid)
+    end
+
+    test "cd, env and stderr" do
+      :ok = System.put_env([{"BEAM_ENV_B", "base"}])
+      parent = Path.expand("..", File.cwd!())
+
+      {:ok, s} =
+        Process.start_link(["sh", "-c", "echo $BEAM_ENV_B $TEST_ENV; pwd; echo foo >&2"],
+          spawner: :daemon,
+          cd: parent,
+          env: %{"TEST_ENV" => "test"},
+          stderr: :consume
+        )
+
+      assert {:ok, "foo\n"} = Process.read_stderr(s)
+      assert :eof == Process.read_stderr(s)
+
+      output =
+        Stream.unfold(nil, fn _ ->
+          case Process.read(s) do
+            {:ok, data} -> {data, nil}
+            :eof -> nil
+          end
+        end)
+        |> Enum.join()
+
+      assert output == "base test\n#{parent}\n"
+      assert {:ok, 0} == Process.await_exit(s)
+    end
+
+    test "many concurrent processes" do
+      tasks =
+        for i <- 1..50 do
+          Task.async(fn ->
+            {:ok, s} = Process.start_link(["echo", to_string(i)], spawner: :daemon)
+            {:ok, data} = Process.read(s)
+            {:ok, 0} = Process.await_exit(s)
+            data
+          end)
+        end
+
+      assert Enum.map(tasks, &Task.await/1) == Enum.map(1..50, &"#{&1}\n")
+    end
+
+    test "when spawner is invalid" do
+      assert {:error, ":spawner must be one of :port, :daemon"} =
+               Process.start_link(~w(cat), spawner: :invalid)
+    end
+  end
+
+  describe "redirect" do
+    setup do
+      path = Path.join(System.tmp_dir!(), "exile_redirect_#{System.unique_integer([:positive])}")
+      on_exit(fn -> File.rm(path) end)
+      %{path: path}
+    end
+
+    for spawner <- [:port, :daemon] do
+      test "stderr to stdout with #{spawner} spawner" do
+        {:ok, s} =
+          Process.start_link(["sh", "-c", "echo out; echo err >&2; echo out"],
+            stderr: :redirect_to_stdout,
+            spawner: unquote(spawner)
+          )
+
+        assert {:ok, "out\nerr\nout\n"} == read_until_eof(s)
+        assert {:error, :pipe_closed_or_invalid_caller} == Process.read_stderr(s)
+        assert {:ok, 0} == Process.await_exit(s)
+      end
+    end
+
+    test "stderr to stdout with stdout redirected to a file", %{path: path} do
+      {:ok, s} =
+        Process.start_link(["sh", "-c", "echo out; echo err >&2"],
+          stdout: {:file, path},
+          stderr: :redirect_to_stdout
+        )
+
+      assert :eof == Process.read(s)
+      assert {:ok, 0} == Process.await_exit(s)
+      assert File.read!(path) == "out\nerr\n"
+    end
+
+    test "when stderr to stdout is used with ring" do
+      assert {:error, ":stderr :redirect_to_stdout is not supported with :ring stdout"} =
+               Process.start_link(~w(cat), stdout: {:ring, 4096}, stderr: :redirect_to_stdout)
+    end
+
+    for spawner <- [:port, :daemon] do
+      test "stdout to a file with #{spawner} spawner", %{path: path} do
+        {:ok, s} =
+          Process.start_link(~w(echo hello), stdout: {:file, path}, spawner: unquote(spawner))
+
+        assert :eof == Process.read(s)
+        assert {:ok, 0} == Process.await_exit(s)
+        assert File.read!(path) == "hello\n"
+      end
+
+      test "stdout to a socket fd with #{spawner} spawner" do
+        {:ok, listen} = :gen_tcp.listen(0, [:binary, active: false])
+        {:ok, port} = :inet.port(listen)
+        {:ok, client} = :gen_tcp.connect({127, 0, 0, 1}, port, [:binary, active: false])
+        {:ok, server} = :gen_tcp.accept(listen)
+        {:ok, fd} = :inet.getfd(client)
+
+        {:ok, s} =
+          Process.start_link(~w(echo hello), stdout: {:fd, fd}, spawner: unquote(spawner))
+
+        assert {:ok, 0} == Process.await_exit(s)
+        assert {:ok, "hello\n"} == :gen_tcp.recv(server, 6, 1000)
+      end
+
+      test "stderr to a file with #{spawner} spawner", %{path: path} do
+        {:ok, s} =
+          Process.start_link(["sh", "-c", "echo foo; echo bar >&2"],
+            stderr: {:file, path},
+            spawner: unquote(spawner)
+          )
+
+        assert {:ok, "foo\n"} == Process.read(s)
+        assert {:ok, 0} == Process.await_exit(s)
+        assert File.read!(path) == "bar\n"
+      end
+    end
+
+    test "stdin from a file", %{path: path} do
+      File.write!(path, "hello")
+      {:ok, s} = Process.start_link(~w(cat), stdin: {:file, path}, spawner: :daemon)
+
+      assert {:ok, "hello"} == Process.read(s)
+      assert :eof == Process.read(s)
+      assert {:ok, 0} == Process.await_exit(s)
+    end
+
+    test "stream to a file", %{path: path} do
+      assert [{:exit, {:status, 0}}] ==
+               Exile.stream(~w(cat), input: ["foo", "bar"], stdout: {:file, path})
+               |> Enum.to_list()
+
+      assert File.read!(path) == "foobar"
+    end
+
+    test "when redirect is invalid" do
+      assert {:error, ":stdout must be one of" <> _} =
+               Process.start_link(~w(cat), stdout: {:file, :invalid})
+
+      assert {:error, ":stderr must be one of" <> _} =
+               Process.start_link(~w(cat), stderr: {:fd, -1})
+
+      assert {:error, ":stdin must be one of" <> _} =
+               Process.start_link(~w(cat), stdin: :invalid)
+    end
+  end
+
+  describe "ring" do
+    for spawner <- [:port, :daemon] do
+      test "reading stdout from the ring with #{spawner} spawner" do
+        {:ok, s} =
+          Process.start_link([fixture("write_ring.sh")],
+            stdout: {:ring, 4096},
+            spawner: unquote(spawner)
+          )
+
+        assert {:ok, "hello"} == Process.read(s)
+        assert :eof == Process.read(s)
+        assert {:ok, 0} == Process.await_exit(s)
+      end
+    end
+
+    @tag :linux
+    test "ring can not be resized by the command" do
+      {:ok, s} =
+        Process.start_link(["sh", "-c", "truncate -s 0 /dev/fd/3 2>/dev/null"],
+          stdout: {:ring, 4096}
+        )
+
+      assert :eof == Process.read(s)
+      assert {:ok, 1} == Process.await_exit(s)
+    end
+
+    test "when ring is invalid" do
+      assert {:error, ":stdout ring capacity must be" <> _} =
+               Process.start_link(~w(cat), stdout: {:ring, 5000})
+
+      assert {:error, ":stdout ring capacity must be" <> _} =
+               Process.start_link(~w(cat), stdout: {:ring, 1024})
+
+      assert {:error, ":stdin must be one of" <> _} =
+               Process.start_link(~w(cat), stdin: {:ring, 4096})
+
+      assert {:error, ":framing is not supported with :ring stdout"} =
+               Process.start_link(~w(cat), stdout: {:ring, 4096}, framing: :lines)
+    end
+  end
+
+  test "stats" do
+    size = 5 * 65_535
+    {:ok, s} = Process.start_link(~w(cat))
+    parent = self()
+
+    # larger than the pipe buffer, so the write has to wait for the reader.
+    # writer keeps the stdin open till we are done, pipe is closed when
+    # the owner exits
+    writer =
+      Task.async(fn ->
+        Process.change_pipe_owner(s, :stdin, self())
+        :ok = Process.write(s, generate_binary(size))
+        send(parent, :written)
+
+        receive do
+          :done -> :ok
+        end
+      end)
+
+    assert read_exactly(s, size) == size
+    assert_receive :written
+
+    assert {:ok, %{stdin: stdin, stdout: stdout, stderr: nil}} = Process.stats(s)
+    assert stdin.bytes_written == size
+    assert stdin.selects > 0
+    assert stdout.bytes_read == size
+
+    send(writer.pid, :done)
+    Task.await(writer)
+    assert {:ok, 0} == Process.await_exit(s, 500)
+  end
+
+  test "stats count each select of a blocked read_any once" do
+    {:ok, s} = Process.start_link(~w(cat), stderr: :consume)
+    parent = self()
+
+    writer =
+      Task.async(fn ->
+        :ok = Process.change_pipe_owner(s, :stdin, self())
+        send(parent, :owner_changed)
+        # let the read block on both pipes
+        :timer.sleep(100)
+        :ok = Process.write(s, "hello")
+      end)
+
+    assert_receive :owner_changed
+    assert {:ok, {:stdout, "hello"}} == Process.read_any(s)
+    assert {:ok, %{stdout: stdout, stderr: stderr}} = Process.stats(s)
+    assert stdout.selects == 1
+    assert stderr.selects == 1
+
+    # stdin is closed when the writer exits
+    :ok = Task.await(writer)
+    assert {:ok, 0} == Process.await_exit(s, 500)
+
+    # ring is always read first, the read arms the select
+    {:ok, s} =
+      Process.start_link(["sh", "-c", "sleep 0.1; exec #{fixture("write_ring.sh")}"],
+        stdout: {:ring, 4096}
+      )
+
+    assert {:ok, {:stdout, "hello"}} == Process.read_any(s)
+    assert {:ok, %{stdout: %{selects: 1}}} = Process.stats(s)
+    assert :eof == Process.read_any(s)
+    assert {:ok, 0} == Process.await_exit(s, 500)
+  end
+
+  test "buffer_pool" do
+    size = 4 * 65_535
+    data = generate_binary(size)
+    {:ok, s} = Process.start_link(~w(cat), buffer_pool: true)
+
+    writer = Task.async(fn -> Process.write(s, data) end)
+    assert IO.iodata_to_binary(read_all(s, size)) == data
+    assert :ok == Task.await(writer)
+
+    # small read is copied, buffer goes straight back to the pool
+    assert :ok == Process.write(s, "hello")
+    assert {:ok, "hello"} == Process.read(s)
+
+    assert {:ok, %{buffer_pool: pool, stdout: %{bytes_read: bytes_read}}} = Process.stats(s)
+    assert bytes_read == size + 5
+    assert pool.allocated + pool.reused > 0
+    assert pool.copied >= 1
+
+    assert :ok == Process.close_stdin(s)
+    assert :eof == Process.read(s)
+    assert {:ok, 0} == Process.await_exit(s)
+  end
+
+  test "buffer_pool is not enabled by default" do
+    {:ok, s} = Process.start_link(~w(cat))
+    assert {:ok, %{buffer_pool: nil}} = Process.stats(s)
+    assert :ok == Process.close_stdin(s)
+    assert {:ok, 0} == Process.await_exit(s)
+  end
+
+  test "IO on normal schedulers" do
+    size = 4 * 65_535
+    data = generate_binary(size)
+    {:ok, s} = Process.start_link(~w(cat), nif_scheduler: :normal, stderr: :consume)
+
+    writer = Task.async(fn -> Process.write(s, data) end)
+    assert IO.iodata_to_binary(read_all(s, size)) == data
+    assert :ok == Task.await(writer)
+
+    assert :ok == Process.write(s, ["hello", " ", "world"])
+    assert {:ok, {:stdout, "hello world"}} == Process.read_any(s)
+
+    assert :ok == Process.close_stdin(s)
+    assert :eof == Process.read(s)
+    assert {:ok, 0} == Process.await_exit(s)
+  end
+
+  describe "start_many" do
+    test "starts all commands in order" do
+      {:ok, processes} = Process.start_many(Enum.map(1..50, &["echo", to_string(&1)]))
+
+      output =
+        Enum.map(processes, fn s ->
+          {:ok, data} = Process.read(s)
+          {:ok, 0} = Process.await_exit(s)
+          data
+        end)
+
+      assert output == Enum.map(1..50, &"#{&1}\n")
+    end
+
+    test "with port spawner and shared options" do
+      {:ok, [s1, s2]} =
+        Process.start_many([["sh", "-c", "echo $TEST_ENV"], ~w(cat)],
+          spawner: :port,
+          env: %{"TEST_ENV" => "test"}
+        )
+
+      assert {:ok, "test\n"} == Process.read(s1)
+      assert {:ok, 0} == Process.await_exit(s1)
+
+      assert :ok == Process.write(s2, "hello")
+      assert {:ok, "hello"} == Process.read(s2)
+      assert :ok == Process.close_stdin(s2)
+      assert {:ok, 0} == Process.await_exit(s2)
+    end
+
+    test "when a command or an option is invalid" do
+      assert {:error, "command not found: \"invalid-command\""} =
+               Process.start_many([~w(echo), ~w(invalid-command)])
+
+      assert {:error, "invalid opts: [invalid: true]"} =
+               Process.start_many([~w(echo)], invalid: true)
+    end
+  end
+
+  describe "notify_spawn" do
+    test "owner is notified when the program is spawned" do
+      {:ok, s} = Process.start_link(~w(cat), notify_spawn: true)
+      pid = s.pid
+
+      # calls made before the spawn completes are queued
+      assert :ok == Process.write(s, "hello")
+      assert_receive {Process, :spawned, ^pid, {:ok, os_pid}}
+      assert {:ok, ^os_pid} = Process.os_pid(s)
+      assert {:ok, "hello"} == Process.read(s)
+
+      assert :ok == Process.close_stdin(s)
+      assert {:ok, 0} == Process.await_exit(s)
+    end
+
+    test "spawn failure is reported without crashing the owner" do
+      Elixir.Process.flag(:trap_exit, true)
+
+      {:ok, s} =
+        Process.start_link(~w(cat),
+          notify_spawn: true,
+          spawner: :daemon,
+          stdin: {:file, "/nonexistent/input"}
+        )
+
+      assert {:error, reason} = Process.await_spawn(s)
+      assert {:error, {:spawn_failed, ^reason}} = Process.await_exit(s)
+      pid = s.pid
+      assert_receive {:EXIT, ^pid, :normal}
+    end
+
+    test "when notify_spawn is invalid" do
+      assert {:error, ":notify_spawn must be a boolean"} =
+               Process.start_link(~w(cat), notify_spawn: :yes)
+    end
+  end
+
+  # records written together might be read separately
+  defp read_records(process, count, acc \\ []) do
+    {:ok, records} = Process.read(process)
+    acc = acc ++ records
+
+    if length(acc) < count do
+      read_records(process, count, acc)
+    else
+      {:ok, acc}
+    end
+  end
+
+  defp read_all(process, size, acc \\ []) do
+    if IO.iodata_length(acc) < size do
+      {:ok, data} = Process.read(process)
+      read_all(process, size, [acc, data])
+    else
+      acc
+    end
+  end
+
+  defp read_until_eof(process, acc \\ []) do
+    case Process.read(process) do
+      {:ok, data} -> read_until_eof(process, [acc, data])
+      :eof -> {:ok, IO.iodata_to_binary(acc)}
+    end
+  end
+
+  defp read_exactly(process, size, total \\ 0) do
+    if total < size do
+      {:ok, data} = Process.read(process)
+      read_exactly(process, size, total + IO.iodata_length(data))
+    else
+      total
+    end
+  end
+
   def start_parallel_reader(process, logger) do
     spawn_link(fn ->
       :ok = Process.change_pipe_owner(process, :stdout, self())
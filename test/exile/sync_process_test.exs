@@ -25,24 +25,40 @@ defmodule Exile.SyncProcessTest do
     # Process.stop(s)
   end
 
-  test "if watcher process exits on command exit" do
-    stop_all_children(Exile.WatcherSupervisor)
-
-    assert %{active: 0, workers: 0} = DynamicSupervisor.count_children(Exile.WatcherSupervisor)
+  test "if watcher forgets the program on command exit" do
+    watching = Exile.Watcher.count()
     assert {:ok, s} = Process.start_link(~w(cat))
 
     # we spawn in background
     :timer.sleep(200)
 
-    assert %{active: 1, workers: 1} = DynamicSupervisor.count_children(Exile.WatcherSupervisor)
+    assert Exile.Watcher.count() == watching + 1
 
     Process.close_stdin(s)
     assert {:ok, 0} = Process.await_exit(s, 500)
-    # Process.stop(s)
 
-    # wait for watcher to terminate
+    # wait for watcher to get the exit
     :timer.sleep(200)
-    assert %{active: 0, workers: 0} = DynamicSupervisor.count_children(Exile.WatcherSupervisor)
+    assert Exile.Watcher.count() == watching
+  end
+
+  test "watchers are shared by the programs" do
+    shards = Supervisor.count_children(Exile.WatcherSupervisor)
+    assert shards.workers == :erlang.system_info(:schedulers)
+
+    processes =
+      Enum.map(1..50, fn _ ->
+        {:ok, s} = Process.start_link(~w(cat))
+        s
+      end)
+
+    :timer.sleep(200)
+    assert Supervisor.count_children(Exile.WatcherSupervisor) == shards
+
+    Enum.each(processes, fn s ->
+      :ok = Process.close_stdin(s)
+      assert {:ok, 0} = Process.await_exit(s, 500)
+    end)
   end
 
   test "FDs are not leaked" do
@@ -71,11 +87,4 @@ defmodule Exile.SyncProcessTest do
     |> String.trim()
     |> String.to_integer()
   end
-
-  defp stop_all_children(sup) do
-    DynamicSupervisor.which_children(sup)
-    |> Enum.each(fn {_, pid, _, _} ->
-      DynamicSupervisor.terminate_child(sup, pid)
-    end)
-  end
 end
@@ -21,6 +21,68 @@ defmodule ExileTest do
     assert IO.iodata_length(stdout) == 1000
   end
 
+  test "stream with many small elements larger than the pipe buffer" do
+    lines = Enum.map(1..100_000, &"line #{&1}\n")
+
+    stdout =
+      Exile.stream!(["cat"], input: lines, input_buffer_size: 4096)
+      |> Enum.into("")
+
+    assert stdout == IO.iodata_to_binary(lines)
+  end
+
+  test "stream with line framing" do
+    lines = Enum.map(1..100_000, &"line #{&1}")
+
+    stdout =
+      Exile.stream!(["cat"], input: Enum.map(lines, &[&1, ?\n]), framing: :lines)
+      |> Enum.to_list()
+
+    assert stdout == lines
+  end
+
+  test "stream with line framing and stderr consume" do
+    stdout =
+      Exile.stream!(["sh", "-c", "printf 'a\\nb\\n'; echo err >&2"],
+        framing: :lines,
+        stderr: :consume
+      )
+      |> Enum.filter(&match?({:stdout, _}, &1))
+
+    assert stdout == [{:stdout, "a"}, {:stdout, "b"}]
+  end
+
+  test "stream with file input" do
+    path = Path.join(System.tmp_dir!(), "exile_input_#{System.unique_integer([:positive])}")
+    data = :binary.copy("0123456789", 100_000)
+    File.write!(path, data)
+
+    try do
+      assert Exile.stream!(~w(cat), input: {:file, path}) |> Enum.into("") == data
+    after
+      File.rm(path)
+    end
+  end
+
+  test "stream with fd input" do
+    {:ok, listen} = :gen_tcp.listen(0, [:binary, active: false])
+    {:ok, port} = :inet.port(listen)
+    {:ok, client} = :gen_tcp.connect({127, 0, 0, 1}, port, [:binary, active: false])
+    {:ok, server} = :gen_tcp.accept(listen)
+    {:ok, fd} = :inet.getfd(server)
+
+    :ok = :gen_tcp.send(client, "hello")
+    :ok = :gen_tcp.close(client)
+
+    assert Exile.stream!(~w(cat), input: {:fd, fd}) |> Enum.into("") == "hello"
+  end
+
+  test "when input_buffer_size is invalid" do
+    assert_raise ArgumentError, ":input_buffer_size must be a positive integer", fn ->
+      Exile.stream!(["cat"], input: ["a"], input_buffer_size: 0)
+    end
+  end
+
   test "stream without stdin" do
     proc_stream = Exile.stream!(~w(echo hello))
     stdout = Enum.to_list(proc_stream)
@@ -46,6 +108,22 @@ defmodule ExileTest do
     assert IO.iodata_to_binary(stderr) == "Hello World\n"
   end
 
+  test "stderr redirected to stdout keeps the order" do
+    script = """
+    for i in $(seq 1 100); do
+      echo "foo ${i}"
+      echo "bar ${i}" >&2
+    done
+    """
+
+    output =
+      Exile.stream!(["sh", "-c", script], stderr: :redirect_to_stdout)
+      |> Enum.into("")
+
+    expected = Enum.map_join(1..100, fn i -> "foo #{i}\nbar #{i}\n" end)
+    assert output == expected
+  end
+
   test "multiple streams" do
     script = """
     for i in {1..1000}; do
@@ -125,6 +203,49 @@ defmodule ExileTest do
     assert exit_status == 5
   end
 
+  describe "run" do
+    test "collects output larger than the pipe buffer" do
+      input = :binary.copy("a", 1024 * 1024)
+      assert {^input, "", 0} = Exile.run(~w(cat), input: input)
+    end
+
+    test "stdout and stderr are drained together" do
+      script = """
+      for i in $(seq 1 2000); do
+        echo "foo ${i}"
+        echo "bar ${i}" >&2
+      done
+      """
+
+      {stdout, stderr, 0} = Exile.run(["sh", "-c", script])
+      assert String.split(stdout, "\n", trim: true) == Enum.map(1..2000, &"foo #{&1}")
+      assert String.split(stderr, "\n", trim: true) == Enum.map(1..2000, &"bar #{&1}")
+    end
+
+    test "output beyond max_output_size is discarded" do
+      input = :binary.copy("a", 200_000)
+      assert {output, "", 0} = Exile.run(~w(cat), input: input, max_output_size: 1000)
+      assert output == :binary.copy("a", 1000)
+    end
+
+    test "with stderr not consumed" do
+      assert {"foo\n", "", 3} =
+               Exile.run(["sh", "-c", "echo foo; echo bar >&2; exit 3"], stderr: :disable)
+    end
+
+    test "when options are invalid" do
+      assert_raise ArgumentError,
+                   ":max_output_size must be :infinity or a non-negative integer",
+                   fn -> Exile.run(~w(cat), max_output_size: -1) end
+
+      assert_raise ArgumentError, ":framing is not supported by Exile.run/2", fn ->
+        Exile.run(~w(cat), framing: :lines)
+      end
+
+      assert_raise ArgumentError, fn -> Exile.run(~w(nonexistent-command)) end
+    end
+  end
+
   defp split_stream(stream) do
     {stdout, stderr} =
       Enum.reduce(stream, {[], []}, fn
@@ -0,0 +1,7 @@
+#!/usr/bin/env bash
+
+# writes "hello" to the shared memory ring (see c_src/exile_ring.h)
+# without the doorbell, the reader sees it when stdout is closed. head
+# counter is little-endian
+printf hello | dd of=/dev/fd/3 bs=1 seek=4096 conv=notrunc 2>/dev/null
+printf '\005\000\000\000\000\000\000\000' | dd of=/dev/fd/3 bs=1 seek=64 conv=notrunc 2>/dev/null